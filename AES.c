@@ -12,7 +12,10 @@
  *
  * Most functions have prototypes in "AES.h" in order to be able to use them separately for their needs
  */
+#include <string.h>
+
 #include "AES.h"
+#include "engineAES.h"
 
 // the number of 32-bit words that make up the encryption key,
 // for AES Nk = 4, 6, or 8
@@ -27,11 +30,15 @@
 #define NR_192 ROUND_AES_192
 #define NR_256 ROUND_AES_256
 
-static const int NkAES[] = {
-        NK_128,
-        NK_192,
-        NK_256
-};
+// the number of blocks that are passed to the engine at once
+#define ENGINE_BATCH 16
+
+// the number of counter blocks that CTR mode passes to the engine at once
+#define CTR_BLOCKS 32
+
+// encryptIntoAES and decryptIntoAES copy and process the data in parts of this size, so that a part is still
+// in the cache when it is encrypted
+#define INTO_CHUNK (256 * AES_BLOCK_SIZE)
 
 static const int keySizeAES[] = {
         KEY_AES_128,
@@ -45,7 +52,7 @@ static const int NrAES[] = {
         NR_256
 };
 
-static const byte Sbox[] = {
+const byte Sbox[256] = {
         0x63, 0x7c, 0x77, 0x7b, 0xf2, 0x6b, 0x6f, 0xc5, 0x30, 0x01, 0x67, 0x2b, 0xfe, 0xd7, 0xab, 0x76,
         0xca, 0x82, 0xc9, 0x7d, 0xfa, 0x59, 0x47, 0xf0, 0xad, 0xd4, 0xa2, 0xaf, 0x9c, 0xa4, 0x72, 0xc0,
         0xb7, 0xfd, 0x93, 0x26, 0x36, 0x3f, 0xf7, 0xcc, 0x34, 0xa5, 0xe5, 0xf1, 0x71, 0xd8, 0x31, 0x15,
@@ -64,7 +71,7 @@ static const byte Sbox[] = {
         0x8c, 0xa1, 0x89, 0x0d, 0xbf, 0xe6, 0x42, 0x68, 0x41, 0x99, 0x2d, 0x0f, 0xb0, 0x54, 0xbb, 0x16
 };
 
-static const byte invSbox[] = {
+const byte invSbox[256] = {
         0x52, 0x09, 0x6a, 0xd5, 0x30, 0x36, 0xa5, 0x38, 0xbf, 0x40, 0xa3, 0x9e, 0x81, 0xf3, 0xd7, 0xfb,
         0x7c, 0xe3, 0x39, 0x82, 0x9b, 0x2f, 0xff, 0x87, 0x34, 0x8e, 0x43, 0x44, 0xc4, 0xde, 0xe9, 0xcb,
         0x54, 0x7b, 0x94, 0x32, 0xa6, 0xc2, 0x23, 0x3d, 0xee, 0x4c, 0x95, 0x0b, 0x42, 0xfa, 0xc3, 0x4e,
@@ -83,7 +90,7 @@ static const byte invSbox[] = {
         0x17, 0x2b, 0x04, 0x7e, 0xba, 0x77, 0xd6, 0x26, 0xe1, 0x69, 0x14, 0x63, 0x55, 0x21, 0x0c, 0x7d
 };
 
-static const word Rcon[] = {0x00000000, 0x01000000, 0x02000000, 0x04000000, 0x08000000, 0x10000000,
+static const uint32_t Rcon[] = {0x00000000, 0x01000000, 0x02000000, 0x04000000, 0x08000000, 0x10000000,
                             0x20000000, 0x40000000, 0x80000000, 0x1b000000, 0x36000000};
 
 #if defined(_WIN32) && defined(_GEN_RAND_KEY)
@@ -101,188 +108,887 @@ int keyGeneration(byte *key, int keySize) {
 
 void setErrMsg(lpcstr msg){ errMsg = msg; }*/
 
+/**
+ * Clears the key material, the volatile pointer keeps the compiler from removing the stores.
+ */
+static void wipeMemory(void *data, size_t dataSize) {
+    volatile byte *ptr = data;
+
+    for (size_t i = 0; i < dataSize; ++i) {
+        ptr[i] = 0;
+    }
+}
+
+/**
+ * Returns 1 for the modes that work on whole blocks and complete the data with PKCS7 Padding.
+ */
+static int paddedMode(ModeAES mode) {
+    return mode == AES_ECB || mode == AES_CBC;
+}
+
+/**
+ * Converts a word of the round key from the order of the state bytes to a number with the first byte
+ * in the high bits, as subWord, rotWord and Rcon expect it.
+ */
+static uint32_t wordValue(uint32_t stateWord) {
+    byte bytes[4];
+
+    memcpy(bytes, &stateWord, 4);
+    return ((uint32_t) bytes[0] << 24) | ((uint32_t) bytes[1] << 16) | ((uint32_t) bytes[2] << 8) | bytes[3];
+}
+
+/**
+ * The inverse of wordValue.
+ */
+static uint32_t stateWord(uint32_t value) {
+    byte bytes[4] = {(byte) (value >> 24), (byte) (value >> 16), (byte) (value >> 8), (byte) value};
+    uint32_t result;
+
+    memcpy(&result, bytes, 4);
+    return result;
+}
+
+/**
+ * Prepares the round keys of the equivalent inverse cipher from the round keys of encryption:
+ * the order of the rounds is reversed and InvMixColumns is applied to all keys except the first and the last.
+ * Then a decryption round has the same order of steps as an encryption round.
+ */
+static void inverseRoundKey(const uint32_t *roundKey, uint32_t *invRoundKey, int rounds) {
+    for (int round = 0; round <= rounds; ++round) {
+        uint32_t *invKey = invRoundKey + round * NB;
+
+        memcpy(invKey, roundKey + (rounds - round) * NB, AES_BLOCK_SIZE);
+        if (round > 0 && round < rounds) {
+            // a round key has the layout of the state
+            invMixColumns((byte *) invKey);
+        }
+    }
+}
+
+/**
+ * Passes the blocks to the engine in groups of ENGINE_BATCH so that the engine can keep several blocks in work.
+ */
+static void engineBlocks(CryptBlocksAES crypt, const uint32_t *roundKey, int rounds, byte **data, size_t blockCount) {
+    byte batch[ENGINE_BATCH * AES_BLOCK_SIZE];
+
+    for (size_t block = 0; block < blockCount; block += ENGINE_BATCH) {
+        size_t count = blockCount - block < ENGINE_BATCH ? blockCount - block : ENGINE_BATCH;
+
+        for (size_t i = 0; i < count; ++i) {
+            memcpy(batch + i * AES_BLOCK_SIZE, data[block + i], AES_BLOCK_SIZE);
+        }
+        crypt((const byte *) roundKey, rounds, batch, count);
+        for (size_t i = 0; i < count; ++i) {
+            memcpy(data[block + i], batch + i * AES_BLOCK_SIZE, AES_BLOCK_SIZE);
+        }
+    }
+}
+
+/**
+ * Encrypts one block with the round functions of this file.
+ */
+static void cipherBlock(byte *data, const uint32_t *roundKey, int rounds) {
+    addRoundKey(data, roundKey);
+
+    for (size_t round = 1; round < rounds; ++round) {
+        _print("round %d----------\n", round);
+        subBytes(data, AES_BLOCK_SIZE);
+        shiftRows(data);
+        mixColumns(data);
+        addRoundKey(data, roundKey + (round * NB));
+    }
+
+    _print("round %d----------\n", rounds);
+    subBytes(data, AES_BLOCK_SIZE);
+    shiftRows(data);
+    addRoundKey(data, roundKey + (rounds * NB));
+}
+
+/**
+ * Decrypts one block with the round functions of this file, in the order of the equivalent inverse cipher,
+ * roundKey takes the round keys of decryption (see inverseRoundKey).
+ */
+static void invCipherBlock(byte *data, const uint32_t *roundKey, int rounds) {
+    addRoundKey(data, roundKey);
+
+    for (size_t round = 1; round < rounds; ++round) {
+        _print("round %d----------\n", round);
+        invSubBytes(data, AES_BLOCK_SIZE);
+        invShiftRows(data);
+        invMixColumns(data);
+        addRoundKey(data, roundKey + (round * NB));
+    }
+
+    _print("round %d----------\n", rounds);
+    invSubBytes(data, AES_BLOCK_SIZE);
+    invShiftRows(data);
+    addRoundKey(data, roundKey + (rounds * NB));
+}
+
+/**
+ * The round functions of this file as an engine, the blocks of the engines already have the layout of the state.
+ */
+static void referenceBlocks(const byte *roundKey, int rounds, byte *data, size_t blockCount, int decrypt) {
+    uint32_t wordRoundKey[(ROUND_AES_256 + 1) * NB];
+
+    // the engines may get the round keys without alignment
+    memcpy(wordRoundKey, roundKey, (rounds + 1) * AES_BLOCK_SIZE);
+
+    for (size_t i = 0; i < blockCount; ++i) {
+        if (decrypt) {
+            invCipherBlock(data + i * AES_BLOCK_SIZE, wordRoundKey, rounds);
+        } else {
+            cipherBlock(data + i * AES_BLOCK_SIZE, wordRoundKey, rounds);
+        }
+    }
+}
+
+static void referenceEncryptBlocks(const byte *roundKey, int rounds, byte *data, size_t blockCount) {
+    referenceBlocks(roundKey, rounds, data, blockCount, 0);
+}
+
+static void referenceDecryptBlocks(const byte *roundKey, int rounds, byte *data, size_t blockCount) {
+    referenceBlocks(roundKey, rounds, data, blockCount, 1);
+}
+
+const EngineAES referenceEngineAES = {
+        "reference",
+        0,
+        NULL,
+        referenceEncryptBlocks,
+        referenceDecryptBlocks,
+        NULL
+};
+
+
+int initContextAES(ContextAES *context, const byte *key, VersionAES version) {
+    if (context == NULL || key == NULL || version < AES_128 || version > AES_256) {
+        return 1;
+    }
+
+    context->version = version;
+    context->rounds = NrAES[version];
+
+    keyExpansion(key, context->roundKey, version);
+    inverseRoundKey(context->roundKey, context->invRoundKey, context->rounds);
+    initGhashAES(context);
+    initMacAES(context);
+    return 0;
+}
+
+
+void freeContextAES(ContextAES *context) {
+    if (context == NULL) {
+        return;
+    }
+    wipeMemory(context->roundKey, sizeof(context->roundKey));
+    wipeMemory(context->invRoundKey, sizeof(context->invRoundKey));
+    wipeMemory(context->ghashTable, sizeof(context->ghashTable));
+    wipeMemory(context->ghashKey, sizeof(context->ghashKey));
+    wipeMemory(context->macKey, sizeof(context->macKey));
+    wipeMemory(context->macInverse, sizeof(context->macInverse));
+    context->rounds = 0;
+}
+
 
 CryptData* decryptAES(byte *data, size_t dataSize, VersionAES version, ModeAES mode, byte *key, byte *iv){
     CryptData* cryptData;
-    size_t blockCount = 0;
+    ContextAES context;
 
-    if (dataSize % AES_BLOCK_SIZE != 0){
+    _print("key:\n");
+    _forprint("%02X ", keySizeAES[version], AES_BLOCK_SIZE, key);
+
+    if (initContextAES(&context, key, version)) {
         return NULL;
     }
-    if (mode == AES_CBC && iv == NULL){
+    cryptData = decryptContextAES(&context, data, dataSize, mode, iv);
+    freeContextAES(&context);
+    return cryptData;
+}
+
+
+CryptData* decryptContextAES(const ContextAES *context, byte *data, size_t dataSize, ModeAES mode, byte *iv){
+    CryptData* cryptData;
+    byte *output;
+
+    if (paddedMode(mode) && dataSize % AES_BLOCK_SIZE != 0){
+        return NULL;
+    }
+    if (mode != AES_ECB && iv == NULL){
         return NULL;
     }
-
-    _print("key:\n");
-    _forprint("%02X ", keySizeAES[version], AES_BLOCK_SIZE, key);
 
     _print("input data:\n");
     _forprint("%02X ", dataSize, AES_BLOCK_SIZE, data);
 
-    byte **blockData = splitDataInBlock(data, dataSize, &blockCount);
+    output = malloc(dataSize);
+    if (output == NULL) {
+        return NULL;
+    }
+    if (decryptIntoAES(context, data, dataSize, output, &dataSize, mode, iv)) {
+        // the tag of GCM does not match
+        free(output);
+        return NULL;
+    }
+
+    cryptData = malloc(sizeof(CryptData));
+    if (cryptData == NULL) {
+        free(output);
+        return NULL;
+    }
+    cryptData->data = output;
+    cryptData->dataSize = dataSize;
+
+
+    _print("output data:\n");
+    _forprint("%02X ", cryptData->dataSize, AES_BLOCK_SIZE, cryptData->data);
+
+    return cryptData;
+}
+
+
+/**
+ * Decrypts whole blocks of CBC. The blocks do not depend on each other, so groups of ENGINE_BATCH blocks
+ * go through the parallel engine at once, then each block is XORed with the previous ciphertext block.
+ * cipher accepts the ciphertext of the data if it is kept in another buffer, NULL if the data is decrypted
+ * over its only copy, then the ciphertext of each group is saved before the decryption.
+ */
+void decryptCbcBlocksAES(const ContextAES *context, byte *data, const byte *cipher, size_t blockCount, byte *chain) {
+    const EngineAES *engine = dispatchAES()->parallel;
+    byte saved[ENGINE_BATCH * AES_BLOCK_SIZE];
+
+    for (size_t block = 0; block < blockCount; block += ENGINE_BATCH) {
+        size_t count = blockCount - block < ENGINE_BATCH ? blockCount - block : ENGINE_BATCH;
+        byte *ptr = data + block * AES_BLOCK_SIZE;
+        const byte *prev = saved;
+
+        if (cipher != NULL) {
+            prev = cipher + block * AES_BLOCK_SIZE;
+        } else {
+            memcpy(saved, ptr, count * AES_BLOCK_SIZE);
+        }
+
+        engine->decryptBlocks((const byte *) context->invRoundKey, context->rounds, ptr, count);
+
+        xorBytesAES(ptr, chain, IV_SIZE);
+        xorBytesAES(ptr + AES_BLOCK_SIZE, prev, (count - 1) * AES_BLOCK_SIZE);
+        memcpy(chain, prev + (count - 1) * AES_BLOCK_SIZE, IV_SIZE);
+    }
+}
+
+
+/**
+ * Decrypts the data in place in the given mode, without the padding. The modes with padding take whole blocks.
+ * chain accepts the IV and returns the IV for the data that follows this data.
+ * cipher accepts the ciphertext of the data in another buffer if there is one, otherwise NULL.
+ */
+static void decryptMode(const ContextAES *context, byte *data, const byte *cipher, size_t dataSize, ModeAES mode,
+                        byte *chain) {
+    const DispatchAES *dispatch = dispatchAES();
+    size_t blockCount = dataSize / AES_BLOCK_SIZE;
 
     switch (mode) {
         case AES_ECB:
-            decryptAES_ECB(blockData, blockCount, version, key);
+            if (poolCryptAES(context, POOL_DECRYPT_ECB, data, data, blockCount, NULL)) {
+                dispatch->parallel->decryptBlocks((const byte *) context->invRoundKey, context->rounds, data, blockCount);
+            }
             break;
         case AES_CBC:
-            decryptAES_CBC(blockData, blockCount, version, key, iv);
+            if (poolCryptAES(context, POOL_DECRYPT_CBC, data, data, blockCount, chain)) {
+                decryptCbcBlocksAES(context, data, cipher, blockCount, chain);
+            }
+            break;
+        case AES_CTR:
+            cryptContextAES_CTR(context, data, dataSize, chain);
+            break;
+        case AES_GCM:
+            // GCM also needs the tag, it goes to encryptGcmAES and decryptGcmAES
+            break;
+        case AES_CFB:
+            decryptContextAES_CFB(context, data, dataSize, chain);
+            break;
+        case AES_OFB:
+            cryptContextAES_OFB(context, data, dataSize, chain);
             break;
     }
+}
 
-    cryptData = malloc(sizeof(CryptData));
-    cryptData->data = mergerBlockInData(blockData, blockCount);
-    cryptData->dataSize = delPadding(cryptData->data, dataSize);
 
+int decryptInPlaceAES(const ContextAES *context, byte *data, size_t *dataSize, ModeAES mode, byte *iv){
+    byte chain[IV_SIZE];
 
-    _print("output data:\n");
-    _forprint("%02X ", cryptData.dataSize, AES_BLOCK_SIZE, cryptData.data);
+    if (paddedMode(mode) && *dataSize % AES_BLOCK_SIZE != 0){
+        return 1;
+    }
+    if (mode != AES_ECB && iv == NULL){
+        return 1;
+    }
+    if (mode == AES_GCM) {
+        if (*dataSize < GCM_TAG_SIZE) {
+            return 1;
+        }
+        *dataSize -= GCM_TAG_SIZE;
+        return decryptGcmAES(context, iv, NULL, 0, data, *dataSize, data + *dataSize, GCM_TAG_SIZE);
+    }
+    if (iv != NULL) {
+        memcpy(chain, iv, IV_SIZE);
+    }
 
-    return cryptData;
+    decryptMode(context, data, NULL, *dataSize, mode, chain);
+
+    if (paddedMode(mode) && *dataSize > 0) {
+        *dataSize = delPadding(data, *dataSize);
+    }
+    return 0;
+}
+
+
+int decryptIntoAES(const ContextAES *context, const byte *data, size_t dataSize, byte *output, size_t *outputSize,
+                   ModeAES mode, byte *iv){
+    byte chain[IV_SIZE];
+    size_t done = 0;
+
+    if ((paddedMode(mode) && dataSize % AES_BLOCK_SIZE != 0) || *outputSize < dataSize){
+        return 1;
+    }
+    if (mode != AES_ECB && iv == NULL){
+        return 1;
+    }
+    if (mode == AES_GCM) {
+        if (dataSize < GCM_TAG_SIZE) {
+            return 1;
+        }
+        *outputSize = dataSize - GCM_TAG_SIZE;
+        if (output != data) {
+            memmove(output, data, *outputSize);
+        }
+        return decryptGcmAES(context, iv, NULL, 0, output, *outputSize, data + *outputSize, GCM_TAG_SIZE);
+    }
+    if (iv != NULL) {
+        memcpy(chain, iv, IV_SIZE);
+    }
+
+    // a large call goes to the worker pool, otherwise the data is copied and decrypted in parts that stay in the cache
+    if (paddedMode(mode) &&
+        !poolCryptAES(context, mode == AES_ECB ? POOL_DECRYPT_ECB : POOL_DECRYPT_CBC, data, output,
+                      dataSize / AES_BLOCK_SIZE, chain)) {
+        done = dataSize;
+    }
+    for (; done < dataSize; done += INTO_CHUNK) {
+        size_t size = dataSize - done < INTO_CHUNK ? dataSize - done : INTO_CHUNK;
+
+        if (output != data) {
+            memmove(output + done, data + done, size);
+        }
+        decryptMode(context, output + done, output != data ? data + done : NULL, size, mode, chain);
+    }
+
+    *outputSize = paddedMode(mode) && dataSize > 0 ? delPadding(output, dataSize) : dataSize;
+    return 0;
 }
 
 
 void decryptAES_ECB(byte **data, size_t blockCount, VersionAES version, byte *key){
-    word *roundKey = malloc(sizeof(word) * (NrAES[version] + 1) * NB);
+    ContextAES context;
 
-    _print("start decrypt AES-%d-ECB!\n", keySizeAES[version] * 8);
+    initContextAES(&context, key, version);
+    decryptContextAES_ECB(&context, data, blockCount);
+    freeContextAES(&context);
+}
 
-    keyExpansion(key, roundKey, version);
 
-    for (size_t block = 0; block < blockCount; ++block) {
-        addRoundKey(data[block], roundKey + (NrAES[version] * NB));
+void decryptContextAES_ECB(const ContextAES *context, byte **data, size_t blockCount){
+    const EngineAES *engine = dispatchAES()->parallel;
 
-        for (size_t round = NrAES[version] - 1; round > 0; --round) {
-            _print("round %d----------\n", round);
-            invShiftRows(data[block]);
-            invSubBytes(data[block], AES_BLOCK_SIZE);
-            addRoundKey(data[block], roundKey + (round * NB));
-            invMixColumns(data[block]);
-        }
+    _print("start decrypt AES-%d-ECB!\n", keySizeAES[context->version] * 8);
 
-        _print("round %d----------\n", 0);
-        invShiftRows(data[block]);
-        invSubBytes(data[block], AES_BLOCK_SIZE);
-        addRoundKey(data[block], roundKey);
-    }
-    free(roundKey);
+    engineBlocks(engine->decryptBlocks, context->invRoundKey, context->rounds, data, blockCount);
 }
 
 
 void decryptAES_CBC(byte **data, size_t blockCount, VersionAES version, byte *key, byte *iv){
-    word *roundKey = malloc(sizeof(word) * (NrAES[version] + 1) * NB);
-    byte* tmpIv = expandBlock(iv);
-    byte* tmpData = malloc(AES_BLOCK_SIZE);
+    ContextAES context;
 
-    _print("start decrypt AES-%d-ECB!\n", keySizeAES[version] * 8);
+    initContextAES(&context, key, version);
+    decryptContextAES_CBC(&context, data, blockCount, iv);
+    freeContextAES(&context);
+}
 
-    keyExpansion(key, roundKey, version);
 
-    for (size_t block = 0; block < blockCount; ++block) {
-        // save this block to use it
-        for (size_t i = 0; i < AES_BLOCK_SIZE; ++i){
-            tmpData[i] = data[block][i];
-        }
+void decryptContextAES_CBC(const ContextAES *context, byte **data, size_t blockCount, byte *iv){
+    byte tmpIv[IV_SIZE];
+    byte next[IV_SIZE];
+    byte batch[ENGINE_BATCH * AES_BLOCK_SIZE];
+    const EngineAES *engine = dispatchAES()->parallel;
+
+    _print("start decrypt AES-%d-CBC!\n", keySizeAES[context->version] * 8);
 
-        addRoundKey(data[block], roundKey + (NrAES[version] * NB));
+    memcpy(tmpIv, iv, IV_SIZE);
 
-        for (size_t round = NrAES[version] - 1; round > 0; --round) {
-            _print("round %d----------\n", round);
-            invShiftRows(data[block]);
-            invSubBytes(data[block], AES_BLOCK_SIZE);
-            addRoundKey(data[block], roundKey + (round * NB));
-            invMixColumns(data[block]);
+    for (size_t block = 0; block < blockCount; block += ENGINE_BATCH) {
+        size_t count = blockCount - block < ENGINE_BATCH ? blockCount - block : ENGINE_BATCH;
+
+        for (size_t i = 0; i < count; ++i) {
+            memcpy(batch + i * AES_BLOCK_SIZE, data[block + i], AES_BLOCK_SIZE);
         }
+        engine->decryptBlocks((const byte *) context->invRoundKey, context->rounds, batch, count);
 
-        _print("round %d----------\n", 0);
-        invShiftRows(data[block]);
-        invSubBytes(data[block], AES_BLOCK_SIZE);
-        addRoundKey(data[block], roundKey);
+        // the blocks are written from the last one, so the previous block is still the ciphertext
+        memcpy(next, data[block + count - 1], IV_SIZE);
+        for (size_t j = count; j > 0; --j) {
+            const byte *prev = j > 1 ? data[block + j - 2] : tmpIv;
 
-        for (size_t i = 0; i < IV_SIZE; ++i){
-            byte tmp = data[block][i] ^ tmpIv[i];
-            tmpIv[i] = tmpData[i];
-            data[block][i] = tmp;
+            for (size_t i = 0; i < IV_SIZE; ++i){
+                data[block + j - 1][i] = batch[(j - 1) * AES_BLOCK_SIZE + i] ^ prev[i];
+            }
         }
+        memcpy(tmpIv, next, IV_SIZE);
         _print("iv:\n");
-        _forprint("%02X ", AES_BLOCK_SIZE, AES_BLOCK_SIZE, data[block]);
+        _forprint("%02X ", AES_BLOCK_SIZE, AES_BLOCK_SIZE, tmpIv);
     }
-    free(tmpData);
-    free(tmpIv);
-    free(roundKey);
 }
 
 
 CryptData encryptAES(byte *data, size_t dataSize, VersionAES version, ModeAES mode, byte *key, byte *iv) {
-    CryptData cryptData;
-    size_t blockCount = 0;
+    CryptData cryptData = {0, NULL};
+    ContextAES context;
 
     _print("key:\n");
     _forprint("%02X ", keySizeAES[version], AES_BLOCK_SIZE, key);
 
+    if (initContextAES(&context, key, version)) {
+        return cryptData;
+    }
+    cryptData = encryptContextAES(&context, data, dataSize, mode, iv);
+    freeContextAES(&context);
+    return cryptData;
+}
+
+
+CryptData encryptContextAES(const ContextAES *context, byte *data, size_t dataSize, ModeAES mode, byte *iv) {
+    CryptData cryptData = {0, NULL};
+    size_t outputSize = outputSizeAES(dataSize, mode);
+    byte *output;
+
     _print("input data:\n");
     _forprint("%02X ", dataSize, AES_BLOCK_SIZE, data);
 
-    byte* dataPadding = addPadding(data, &dataSize);
+    output = malloc(outputSize);
+    if (output == NULL) {
+        return cryptData;
+    }
+    if (encryptIntoAES(context, data, dataSize, output, &outputSize, mode, iv)) {
+        free(output);
+        return cryptData;
+    }
+
+    cryptData.data = output;
+    cryptData.dataSize = outputSize;
+
+    _print("output data:\n");
+    _forprint("%02X ", cryptData.dataSize, AES_BLOCK_SIZE, cryptData.data);
+
+    return cryptData;
+}
 
-    _print("data after adding padding:\n");
-    _forprint("%02X ", dataSize, AES_BLOCK_SIZE, dataPadding);
 
-    byte **blockData = splitDataInBlock(dataPadding, dataSize, &blockCount);
+/**
+ * Encrypts the data in place in the given mode, for the modes with padding it must already be added.
+ * chain accepts the IV and returns the IV for the data that follows this data.
+ */
+static void encryptMode(const ContextAES *context, byte *data, size_t dataSize, ModeAES mode, byte *chain) {
+    const DispatchAES *dispatch = dispatchAES();
+    size_t blockCount = dataSize / AES_BLOCK_SIZE;
 
     switch (mode) {
         case AES_ECB:
-            encryptAES_ECB(blockData, blockCount, version, key);
+            if (poolCryptAES(context, POOL_ENCRYPT_ECB, data, data, blockCount, NULL)) {
+                dispatch->parallel->encryptBlocks((const byte *) context->roundKey, context->rounds, data, blockCount);
+            }
             break;
+        case AES_CBC: {
+            const byte *prev = chain;
+
+            for (size_t block = 0; block < blockCount; ++block) {
+                byte *ptr = data + block * AES_BLOCK_SIZE;
+
+                // using the previous block of initialization vector
+                for (size_t i = 0; i < IV_SIZE; ++i){
+                    ptr[i] ^= prev[i];
+                }
+                dispatch->serial->encryptBlocks((const byte *) context->roundKey, context->rounds, ptr, 1);
+                prev = ptr;
+            }
+            if (blockCount > 0) {
+                memcpy(chain, prev, IV_SIZE);
+            }
+            break;
+        }
+        case AES_CTR:
+            cryptContextAES_CTR(context, data, dataSize, chain);
+            break;
+        case AES_GCM:
+            // GCM also needs the tag, it goes to encryptGcmAES and decryptGcmAES
+            break;
+        case AES_CFB:
+            encryptContextAES_CFB(context, data, dataSize, chain);
+            break;
+        case AES_OFB:
+            cryptContextAES_OFB(context, data, dataSize, chain);
+            break;
+    }
+}
+
+
+void cryptModeAES(const ContextAES *context, byte *data, size_t dataSize, ModeAES mode, int decrypt, byte *chain) {
+    if (decrypt) {
+        decryptMode(context, data, NULL, dataSize, mode, chain);
+    } else {
+        encryptMode(context, data, dataSize, mode, chain);
+    }
+}
+
+
+/**
+ * Completes the last block with PKCS7 Padding, the data before it is not touched.
+ * Returns the size with the padding.
+ */
+static size_t padLastBlock(byte *data, size_t dataSize, ModeAES mode) {
+    byte valuePadding;
+
+    if (!paddedMode(mode) || dataSize % AES_BLOCK_SIZE == 0) {
+        // if padding is not needed
+        return dataSize;
+    }
+    valuePadding = AES_BLOCK_SIZE - (dataSize % AES_BLOCK_SIZE);
+    memset(data + dataSize, valuePadding, valuePadding);
+    return dataSize + valuePadding;
+}
+
+
+int encryptInPlaceAES(const ContextAES *context, byte *data, size_t *dataSize, size_t bufferSize, ModeAES mode, byte *iv) {
+    byte chain[IV_SIZE];
+
+    if (mode != AES_ECB && iv == NULL){
+        return 1;
+    }
+    if (bufferSize < outputSizeAES(*dataSize, mode)) {
+        return 1;
+    }
+    if (mode == AES_GCM) {
+        if (encryptGcmAES(context, iv, NULL, 0, data, *dataSize, data + *dataSize, GCM_TAG_SIZE)) {
+            return 1;
+        }
+        *dataSize += GCM_TAG_SIZE;
+        return 0;
+    }
+    if (iv != NULL) {
+        memcpy(chain, iv, IV_SIZE);
+    }
+
+    *dataSize = padLastBlock(data, *dataSize, mode);
+
+    _print("data after adding padding:\n");
+    _forprint("%02X ", *dataSize, AES_BLOCK_SIZE, data);
+
+    encryptMode(context, data, *dataSize, mode, chain);
+    return 0;
+}
+
+
+int encryptIntoAES(const ContextAES *context, const byte *data, size_t dataSize, byte *output, size_t *outputSize,
+                   ModeAES mode, byte *iv) {
+    size_t paddedSize = outputSizeAES(dataSize, mode);
+    byte chain[IV_SIZE];
+    size_t done = 0;
+
+    if (mode != AES_ECB && iv == NULL){
+        return 1;
+    }
+    if (*outputSize < paddedSize) {
+        return 1;
+    }
+    if (mode == AES_GCM) {
+        // the tag is computed over the whole data, so it is encrypted in one call
+        if (output != data) {
+            memmove(output, data, dataSize);
+        }
+        *outputSize = paddedSize;
+        return encryptGcmAES(context, iv, NULL, 0, output, dataSize, output + dataSize, GCM_TAG_SIZE);
+    }
+    if (iv != NULL) {
+        memcpy(chain, iv, IV_SIZE);
+    }
+
+    // the whole blocks of a large call of ECB go to the worker pool, otherwise the data is copied and encrypted
+    // in parts that stay in the cache
+    if (mode == AES_ECB && !poolCryptAES(context, POOL_ENCRYPT_ECB, data, output, dataSize / AES_BLOCK_SIZE, NULL)) {
+        done = dataSize / AES_BLOCK_SIZE * AES_BLOCK_SIZE;
+    }
+    for (; done < dataSize; done += INTO_CHUNK) {
+        size_t size = dataSize - done < INTO_CHUNK ? dataSize - done : INTO_CHUNK;
+
+        if (output != data) {
+            memmove(output + done, data + done, size);
+        }
+        size = padLastBlock(output + done, size, mode);
+        encryptMode(context, output + done, size, mode, chain);
+    }
+
+    *outputSize = paddedSize;
+    return 0;
+}
+
+
+size_t outputSizeAES(size_t dataSize, ModeAES mode) {
+    switch (mode) {
+        case AES_ECB:
         case AES_CBC:
-            encryptAES_CBC(blockData, blockCount, version, key, iv);
+            // PKCS7 Padding only completes the last block
+            return (dataSize + AES_BLOCK_SIZE - 1) / AES_BLOCK_SIZE * AES_BLOCK_SIZE;
+        case AES_CTR:
+        case AES_CFB:
+        case AES_OFB:
             break;
+        case AES_GCM:
+            // the tag follows the data
+            return dataSize + GCM_TAG_SIZE;
     }
+    return dataSize;
+}
 
-    cryptData.data = mergerBlockInData(blockData, blockCount);
-    cryptData.dataSize = dataSize;
 
-    _print("output data:\n");
-    _forprint("%02X ", cryptData.dataSize, AES_BLOCK_SIZE, cryptData.data);
 
-    return cryptData;
+/**
+ * The number of bytes that the decryption keeps until finalCipherAES: the last block of ECB and CBC has
+ * the padding, the last 16 bytes of GCM can be the tag.
+ */
+static size_t cipherReserve(const CipherAES *cipher) {
+    if (cipher->decrypt && (paddedMode(cipher->mode) || cipher->mode == AES_GCM)) {
+        return AES_BLOCK_SIZE;
+    }
+    return 0;
 }
 
 
-void encryptAES_ECB(byte **data, size_t blockCount, VersionAES version, byte *key) {
-    word *roundKey = malloc(sizeof(word) * (NrAES[version] + 1) * NB);
+/**
+ * Encrypts or decrypts the data in place in the mode of the cipher, every part except the last is whole blocks.
+ */
+static void cipherCrypt(CipherAES *cipher, byte *data, size_t dataSize) {
+    if (cipher->mode == AES_GCM) {
+        cryptGcmAES(cipher->context, &cipher->gcm, data, dataSize, cipher->decrypt);
+    } else if (cipher->decrypt) {
+        decryptMode(cipher->context, data, NULL, dataSize, cipher->mode, cipher->chain);
+    } else {
+        encryptMode(cipher->context, data, dataSize, cipher->mode, cipher->chain);
+    }
+    cipher->dataSize += dataSize;
+}
 
-    _print("start encrypt AES-%d-ECB!\n", keySizeAES[version] * 8);
 
-    keyExpansion(key, roundKey, version);
+int initCipherAES(CipherAES *cipher, const ContextAES *context, ModeAES mode, int decrypt, const byte *iv) {
+    if (cipher == NULL || context == NULL || (unsigned) mode > AES_OFB) {
+        return 1;
+    }
+    if (mode != AES_ECB && iv == NULL) {
+        return 1;
+    }
 
-    for (size_t block = 0; block < blockCount; ++block) {
-        addRoundKey(data[block], roundKey);
+    cipher->context = context;
+    cipher->mode = mode;
+    cipher->decrypt = decrypt != 0;
+    memset(cipher->chain, 0, IV_SIZE);
+    if (mode == AES_GCM) {
+        startGcmAES(context, &cipher->gcm, iv);
+    } else if (iv != NULL) {
+        memcpy(cipher->chain, iv, IV_SIZE);
+    }
+    cipher->bufferSize = 0;
+    cipher->dataSize = 0;
+    return 0;
+}
+
+
+int updateCipherAES(CipherAES *cipher, const byte *data, size_t dataSize, byte *output, size_t *outputSize) {
+    size_t pending = cipher->bufferSize + dataSize;
+    size_t reserve = cipherReserve(cipher);
+    size_t size = 0, fromBuffer, fromData;
+    byte rest[2 * AES_BLOCK_SIZE];
+    size_t restSize;
+
+    if ((data == NULL && dataSize > 0) || *outputSize < dataSize + AES_BLOCK_SIZE) {
+        return 1;
+    }
+    // only whole blocks are processed, the reserve stays for finalCipherAES
+    if (pending > reserve) {
+        size = (pending - reserve) / AES_BLOCK_SIZE * AES_BLOCK_SIZE;
+    }
+    fromBuffer = size < cipher->bufferSize ? size : cipher->bufferSize;
+    fromData = size - fromBuffer;
 
-        for (size_t round = 1; round < NrAES[version]; ++round) {
-            _print("round %d----------\n", round);
-            subBytes(data[block], AES_BLOCK_SIZE);
-            shiftRows(data[block]);
-            mixColumns(data[block]);
-            addRoundKey(data[block], roundKey + (round * NB));
+    // the rest is saved first, because the output can be the same as the data
+    restSize = pending - size;
+    memcpy(rest, cipher->buffer + fromBuffer, cipher->bufferSize - fromBuffer);
+    memcpy(rest + cipher->bufferSize - fromBuffer, data + fromData, dataSize - fromData);
+
+    if (output == data) {
+        memmove(output + fromBuffer, data, fromData);
+    }
+    memcpy(output, cipher->buffer, fromBuffer);
+
+    // the data is copied and processed in parts that stay in the cache
+    for (size_t done = 0; done < size; done += INTO_CHUNK) {
+        size_t part = size - done < INTO_CHUNK ? size - done : INTO_CHUNK;
+
+        if (output != data) {
+            size_t start = done < fromBuffer ? fromBuffer : done;
+
+            memcpy(output + start, data + start - fromBuffer, done + part - start);
         }
+        cipherCrypt(cipher, output + done, part);
+    }
+
+    memcpy(cipher->buffer, rest, restSize);
+    cipher->bufferSize = restSize;
+    *outputSize = size;
+    return 0;
+}
+
+
+int finalCipherAES(CipherAES *cipher, byte *output, size_t *outputSize) {
+    size_t size = cipher->bufferSize;
+    int result = 0;
 
-        _print("round %d----------\n", NrAES[version]);
-        subBytes(data[block], AES_BLOCK_SIZE);
-        shiftRows(data[block]);
-        addRoundKey(data[block], roundKey + (NrAES[version] * NB));
+    if (*outputSize < 2 * AES_BLOCK_SIZE) {
+        return 1;
+    }
+    memcpy(output, cipher->buffer, size);
+
+    if (cipher->decrypt && cipher->mode == AES_GCM) {
+        byte tag[GCM_TAG_SIZE];
+        byte diff = 0;
+
+        if (size < GCM_TAG_SIZE) {
+            result = 1;
+        } else {
+            size -= GCM_TAG_SIZE;
+            cipherCrypt(cipher, output, size);
+            tagGcmAES(cipher->context, &cipher->gcm, cipher->dataSize, tag);
+
+            // the comparison takes the same time wherever the tags differ
+            for (int i = 0; i < GCM_TAG_SIZE; ++i) {
+                diff |= tag[i] ^ cipher->buffer[size + i];
+            }
+            result = diff != 0;
+        }
+    } else if (cipher->decrypt && paddedMode(cipher->mode)) {
+        if (size % AES_BLOCK_SIZE != 0) {
+            result = 1;
+        } else if (size > 0) {
+            cipherCrypt(cipher, output, size);
+            size = delPadding(output, size);
+        }
+    } else {
+        if (!cipher->decrypt) {
+            size = padLastBlock(output, size, cipher->mode);
+        }
+        cipherCrypt(cipher, output, size);
+        if (cipher->mode == AES_GCM) {
+            tagGcmAES(cipher->context, &cipher->gcm, cipher->dataSize, output + size);
+            size += GCM_TAG_SIZE;
+        }
+    }
+
+    if (result) {
+        memset(output, 0, 2 * AES_BLOCK_SIZE);
+        size = 0;
+    }
+    *outputSize = size;
+    wipeMemory(cipher, sizeof(CipherAES));
+    return result;
+}
+
+static uint64_t loadBig64(const byte *data) {
+    uint64_t value = 0;
+
+    for (int i = 0; i < 8; ++i) {
+        value = (value << 8) | data[i];
     }
-    free(roundKey);
+    return value;
+}
+
+
+static void storeBig64(byte *data, uint64_t value) {
+    for (int i = 7; i >= 0; --i) {
+        data[i] = (byte) value;
+        value >>= 8;
+    }
+}
+
+
+void cryptContextAES_CTR(const ContextAES *context, byte *data, size_t dataSize, byte *counter) {
+    const EngineAES *engine = dispatchAES()->parallel;
+    byte keystream[CTR_BLOCKS * AES_BLOCK_SIZE];
+    // the counter is a 128-bit big-endian number, kept as two halves
+    uint64_t high = loadBig64(counter);
+    uint64_t low = loadBig64(counter + 8);
+
+    for (size_t done = 0; done < dataSize; done += sizeof(keystream)) {
+        size_t size = dataSize - done < sizeof(keystream) ? dataSize - done : sizeof(keystream);
+        size_t blockCount = (size + AES_BLOCK_SIZE - 1) / AES_BLOCK_SIZE;
+
+        // the counter blocks of the whole group are encrypted by the engine at once
+        for (size_t block = 0; block < blockCount; ++block) {
+            storeBig64(keystream + block * AES_BLOCK_SIZE, high);
+            storeBig64(keystream + block * AES_BLOCK_SIZE + 8, low);
+            if (++low == 0) {
+                ++high;
+            }
+        }
+        engine->encryptBlocks((const byte *) context->roundKey, context->rounds, keystream, blockCount);
+
+        xorBytesAES(data + done, keystream, size);
+    }
+
+    storeBig64(counter, high);
+    storeBig64(counter + 8, low);
+}
+
+
+void encryptAES_ECB(byte **data, size_t blockCount, VersionAES version, byte *key) {
+    ContextAES context;
+
+    initContextAES(&context, key, version);
+    encryptContextAES_ECB(&context, data, blockCount);
+    freeContextAES(&context);
+}
+
+
+void encryptContextAES_ECB(const ContextAES *context, byte **data, size_t blockCount) {
+    const EngineAES *engine = dispatchAES()->parallel;
+
+    _print("start encrypt AES-%d-ECB!\n", keySizeAES[context->version] * 8);
+
+    engineBlocks(engine->encryptBlocks, context->roundKey, context->rounds, data, blockCount);
 }
 
 
 void encryptAES_CBC(byte **data, size_t blockCount, VersionAES version, byte *key, byte *iv){
-    word *roundKey = malloc(sizeof(word) * (NrAES[version] + 1) * NB);
-    byte* tmpIv = expandBlock(iv);
+    ContextAES context;
 
-    _print("start encrypt AES-%d-ECB!\n", keySizeAES[version] * 8);
+    initContextAES(&context, key, version);
+    encryptContextAES_CBC(&context, data, blockCount, iv);
+    freeContextAES(&context);
+}
+
+
+void encryptContextAES_CBC(const ContextAES *context, byte **data, size_t blockCount, byte *iv){
+    byte tmpIv[IV_SIZE];
+    const EngineAES *engine = dispatchAES()->serial;
 
-    keyExpansion(key, roundKey, version);
+    _print("start encrypt AES-%d-CBC!\n", keySizeAES[context->version] * 8);
+
+    memcpy(tmpIv, iv, IV_SIZE);
 
     for (size_t block = 0; block < blockCount; ++block) {
         // using the previous block of initialization vector
@@ -292,28 +998,13 @@ void encryptAES_CBC(byte **data, size_t blockCount, VersionAES version, byte *ke
         _print("iv:\n");
         _forprint("%02X ", AES_BLOCK_SIZE, AES_BLOCK_SIZE, data[block]);
 
-        addRoundKey(data[block], roundKey);
-
-        for (size_t round = 1; round < NrAES[version]; ++round) {
-            _print("round %d----------\n", round);
-            subBytes(data[block], AES_BLOCK_SIZE);
-            shiftRows(data[block]);
-            mixColumns(data[block]);
-            addRoundKey(data[block], roundKey + (round * NB));
-        }
-
-        _print("round %d----------\n", NrAES[version]);
-        subBytes(data[block], AES_BLOCK_SIZE);
-        shiftRows(data[block]);
-        addRoundKey(data[block], roundKey + (NrAES[version] * NB));
+        engineBlocks(engine->encryptBlocks, context->roundKey, context->rounds, data + block, 1);
 
         // copies the data to modify the next block by this block
         for (size_t i = 0; i < IV_SIZE; ++i){
             tmpIv[i] = data[block][i];
         }
     }
-    free(tmpIv);
-    free(roundKey);
 }
 
 
@@ -364,11 +1055,9 @@ byte **splitDataInBlock(byte *data, size_t dataSize, size_t *blockCount) {
     *blockCount = dataSize / AES_BLOCK_SIZE;
     byte **blockData = malloc(sizeof(void *) * (*blockCount));
     for (size_t i = 0; i < *blockCount; ++i) {
-        blockData[i] = expandBlock(data + (AES_BLOCK_SIZE * i));
-        /*blockData[i] = malloc(AES_BLOCK_SIZE);
-        for (int j = 0; j < AES_BLOCK_SIZE; ++j) {
-            blockData[i][j] = data[(AES_BLOCK_SIZE * i) + j];
-        }*/
+        // the state is stored by columns, the same order as the data
+        blockData[i] = malloc(AES_BLOCK_SIZE);
+        memcpy(blockData[i], data + (AES_BLOCK_SIZE * i), AES_BLOCK_SIZE);
     }
 
     return blockData;
@@ -377,13 +1066,8 @@ byte **splitDataInBlock(byte *data, size_t dataSize, size_t *blockCount) {
 
 byte *mergerBlockInData(byte **blockData, size_t blockCount) {
     byte *data = malloc(blockCount * AES_BLOCK_SIZE);
-    byte *tmp;
     for (size_t i = 0; i < blockCount; ++i) {
-        tmp = backExpandBlock(blockData[i]);
-        for (size_t j = 0; j < AES_BLOCK_SIZE; ++j) {
-            data[i * AES_BLOCK_SIZE + j] = tmp[j];//data[i * AES_BLOCK_SIZE + j] = blockData[i][j];
-        }
-        free(tmp);
+        memcpy(data + i * AES_BLOCK_SIZE, blockData[i], AES_BLOCK_SIZE);
     }
     return data;
 }
@@ -453,41 +1137,29 @@ void invSubBytes(byte *data, size_t dataSize){
 }
 
 
-void addRoundKey(byte *data, word *roundKey) {
-    byte *byteRoundKey = malloc(AES_BLOCK_SIZE);
-
+void addRoundKey(byte *data, const uint32_t *roundKey) {
+    // the round key has the layout of the state, one word is one column
     for (int i = 0; i < NB; ++i) {
-        byteRoundKey[i * 4 + 0] = ((byte) (roundKey[i] >> 24));
-        byteRoundKey[i * 4 + 1] = ((byte) (roundKey[i] >> 16));
-        byteRoundKey[i * 4 + 2] = ((byte) (roundKey[i] >> 8));
-        byteRoundKey[i * 4 + 3] = ((byte) (roundKey[i]));
-    }
-
-    // the mapping order is a0,0 a1,0 a2,0 a3,0 a0,1 a1,1 ... a2,3 a3,3
-    byte *tmp = expandBlock(byteRoundKey);
-    free(byteRoundKey);
-    byteRoundKey = tmp;
+        uint32_t column;
 
-    for (int i = 0; i < AES_BLOCK_SIZE; ++i) {
-        data[i] ^= byteRoundKey[i];
+        memcpy(&column, data + i * 4, 4);
+        column ^= roundKey[i];
+        memcpy(data + i * 4, &column, 4);
     }
 
     _print("add round key:\n");
     _forprint("%02X ", AES_BLOCK_SIZE, AES_BLOCK_SIZE, data);
-
-    free(byteRoundKey);
 }
 
 
 void shiftRows(byte *data) {
-    for (int rows = 0; rows < NB; ++rows) {
-        byte tmp;
-        for (int i = 0; i < rows; ++i) {
-            for (int j = 0; j < NB - 1; ++j) {
-                tmp = data[rows * NB + j];
-                data[rows * NB + j] = data[rows * NB + j + 1];
-                data[rows * NB + j + 1] = tmp;
-            }
+    byte tmp[AES_BLOCK_SIZE];
+
+    memcpy(tmp, data, AES_BLOCK_SIZE);
+    // byte of the row "rows" in the column "col" is data[col * NB + rows]
+    for (int rows = 1; rows < NB; ++rows) {
+        for (int col = 0; col < NB; ++col) {
+            data[col * NB + rows] = tmp[((col + rows) % NB) * NB + rows];
         }
     }
 
@@ -497,14 +1169,12 @@ void shiftRows(byte *data) {
 
 
 void invShiftRows(byte *data){
-    for (int rows = 0; rows < NB; ++rows) {
-        byte tmp;
-        for (int i = 0; i < rows; ++i) {
-            for (int j = NB - 2; j >= 0; --j) {
-                tmp = data[rows * NB + j];
-                data[rows * NB + j] = data[rows * NB + j + 1];
-                data[rows * NB + j + 1] = tmp;
-            }
+    byte tmp[AES_BLOCK_SIZE];
+
+    memcpy(tmp, data, AES_BLOCK_SIZE);
+    for (int rows = 1; rows < NB; ++rows) {
+        for (int col = 0; col < NB; ++col) {
+            data[((col + rows) % NB) * NB + rows] = tmp[col * NB + rows];
         }
     }
 
@@ -568,14 +1238,14 @@ void mixColumns(byte *data) {
 
     for (int i = 0; i < 4; ++i) {
         for (int j = 0; j < 4; ++j) {
-            dataCol[j] = data[j * 4 + i];
+            dataCol[j] = data[i * 4 + j];
         }
 
         // apply the MixColumn on one column
         mixColumn(dataCol, mixMatrix);
 
         for (int j = 0; j < 4; ++j) {
-            data[j * 4 + i] = dataCol[j];
+            data[i * 4 + j] = dataCol[j];
         }
     }
 
@@ -592,14 +1262,14 @@ void invMixColumns(byte *data) {
 
     for (int i = 0; i < 4; ++i) {
         for (int j = 0; j < 4; ++j) {
-            dataCol[j] = data[j * 4 + i];
+            dataCol[j] = data[i * 4 + j];
         }
 
         // apply the MixColumn on one column
         mixColumn(dataCol, mixMatrix);
 
         for (int j = 0; j < 4; ++j) {
-            data[j * 4 + i] = dataCol[j];
+            data[i * 4 + j] = dataCol[j];
         }
     }
 
@@ -608,44 +1278,61 @@ void invMixColumns(byte *data) {
 }
 
 
-void keyExpansion(const byte *key, word *roundKey, VersionAES versionAES) {
-    int Nk = NkAES[versionAES];
-    int Nr = NrAES[versionAES];
+/*
+ * Generates the key expansion for one version of AES. Nk and the number of words are known at compile time,
+ * so the loop over the words of a group is unrolled and the branch on the position of the word disappears.
+ * XOR does not depend on the order of the bytes in the word, only SubWord, RotWord and Rcon need the number.
+ */
+#define KEY_EXPANSION_SPECIALIZE(name, Nk, Nr)                                                                      \
+static void name(const byte *key, uint32_t *roundKey) {                                                             \
+    /* the key already has the layout of the state */                                                               \
+    memcpy(roundKey, key, (Nk) * 4);                                                                                \
+                                                                                                                    \
+    for (int i = (Nk); i < NB * ((Nr) + 1); i += (Nk)) {                                                            \
+        roundKey[i] = roundKey[i - (Nk)] ^ stateWord(subWord(rotWord(wordValue(roundKey[i - 1]))) ^ Rcon[i / (Nk)]);\
+        for (int j = 1; j < (Nk) && i + j < NB * ((Nr) + 1); ++j) {                                                 \
+            uint32_t temp = roundKey[i + j - 1];                                                                    \
+            if ((Nk) == NK_256 && j == 4) {                                                                         \
+                temp = stateWord(subWord(wordValue(temp)));                                                         \
+            }                                                                                                       \
+            roundKey[i + j] = roundKey[i + j - (Nk)] ^ temp;                                                        \
+        }                                                                                                           \
+    }                                                                                                               \
+}
 
-    _print("key expansion:\n");
+KEY_EXPANSION_SPECIALIZE(keyExpansion128, NK_128, NR_128)
+KEY_EXPANSION_SPECIALIZE(keyExpansion192, NK_192, NR_192)
+KEY_EXPANSION_SPECIALIZE(keyExpansion256, NK_256, NR_256)
 
-    // copy the original key to the beginning of the extended key
-    for (int i = 0; i < Nk; i++) {
-        roundKey[i] = ((word) key[4 * i] << 24) |
-                      ((word) key[4 * i + 1] << 16) |
-                      ((word) key[4 * i + 2] << 8) |
-                      ((word) key[4 * i + 3]);
-    }
 
-    // key expansion is performed here
-    for (int i = Nk; i < NB * (Nr + 1); i++) {
-        word temp = roundKey[i - 1];
-        if (i % Nk == 0) {
-            temp = subWord(rotWord(temp)) ^ Rcon[i / Nk];
-        } else if ((Nk == NK_256) & (i % Nk == 4)) {
-            temp = subWord(temp);
-        }
-        roundKey[i] = roundKey[i - Nk] ^ temp;
+void keyExpansion(const byte *key, uint32_t *roundKey, VersionAES versionAES) {
+    _print("key expansion:\n");
+
+    switch (versionAES) {
+        case AES_128:
+            keyExpansion128(key, roundKey);
+            break;
+        case AES_192:
+            keyExpansion192(key, roundKey);
+            break;
+        case AES_256:
+            keyExpansion256(key, roundKey);
+            break;
     }
 
-    _forprint(" %08X ", NB * (Nr + 1), NB, roundKey);
+    _forprint(" %08X ", NB * (NrAES[versionAES] + 1), NB, roundKey);
 }
 
 
-word subWord(word keyWord) {
-    word result = 0;
+uint32_t subWord(uint32_t keyWord) {
+    uint32_t result = 0;
     for (int i = 0; i < NB; i++) {
-        result |= (Sbox[(keyWord >> (i * 8)) & 0xFF] << (i * 8));
+        result |= ((uint32_t) Sbox[(keyWord >> (i * 8)) & 0xFF] << (i * 8));
     }
     return result;
 }
 
 
-word rotWord(word keyWord) {
-    return ((keyWord << 8) | (keyWord >> 24));
+uint32_t rotWord(uint32_t keyWord) {
+    return (keyWord << 8) | (keyWord >> 24);
 }
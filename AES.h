@@ -2,7 +2,45 @@
  * AES crypter
  *
  * This library allows you to encrypt and decrypt various data.
- * There is support for AES-128, AES-192, and AES-256 in ECB and CBC modes.
+ * There is support for AES-128, AES-192, and AES-256 in ECB, CBC, CTR, GCM, CFB and OFB modes.
+ *
+ * On x86 processors with the AES-NI instructions the blocks are processed by the hardware engine
+ * (ECB and CBC decryption by the VAES engine if the processor has these instructions). Otherwise ECB and CBC
+ * decryption go through the bitsliced engine (constant time, eight blocks at once) and the chained blocks
+ * of CBC encryption through the SSSE3
+ * vector permutation engine, or through the engine on 32-bit tables (T-tables) built from the S-box
+ * if the processor has no SSSE3. The processor features are detected once, setEngineAES or
+ * the environment variable AES_ENGINE can force an engine.
+ *
+ * Large calls of ECB and of CBC decryption are split between the threads of a worker pool (setThreadsAES),
+ * batches of jobs of different sizes are shared between the threads with work stealing (cryptBatchAES).
+ * An asynchronous queue (createQueueAES) takes jobs without blocking the caller, its completions are polled.
+ * Files are encrypted in chunks (encryptFileAES), on Linux the reads and writes overlap with the work (io_uring).
+ *
+ * A key that is used many times can be expanded once into a ContextAES (initContextAES), the functions
+ * with "Context" in the name take it instead of the key. The functions with the key expand it on each call.
+ *
+ * CTR mode turns the cipher into a stream: the counter blocks are encrypted many at once by the same engine as ECB,
+ * the data of any size is XORed with them and is not padded.
+ *
+ * GCM mode encrypts as CTR and authenticates the ciphertext and the additional data (AAD) with GHASH in the same pass.
+ * GHASH runs on the carry-less multiplication (PCLMULQDQ) together with AES-NI, or on 4-bit tables that are
+ * prepared once in the context.
+ *
+ * Any mode can also process the data in parts of any size (initCipherAES, updateCipherAES, finalCipherAES),
+ * the padding is added or removed only by the last call.
+ *
+ * CFB and OFB modes also work as streams. The keystream of OFB can be generated ahead (fillStreamAES),
+ * then the data only needs an XOR. CFB decryption processes the blocks many at once.
+ *
+ * Many independent CBC streams can be encrypted together (encryptMultiAES_CBC), one block of each stream at a time.
+ *
+ * CMAC and PMAC authenticate the data, their subkeys are prepared once in the context. The blocks of PMAC are
+ * independent and are encrypted many at once, many short messages can be authenticated with CMAC at once.
+ *
+ * Keys are wrapped with AES-KW and AES-KWP by one expanded KEK, many keys can be wrapped at once.
+ *
+ * XTS mode encrypts sectors of storage with two keys, the tweak of a sector is its number, so no IV is stored.
  *
  * PKCS7 Padding is used to supplement blocks, it complements only if the block is not complete,
  * but if the block is complete, another augmented block will not be created.
@@ -19,6 +57,7 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdint.h>
 
 #ifdef _WIN32
 #include <windows.h>
@@ -56,6 +95,18 @@
 
 #define IV_SIZE 16
 
+#define GCM_IV_SIZE 12
+#define GCM_TAG_SIZE 16
+#define GCM_MIN_TAG_SIZE 4
+
+#define MAC_SIZE 16
+
+// the number of subkeys L * x^i of CMAC and PMAC that are prepared in the context
+#define MAC_LEVELS 16
+
+// the keystream of OFB that a stream can generate ahead
+#define STREAM_RING_SIZE (64 * AES_BLOCK_SIZE)
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -68,9 +119,24 @@ typedef enum {
 
 typedef enum {
     AES_ECB,
-    AES_CBC
+    AES_CBC,
+    // counter mode, iv is the initial 128-bit big-endian counter, there is no padding
+    AES_CTR,
+    // CTR with GHASH, iv is the 96-bit IV, the 128-bit tag follows the encrypted data, there is no padding
+    AES_GCM,
+    // CFB-128, iv is the first block of the feedback, there is no padding
+    AES_CFB,
+    // output feedback, the keystream does not depend on the data, there is no padding
+    AES_OFB
 } ModeAES;
 
+typedef enum {
+    // AES-KW (RFC 3394), the key is a multiple of 8 bytes, at least 16 bytes
+    AES_KW,
+    // AES-KWP (RFC 5649), the key of any size is completed with zeros
+    AES_KWP
+} KeyWrapAES;
+
 typedef unsigned char byte;
 typedef unsigned long word;
 typedef const char* lpcstr;
@@ -80,6 +146,193 @@ typedef struct {
     byte *data;
 } CryptData;
 
+/**
+ * The expanded key of one AES key, it is prepared once by initContextAES and then used by any number of calls.
+ * The context is only read during encryption and decryption, so one context can be shared between threads.
+ */
+typedef struct {
+    VersionAES version;
+    int rounds;
+    // round keys, four words per round in the layout of the state (see keyExpansion)
+    uint32_t roundKey[(ROUND_AES_256 + 1) * 4];
+    // round keys of the equivalent inverse cipher for decryption, in the order of use
+    uint32_t invRoundKey[(ROUND_AES_256 + 1) * 4];
+    // 4-bit tables of GHASH: the low and the high halves of the products of the hash key by 0 ... 15
+    uint64_t ghashTable[32];
+    // the powers H^1 ... H^8 of the hash key for the aggregated reduction of GHASH
+    byte ghashKey[8 * AES_BLOCK_SIZE];
+    // subkeys of CMAC and PMAC: L * x^i for L = E(K, 0^128), the subkeys K1 and K2 of CMAC are i = 1 and i = 2
+    byte macKey[MAC_LEVELS * AES_BLOCK_SIZE];
+    // L * x^-1 for the last block of PMAC
+    byte macInverse[AES_BLOCK_SIZE];
+} ContextAES;
+
+/**
+ * The two keys of XTS mode, prepared once by initXtsAES.
+ */
+typedef struct {
+    // encrypts the data
+    ContextAES dataKey;
+    // encrypts the tweaks
+    ContextAES tweakKey;
+} ContextXtsAES;
+
+/**
+ * The state of a CFB or OFB stream, the data of any size can be passed to it in any number of calls.
+ */
+typedef struct {
+    const ContextAES *context;
+    ModeAES mode;
+    // CFB: the ciphertext block that is encrypted next, OFB: the last generated keystream block
+    byte feedback[AES_BLOCK_SIZE];
+    // the keystream that is not used yet: count bytes from head, for CFB only the rest of the current block
+    byte ring[STREAM_RING_SIZE];
+    size_t head;
+    size_t count;
+} StreamAES;
+
+/**
+ * The state of GCM between the parts of the data.
+ */
+typedef struct {
+    // the first counter block J0, it encrypts the tag
+    byte j0[AES_BLOCK_SIZE];
+    // the next counter block
+    byte counter[AES_BLOCK_SIZE];
+    // the value of GHASH, in the byte order of GCM
+    byte hash[AES_BLOCK_SIZE];
+} GcmStateAES;
+
+/**
+ * The state of an incremental encryption or decryption in any mode (initCipherAES, updateCipherAES,
+ * finalCipherAES). The data of any size is passed in any number of parts, the state keeps at most
+ * two blocks of it, so its size does not depend on the size of the data.
+ */
+typedef struct {
+    const ContextAES *context;
+    ModeAES mode;
+    int decrypt;
+    // the IV for the data that follows (CBC: the last ciphertext block), for GCM the state of GCM
+    byte chain[IV_SIZE];
+    GcmStateAES gcm;
+    // the data that is not processed yet: a partial block, for the decryption of ECB and CBC the last whole block
+    // (it has the padding), for the decryption of GCM also the last 16 bytes (they can be the tag)
+    byte buffer[2 * AES_BLOCK_SIZE];
+    size_t bufferSize;
+    // the size of the processed data, for the tag of GCM
+    uint64_t dataSize;
+} CipherAES;
+
+/**
+ * One key for wrapKeyBatchAES or unwrapKeyBatchAES.
+ */
+typedef struct {
+    // the key to wrap or the wrapped key
+    const byte *input;
+    size_t inputSize;
+    // the buffer for the result, it can be the same as input
+    byte *output;
+    // accepts the size of the buffer, returns the size of the result
+    size_t outputSize;
+    // returns 0 on success, 1 if the sizes are wrong or the wrapped key is not authentic
+    int result;
+} KeyWrapJobAES;
+
+/**
+ * One independent stream for encryptMultiAES_CBC.
+ */
+typedef struct {
+    const ContextAES *context;
+    // the data is encrypted in place, a multiple of 16 bytes (see addPadding)
+    byte *data;
+    size_t dataSize;
+    // accepts the IV and returns the IV for the data that follows this data (the last ciphertext block)
+    byte *iv;
+} JobAES;
+
+/**
+ * One job of cryptBatchAES, the data is encrypted or decrypted in place.
+ */
+typedef struct {
+    const ContextAES *context;
+    // ECB, CBC, CTR, CFB or OFB
+    ModeAES mode;
+    // 0 for encryption, 1 for decryption
+    int decrypt;
+    // for ECB and CBC a multiple of 16 bytes (see addPadding)
+    byte *data;
+    size_t dataSize;
+    // accepts the IV and returns the IV for the data that follows this data, NULL for ECB
+    byte *iv;
+} BatchJobAES;
+
+/**
+ * The statistics of one thread of cryptBatchAES, for tuning the grain.
+ */
+typedef struct {
+    // the tasks that the thread processed and the blocks in them
+    uint64_t tasks;
+    uint64_t blocks;
+    // the tasks that the thread split in two, one half went to its deque
+    uint64_t splits;
+    // the tasks taken from the deques of other threads, and the searches that found no work
+    uint64_t steals;
+    uint64_t failedSteals;
+    // the time without work, in nanoseconds
+    uint64_t idleTime;
+} WorkerStatsAES;
+
+/**
+ * One job of the asynchronous queue (submitQueueAES), processed as by encryptIntoAES or decryptIntoAES.
+ * The context and all buffers must stay valid until the completion of the job is polled.
+ */
+typedef struct {
+    const ContextAES *context;
+    ModeAES mode;
+    // 0 for encryption, 1 for decryption
+    int decrypt;
+    const byte *data;
+    size_t dataSize;
+    // the buffer for the result and its size, it can be the same as data
+    byte *output;
+    size_t outputSize;
+    // an initialization vector, NULL for ECB
+    byte *iv;
+    // returned with the completion
+    void *userData;
+} AsyncJobAES;
+
+/**
+ * The completion of one job of the asynchronous queue.
+ */
+typedef struct {
+    void *userData;
+    // 0 on success, 1 if the job failed as the function into the caller's buffer (or the tag of GCM does not match)
+    int result;
+    // the size of the result in the output buffer
+    size_t outputSize;
+} CompletionAES;
+
+/**
+ * The asynchronous queue, created by createQueueAES.
+ */
+typedef struct QueueAES QueueAES;
+
+/**
+ * The statistics of the encryption or decryption of one file.
+ */
+typedef struct {
+    // the bytes read from the input file and written to the output file
+    uint64_t inputSize;
+    uint64_t outputSize;
+    // the time of the whole call in nanoseconds
+    uint64_t time;
+    // the input bytes per second, in millions
+    double megabytesPerSecond;
+    // 1 if the file went through io_uring, 0 if through stdio
+    int uring;
+} FileStatsAES;
+
 //static lpcstr errMsg = "NULL";
 //
 ///**
@@ -101,6 +354,130 @@ typedef struct {
 int keyGeneration(byte *key, int keySize);
 #endif // defined(_WIN32) && defined(_RAND_KEY_)
 
+/**
+ * Forces the engine that encrypts and decrypts the blocks, instead of the automatic choice by the processor features.
+ * The same can be done before the start with the environment variable AES_ENGINE.
+ * It must not be called while other threads are encrypting or decrypting.
+ *
+ * @param name accepts "reference", "t-table", "bitslice", "ssse3-vperm", "aes-ni", "vaes-256" or "vaes-512",
+ * NULL returns the automatic choice.
+ * @return returns 0 on success, 1 if the engine is unknown or the processor does not support it.
+ */
+int setEngineAES(lpcstr name);
+
+/**
+ * Returns the name of the active engine, for example "aes-ni". If the calls with many independent blocks
+ * and the calls with one block at a time go to different engines, both names are returned: "vaes-512+aes-ni".
+ */
+lpcstr getEngineAES(void);
+
+/**
+ * Sets the worker pool: large calls of ECB and of CBC decryption are split into chunks of 64 KiB that are processed
+ * by several threads, the calling thread also takes chunks. The threads are started on the first large call.
+ * By default the pool has as many threads as processors (or the environment variable AES_THREADS)
+ * and takes the calls from 1 MiB. It must not be called while other threads are encrypting or decrypting.
+ *
+ * @param threadCount sets the number of threads with the calling thread (at most 256), 0 is the number
+ * of processors, 1 keeps all calls on the calling thread.
+ * @param threshold sets the size of the data in bytes below which a call stays on the calling thread,
+ * 0 is the default.
+ * @return returns 0 on success, 1 if threadCount is out of range.
+ */
+int setThreadsAES(int threadCount, size_t threshold);
+
+/**
+ * Returns the number of threads of the worker pool, with the calling thread.
+ */
+int getThreadsAES(void);
+
+/**
+ * Encrypts or decrypts a batch of independent jobs of any size on the threads of the worker pool with work stealing.
+ * The jobs of ECB and of CBC decryption are split into tasks down to the grain, the other jobs are processed
+ * whole by one thread. A batch smaller than the threshold of the pool runs on the calling thread.
+ *
+ * @param grain sets the size in bytes below which a task is not split, 0 is 64 KiB.
+ * @param stats accepts an array of getThreadsAES() statistics, the calling thread is the first one, or NULL.
+ * @return returns 0 on success, 1 if a job is not valid (then no job is processed) or there is no memory.
+ */
+int cryptBatchAES(BatchJobAES *jobs, size_t jobCount, size_t grain, WorkerStatsAES *stats);
+
+/**
+ * Creates an asynchronous queue with its worker thread. The jobs are submitted from any threads without a lock,
+ * the worker processes them in order (a large job goes to the worker pool) and the completions are polled.
+ *
+ * @param capacity sets the number of jobs that can be submitted and not polled yet, it is rounded up
+ * to a power of two.
+ * @return returns the queue, NULL if the capacity is 0 or the queue cannot be created.
+ */
+QueueAES *createQueueAES(size_t capacity);
+
+/**
+ * Processes the submitted jobs, stops the worker and frees the queue. The completions that are not polled are lost.
+ */
+void freeQueueAES(QueueAES *queue);
+
+/**
+ * Submits a job without waiting, the job is copied into the queue.
+ *
+ * @return returns 0 on success, 1 if the job is not valid or the queue has capacity jobs that are not polled yet.
+ */
+int submitQueueAES(QueueAES *queue, const AsyncJobAES *job);
+
+/**
+ * Takes the finished jobs without waiting, in the order of their submission. Only one thread may poll a queue.
+ *
+ * @param completions accepts the array for at most maxCount completions.
+ * @return returns the number of completions.
+ */
+size_t pollQueueAES(QueueAES *queue, CompletionAES *completions, size_t maxCount);
+
+/**
+ * Returns the eventfd of the queue (on Linux), it becomes readable when there are completions, for epoll
+ * or poll together with the sockets. pollQueueAES clears it. On other systems returns -1.
+ */
+int getEventQueueAES(const QueueAES *queue);
+
+/**
+ * Encrypts the input file into the output file in chunks, only the last chunk is padded.
+ * On Linux the reads and the writes go through io_uring and overlap with the encryption.
+ *
+ * @param mode accepts any mode except GCM.
+ * @param stats accepts the statistics of the call or NULL.
+ * @return returns 0 on success, 1 if a file cannot be opened, read or written, or the mode is GCM.
+ */
+int encryptFileAES(const ContextAES *context, lpcstr inputPath, lpcstr outputPath, ModeAES mode, const byte *iv,
+                   FileStatsAES *stats);
+
+/**
+ * Decrypts the input file into the output file in chunks, the padding is removed from the last chunk.
+ *
+ * @return returns 0 on success, 1 if a file cannot be opened, read or written, the mode is GCM,
+ * or the size of ECB or CBC data is not a multiple of 16 bytes.
+ */
+int decryptFileAES(const ContextAES *context, lpcstr inputPath, lpcstr outputPath, ModeAES mode, const byte *iv,
+                   FileStatsAES *stats);
+
+/**
+ * Turns the io_uring path of encryptFileAES and decryptFileAES on (1, the default) or off (0), then the files go
+ * through stdio as on other systems. It must not be called while files are encrypted or decrypted.
+ */
+void setFileUringAES(int enabled);
+
+/**
+ * Expands the key into the context.
+ *
+ * @param context accepts the memory of the context, for example a local variable.
+ * @param key accepts the encryption key.
+ * @param version sets AES_128, AES_192 or AES_256.
+ * @return returns 0 on success, 1 if the context or the key is NULL or the version is unknown.
+ */
+int initContextAES(ContextAES *context, const byte *key, VersionAES version);
+
+/**
+ * Clears the key material of the context, the context can be initialized again after that.
+ */
+void freeContextAES(ContextAES *context);
+
 /**
  * A function for decrypting data with the AES algorithm.
  *
@@ -110,9 +487,38 @@ int keyGeneration(byte *key, int keySize);
  * @param mode sets the encryption mode.
  * @return returns decrypted data.
  * @return returns structures with empty data if the transmitted encrypted data is not a multiple of 16 bytes or there is no IV when using CBC mode.
+ * @return returns NULL if the memory cannot be allocated.
  */
 CryptData* decryptAES(byte *data, size_t dataSize, VersionAES version, ModeAES mode, byte *key, byte* iv);
 
+/**
+ * The same as decryptAES, but with the key prepared in the context.
+ */
+CryptData* decryptContextAES(const ContextAES *context, byte *data, size_t dataSize, ModeAES mode, byte *iv);
+
+/**
+ * Decrypts the data in place, without allocation. The padding is removed from the size, not from the buffer.
+ *
+ * @param data accepts the encrypted data, the decrypted data is written over it.
+ * @param dataSize accepts the size of the data, a multiple of 16 bytes, returns the size without PKCS7 Padding.
+ * @param iv accepts an initialization vector, if you use the mode without its support, then use NULL.
+ * @return returns 0 on success, 1 if the size is not a multiple of 16 bytes or there is no IV when using CBC mode.
+ */
+int decryptInPlaceAES(const ContextAES *context, byte *data, size_t *dataSize, ModeAES mode, byte *iv);
+
+/**
+ * Decrypts the data into the caller's buffer, nothing is allocated.
+ *
+ * @param data accepts the encrypted data, a multiple of 16 bytes.
+ * @param output accepts the buffer for the decrypted data, it can be the same as data, otherwise they must not overlap.
+ * @param outputSize accepts the size of the buffer, at least dataSize, returns the size without PKCS7 Padding.
+ * @param iv accepts an initialization vector, if you use the mode without its support, then use NULL.
+ * @return returns 0 on success, 1 if the size is not a multiple of 16 bytes, the buffer is too small
+ * or there is no IV when using CBC mode.
+ */
+int decryptIntoAES(const ContextAES *context, const byte *data, size_t dataSize, byte *output, size_t *outputSize,
+                   ModeAES mode, byte *iv);
+
 /**
  * A function to decrypt data with the AES algorithm in ECB mode.
  *
@@ -122,6 +528,11 @@ CryptData* decryptAES(byte *data, size_t dataSize, VersionAES version, ModeAES m
  */
 void decryptAES_ECB(byte **data, size_t blockCount, VersionAES version, byte *key);
 
+/**
+ * The same as decryptAES_ECB, but with the key prepared in the context.
+ */
+void decryptContextAES_ECB(const ContextAES *context, byte **data, size_t blockCount);
+
 /**
  * A function for decrypting data with the AES algorithm in CBC mode.
  *
@@ -131,6 +542,11 @@ void decryptAES_ECB(byte **data, size_t blockCount, VersionAES version, byte *ke
  */
 void decryptAES_CBC(byte **data, size_t blockCount, VersionAES version, byte *key, byte *iv);
 
+/**
+ * The same as decryptAES_CBC, but with the key prepared in the context.
+ */
+void decryptContextAES_CBC(const ContextAES *context, byte **data, size_t blockCount, byte *iv);
+
 /**
  * A function to encrypt data with the AES algorithm.
  *
@@ -140,9 +556,267 @@ void decryptAES_CBC(byte **data, size_t blockCount, VersionAES version, byte *ke
  * @param version sets AES_128, AES_192 or AES_256.
  * @param mode sets the encryption mode.
  * @return returns encrypted data.
+ * @return returns empty data (NULL and the size 0) if the memory cannot be allocated.
  */
 CryptData encryptAES(byte *data, size_t dataSize, VersionAES version, ModeAES mode, byte *key, byte *iv);
 
+/**
+ * The same as encryptAES, but with the key prepared in the context.
+ */
+CryptData encryptContextAES(const ContextAES *context, byte *data, size_t dataSize, ModeAES mode, byte *iv);
+
+/**
+ * Encrypts the data in place, without allocation. If the size is not a multiple of 16 bytes,
+ * the last block is completed with PKCS7 Padding in the same buffer.
+ *
+ * @param data accepts the data, the encrypted data is written over it.
+ * @param dataSize accepts the size of the data, returns the size with PKCS7 Padding.
+ * @param bufferSize accepts the size of the buffer, it must fit the data with the padding.
+ * @param iv accepts an initialization vector, if you use the mode without its support, then use NULL.
+ * @return returns 0 on success, 1 if the buffer is too small or there is no IV when using CBC mode.
+ */
+int encryptInPlaceAES(const ContextAES *context, byte *data, size_t *dataSize, size_t bufferSize, ModeAES mode, byte *iv);
+
+/**
+ * Encrypts the data into the caller's buffer, nothing is allocated. The buffer can be reused for every call.
+ *
+ * @param data accepts the data.
+ * @param output accepts the buffer for the encrypted data, it can be the same as data, otherwise they must not overlap.
+ * @param outputSize accepts the size of the buffer, at least outputSizeAES(dataSize, mode),
+ * returns the size of the encrypted data.
+ * @param iv accepts an initialization vector, if you use the mode without its support, then use NULL.
+ * @return returns 0 on success, 1 if the buffer is too small or there is no IV when using CBC mode.
+ */
+int encryptIntoAES(const ContextAES *context, const byte *data, size_t dataSize, byte *output, size_t *outputSize,
+                   ModeAES mode, byte *iv);
+
+/**
+ * Starts an incremental encryption or decryption, the data is then passed by updateCipherAES in parts of any size.
+ *
+ * @param context accepts the expanded key, it must stay valid until finalCipherAES.
+ * @param decrypt sets 0 for encryption, 1 for decryption.
+ * @param iv accepts an initialization vector, if you use the mode without its support, then use NULL.
+ * @return returns 0 on success, 1 if the context is NULL, the mode is unknown or there is no IV.
+ */
+int initCipherAES(CipherAES *cipher, const ContextAES *context, ModeAES mode, int decrypt, const byte *iv);
+
+/**
+ * Encrypts or decrypts the next part of the data. Only whole blocks are written, the rest waits in the state
+ * for the next part. The decryption of GCM returns the data before the tag is checked by finalCipherAES.
+ *
+ * @param output accepts the buffer for the result, it can be the same as data, otherwise they must not overlap.
+ * @param outputSize accepts the size of the buffer, at least dataSize + 16, returns the size of the result.
+ * @return returns 0 on success, 1 if the buffer is too small.
+ */
+int updateCipherAES(CipherAES *cipher, const byte *data, size_t dataSize, byte *output, size_t *outputSize);
+
+/**
+ * Finishes the data: adds PKCS7 Padding or removes it, for GCM appends or checks the tag. The state is cleared.
+ *
+ * @param output accepts the buffer for the rest of the result, at least 32 bytes.
+ * @param outputSize accepts the size of the buffer, returns the size of the rest.
+ * @return returns 0 on success, 1 if the buffer is too small, the encrypted data of ECB or CBC is not a multiple
+ * of 16 bytes, or the tag of GCM does not match.
+ */
+int finalCipherAES(CipherAES *cipher, byte *output, size_t *outputSize);
+
+/**
+ * Encrypts or decrypts the data in place in CTR mode, in this mode it is the same operation.
+ *
+ * @param counter accepts the counter block, a 128-bit big-endian number. It is advanced by one for each block,
+ * so the next call continues the stream. Only the last call of a stream may take a size that is not
+ * a multiple of 16 bytes.
+ */
+void cryptContextAES_CTR(const ContextAES *context, byte *data, size_t dataSize, byte *counter);
+
+/**
+ * Encrypts the data in place in CFB mode.
+ *
+ * @param iv accepts the IV and returns the IV for the data that follows this data, so the next call continues
+ * the stream. Only the last call of a stream may take a size that is not a multiple of 16 bytes (see StreamAES).
+ */
+void encryptContextAES_CFB(const ContextAES *context, byte *data, size_t dataSize, byte *iv);
+
+/**
+ * Decrypts the data in place in CFB mode, the blocks are decrypted many at once. The IV is the same as
+ * for encryptContextAES_CFB.
+ */
+void decryptContextAES_CFB(const ContextAES *context, byte *data, size_t dataSize, byte *iv);
+
+/**
+ * Encrypts or decrypts the data in place in OFB mode, in this mode it is the same operation. The IV is the same as
+ * for encryptContextAES_CFB.
+ */
+void cryptContextAES_OFB(const ContextAES *context, byte *data, size_t dataSize, byte *iv);
+
+/**
+ * Starts a CFB or OFB stream.
+ *
+ * @param context accepts the context, it must stay valid while the stream is used.
+ * @param mode sets AES_CFB or AES_OFB.
+ * @param iv accepts the initialization vector.
+ * @return returns 0 on success, 1 if there is no stream, context or IV or the mode is not a stream mode.
+ */
+int initStreamAES(StreamAES *stream, const ContextAES *context, ModeAES mode, const byte *iv);
+
+/**
+ * Generates the keystream of an OFB stream ahead, up to STREAM_RING_SIZE bytes, for example while the connection
+ * is idle. The keystream of CFB depends on the data, it cannot be generated ahead.
+ *
+ * @return returns the number of bytes of the keystream that are ready.
+ */
+size_t fillStreamAES(StreamAES *stream);
+
+/**
+ * Encrypts the data of any size in place, it continues the data of the previous calls. For OFB it is
+ * the same as decryptStreamAES.
+ */
+void encryptStreamAES(StreamAES *stream, byte *data, size_t dataSize);
+
+/**
+ * Decrypts the data of any size in place, it continues the data of the previous calls.
+ */
+void decryptStreamAES(StreamAES *stream, byte *data, size_t dataSize);
+
+/**
+ * Encrypts the data in place in GCM mode and computes the tag over the additional data and the encrypted data.
+ *
+ * @param iv accepts the IV of GCM_IV_SIZE bytes, it must never be used twice with the same key.
+ * @param aad accepts the additional data that is authenticated but not encrypted, NULL if there is none.
+ * @param tag accepts the buffer for the tag.
+ * @param tagSize sets the size of the tag, from GCM_MIN_TAG_SIZE to GCM_TAG_SIZE bytes, the tag is truncated.
+ * @return returns 0 on success, 1 if there is no IV or tag or the size of the tag is not supported.
+ */
+int encryptGcmAES(const ContextAES *context, const byte *iv, const byte *aad, size_t aadSize,
+                  byte *data, size_t dataSize, byte *tag, size_t tagSize);
+
+/**
+ * Decrypts the data in place in GCM mode and checks the tag.
+ *
+ * @param tag accepts the tag from encryptGcmAES.
+ * @return returns 0 on success, 1 if the tag does not match (the data is then cleared), there is no IV or tag
+ * or the size of the tag is not supported.
+ */
+int decryptGcmAES(const ContextAES *context, const byte *iv, const byte *aad, size_t aadSize,
+                  byte *data, size_t dataSize, const byte *tag, size_t tagSize);
+
+/**
+ * Computes the CMAC (RFC 4493) of the data.
+ *
+ * @param data accepts the data of any size, NULL if the size is 0.
+ * @param mac accepts the buffer for the code of MAC_SIZE bytes.
+ */
+void cmacContextAES(const ContextAES *context, const byte *data, size_t dataSize, byte *mac);
+
+/**
+ * Computes the CMAC of many messages under one key, the blocks of different messages are encrypted at once.
+ *
+ * @param data accepts the messages.
+ * @param dataSize accepts the size of each message.
+ * @param count accepts the number of messages.
+ * @param mac accepts the buffer for the codes, MAC_SIZE bytes for each message in the same order.
+ */
+void cmacBatchContextAES(const ContextAES *context, const byte *const *data, const size_t *dataSize, size_t count,
+                         byte *mac);
+
+/**
+ * Computes the PMAC of the data (MAC_SIZE bytes), unlike CMAC the blocks are independent and are encrypted
+ * many at once.
+ */
+void pmacContextAES(const ContextAES *context, const byte *data, size_t dataSize, byte *mac);
+
+/**
+ * Returns the size of the wrapped key for the key of keySize bytes: 8 bytes more, for AES_KWP after the padding.
+ */
+size_t wrapSizeAES(size_t keySize, KeyWrapAES variant);
+
+/**
+ * Wraps the key with the KEK of the context.
+ *
+ * @param variant sets AES_KW or AES_KWP.
+ * @param output accepts the buffer for the wrapped key, it can be the same as key.
+ * @param outputSize accepts the size of the buffer, at least wrapSizeAES(keySize, variant),
+ * returns the size of the wrapped key.
+ * @return returns 0 on success, 1 if the size of the key is not supported or the buffer is too small.
+ */
+int wrapKeyAES(const ContextAES *context, KeyWrapAES variant, const byte *key, size_t keySize,
+               byte *output, size_t *outputSize);
+
+/**
+ * Unwraps the key with the KEK of the context and checks its integrity.
+ *
+ * @param output accepts the buffer for the key, it can be the same as data.
+ * @param outputSize accepts the size of the buffer, at least dataSize - 8, returns the size of the key.
+ * @return returns 0 on success, 1 if the size is wrong, the buffer is too small or the integrity check fails
+ * (then the buffer is cleared).
+ */
+int unwrapKeyAES(const ContextAES *context, KeyWrapAES variant, const byte *data, size_t dataSize,
+                 byte *output, size_t *outputSize);
+
+/**
+ * Wraps many keys with one KEK, the steps of different keys are encrypted at once.
+ *
+ * @return returns 0 if all keys are wrapped, 1 if any job failed, the result of each job is in its result.
+ */
+int wrapKeyBatchAES(const ContextAES *context, KeyWrapAES variant, KeyWrapJobAES *jobs, size_t count);
+
+/**
+ * Unwraps many keys with one KEK, the same as wrapKeyBatchAES in reverse.
+ */
+int unwrapKeyBatchAES(const ContextAES *context, KeyWrapAES variant, KeyWrapJobAES *jobs, size_t count);
+
+/**
+ * Expands the two keys of XTS mode.
+ *
+ * @param key accepts the two keys one after another: 32 bytes for AES_128, 64 bytes for AES_256.
+ * @param version sets AES_128 or AES_256, XTS has no AES-192.
+ * @return returns 0 on success, 1 if the context or the key is NULL or the version is not supported.
+ */
+int initXtsAES(ContextXtsAES *context, const byte *key, VersionAES version);
+
+/**
+ * Clears the keys of the XTS context.
+ */
+void freeXtsAES(ContextXtsAES *context);
+
+/**
+ * Encrypts one data unit in place in XTS mode, the size does not change.
+ *
+ * @param tweak accepts the 16-byte tweak of the data unit, usually the little-endian number of the sector.
+ * @param dataSize accepts the size of the data, at least 16 bytes. If it is not a multiple of 16 bytes,
+ * ciphertext stealing is used for the last two blocks.
+ * @return returns 0 on success, 1 if there is no tweak or the data is shorter than one block.
+ */
+int encryptXtsAES(const ContextXtsAES *context, const byte *tweak, byte *data, size_t dataSize);
+
+/**
+ * Decrypts one data unit in place in XTS mode, the same as encryptXtsAES in reverse.
+ */
+int decryptXtsAES(const ContextXtsAES *context, const byte *tweak, byte *data, size_t dataSize);
+
+/**
+ * Encrypts consecutive sectors in place in XTS mode, the tweaks of many sectors are computed at once.
+ *
+ * @param sector accepts the number of the first sector, the tweak of each next sector is one more.
+ * @param data accepts sectorCount sectors one after another.
+ * @param sectorSize accepts the size of one sector, for example 512 or 4096 bytes, at least 16 bytes.
+ * @return returns 0 on success, 1 if the sector is shorter than one block.
+ */
+int encryptSectorsXtsAES(const ContextXtsAES *context, uint64_t sector, byte *data, size_t sectorSize,
+                         size_t sectorCount);
+
+/**
+ * Decrypts consecutive sectors in place in XTS mode, the same as encryptSectorsXtsAES in reverse.
+ */
+int decryptSectorsXtsAES(const ContextXtsAES *context, uint64_t sector, byte *data, size_t sectorSize,
+                         size_t sectorCount);
+
+/**
+ * Returns the exact size of the encrypted data for the data of dataSize bytes in the given mode.
+ * The decrypted data is never larger than the encrypted data.
+ */
+size_t outputSizeAES(size_t dataSize, ModeAES mode);
+
 /**
  * Function to encrypt data with AES algorithm in ECB mode.
  *
@@ -152,6 +826,11 @@ CryptData encryptAES(byte *data, size_t dataSize, VersionAES version, ModeAES mo
  */
 void encryptAES_ECB(byte **data, size_t blockCount, VersionAES version, byte *key);
 
+/**
+ * The same as encryptAES_ECB, but with the key prepared in the context.
+ */
+void encryptContextAES_ECB(const ContextAES *context, byte **data, size_t blockCount);
+
 /**
  * Function to encrypt data with AES algorithm in CBC mode.
  *
@@ -161,6 +840,21 @@ void encryptAES_ECB(byte **data, size_t blockCount, VersionAES version, byte *ke
  */
 void encryptAES_CBC(byte **data, size_t blockCount, VersionAES version, byte *key, byte *iv);
 
+/**
+ * The same as encryptAES_CBC, but with the key prepared in the context.
+ */
+void encryptContextAES_CBC(const ContextAES *context, byte **data, size_t blockCount, byte *iv);
+
+/**
+ * Encrypts many independent streams in CBC mode at once, each with its own context and IV.
+ * One block of each stream is encrypted per step, so the blocks of different streams fill the AES pipeline.
+ * The jobs can have different sizes and keys.
+ *
+ * @return returns 0 on success, 1 if a job has no context or IV or its size is not a multiple of 16 bytes,
+ * then no job is encrypted.
+ */
+int encryptMultiAES_CBC(JobAES *jobs, size_t jobCount);
+
 /**
  * The function completes the data if it is not a multiple of the required one.
  * number of bytes using PKCS7 Padding.
@@ -193,6 +887,9 @@ byte *mergerBlockInData(byte **blockData, size_t blockCount);
  * a2,0 a2,1 a2,2 a2,3\n
  * a3,0 a3,1 a3,2 a3,3\n
  * the mapping order is a0,0 a1,0 a2,0 a3,0 a0,1 a1,1 ... a2,3 a3,3
+ *
+ * The round functions no longer need it: the state is stored by columns as in FIPS-197,
+ * ar,c is data[r + 4 * c], which is already the order of the input data.
  */
 byte *expandBlock(byte *data);
 
@@ -220,8 +917,9 @@ void invSubBytes(byte *data, size_t dataSize);
 
 /**
  * Adding a Round Key to a Data Block.
+ * Takes the four words of one round from keyExpansion, they are added to the columns without conversion.
  */
-void addRoundKey(byte *data, word *roundKey);
+void addRoundKey(byte *data, const uint32_t *roundKey);
 
 /**
  * Rotates the string to the left.
@@ -249,21 +947,23 @@ void invMixColumns(byte *data);
 /**
  * Key expansion to create a round key.
  * Key size depends on AES version:
- * 128 - 44 байта
- * 192 - 52 байта
- * 256 - 60 байт
+ * 128 - 44 words
+ * 192 - 52 words
+ * 256 - 60 words
+ * Each word is one column of a round key and is stored with the bytes in the order of the state,
+ * so the bytes of the round key for round r are ((byte *) roundKey)[r * 16 .. r * 16 + 15].
  */
-void keyExpansion(const byte *key, word *roundKey, VersionAES versionAES);
+void keyExpansion(const byte *key, uint32_t *roundKey, VersionAES versionAES);
 
 /**
  * SubWord using table S-box.
  */
-word subWord(word keyWord);
+uint32_t subWord(uint32_t keyWord);
 
 /**
- * A function to rotate a 32-bit word left by one byte.
+ * A function to rotate a 32-bit word left by one byte, the first byte of the word is in the high bits.
  */
-word rotWord(word keyWord);
+uint32_t rotWord(uint32_t keyWord);
 
 
 #ifdef __cplusplus
@@ -0,0 +1,532 @@
+/*
+ * AES crypter
+ *
+ * Bitsliced engine, it works in constant time: there are no table lookups and no branches
+ * that depend on the data or the key.
+ *
+ * Eight blocks are processed at once. They are transposed into bit planes: 8 words of 64 bits
+ * hold one bit of every byte of four blocks, two such sets make up the eight blocks. The S-box is
+ * computed as a boolean circuit (Boyar and Peralta), ShiftRows and MixColumns are shifts and
+ * rotations of the planes.
+ */
+#include <string.h>
+
+#include "engineAES.h"
+
+#define MAX_ROUNDS ROUND_AES_256
+
+// the number of blocks in one set of bit planes
+#define SLICE_BLOCKS 4
+
+// the number of blocks processed at once
+#define BITSLICE_BLOCKS (SLICE_BLOCKS * 2)
+
+#define GETU32LE(p) (((uint32_t) (p)[0]) | ((uint32_t) (p)[1] << 8) | \
+                     ((uint32_t) (p)[2] << 16) | ((uint32_t) (p)[3] << 24))
+
+#define PUTU32LE(p, v) do {             \
+        (p)[0] = (byte) (v);            \
+        (p)[1] = (byte) ((v) >> 8);     \
+        (p)[2] = (byte) ((v) >> 16);    \
+        (p)[3] = (byte) ((v) >> 24);    \
+    } while (0)
+
+#define SWAPN(cl, ch, s, x, y) do {                                 \
+        uint64_t a = (x), b = (y);                                  \
+        (x) = (a & (uint64_t) (cl)) | ((b & (uint64_t) (cl)) << (s)); \
+        (y) = ((a & (uint64_t) (ch)) >> (s)) | (b & (uint64_t) (ch)); \
+    } while (0)
+
+#define SWAP2(x, y) SWAPN(0x5555555555555555, 0xAAAAAAAAAAAAAAAA, 1, x, y)
+#define SWAP4(x, y) SWAPN(0x3333333333333333, 0xCCCCCCCCCCCCCCCC, 2, x, y)
+#define SWAP8(x, y) SWAPN(0x0F0F0F0F0F0F0F0F, 0xF0F0F0F0F0F0F0F0, 4, x, y)
+
+
+/**
+ * Transposes the 8x8 bit matrices so that q[i] gets the bit i of every byte, the transformation is symmetric.
+ */
+static void ortho(uint64_t *q) {
+    SWAP2(q[0], q[1]);
+    SWAP2(q[2], q[3]);
+    SWAP2(q[4], q[5]);
+    SWAP2(q[6], q[7]);
+
+    SWAP4(q[0], q[2]);
+    SWAP4(q[1], q[3]);
+    SWAP4(q[4], q[6]);
+    SWAP4(q[5], q[7]);
+
+    SWAP8(q[0], q[4]);
+    SWAP8(q[1], q[5]);
+    SWAP8(q[2], q[6]);
+    SWAP8(q[3], q[7]);
+}
+
+
+/**
+ * Spreads the four words of one block over two words of the bit planes.
+ */
+static void interleaveIn(uint64_t *q0, uint64_t *q1, const uint32_t *w) {
+    uint64_t x0 = w[0], x1 = w[1], x2 = w[2], x3 = w[3];
+
+    x0 |= (x0 << 16);
+    x1 |= (x1 << 16);
+    x2 |= (x2 << 16);
+    x3 |= (x3 << 16);
+    x0 &= (uint64_t) 0x0000FFFF0000FFFF;
+    x1 &= (uint64_t) 0x0000FFFF0000FFFF;
+    x2 &= (uint64_t) 0x0000FFFF0000FFFF;
+    x3 &= (uint64_t) 0x0000FFFF0000FFFF;
+    x0 |= (x0 << 8);
+    x1 |= (x1 << 8);
+    x2 |= (x2 << 8);
+    x3 |= (x3 << 8);
+    x0 &= (uint64_t) 0x00FF00FF00FF00FF;
+    x1 &= (uint64_t) 0x00FF00FF00FF00FF;
+    x2 &= (uint64_t) 0x00FF00FF00FF00FF;
+    x3 &= (uint64_t) 0x00FF00FF00FF00FF;
+    *q0 = x0 | (x2 << 8);
+    *q1 = x1 | (x3 << 8);
+}
+
+
+/**
+ * The inverse of interleaveIn.
+ */
+static void interleaveOut(uint32_t *w, uint64_t q0, uint64_t q1) {
+    uint64_t x0, x1, x2, x3;
+
+    x0 = q0 & (uint64_t) 0x00FF00FF00FF00FF;
+    x1 = q1 & (uint64_t) 0x00FF00FF00FF00FF;
+    x2 = (q0 >> 8) & (uint64_t) 0x00FF00FF00FF00FF;
+    x3 = (q1 >> 8) & (uint64_t) 0x00FF00FF00FF00FF;
+    x0 |= (x0 >> 8);
+    x1 |= (x1 >> 8);
+    x2 |= (x2 >> 8);
+    x3 |= (x3 >> 8);
+    x0 &= (uint64_t) 0x0000FFFF0000FFFF;
+    x1 &= (uint64_t) 0x0000FFFF0000FFFF;
+    x2 &= (uint64_t) 0x0000FFFF0000FFFF;
+    x3 &= (uint64_t) 0x0000FFFF0000FFFF;
+    w[0] = (uint32_t) x0 | (uint32_t) (x0 >> 16);
+    w[1] = (uint32_t) x1 | (uint32_t) (x1 >> 16);
+    w[2] = (uint32_t) x2 | (uint32_t) (x2 >> 16);
+    w[3] = (uint32_t) x3 | (uint32_t) (x3 >> 16);
+}
+
+
+/**
+ * Loads four blocks into one set of bit planes.
+ */
+static void loadSlice(uint64_t *q, const byte *data) {
+    uint32_t w[SLICE_BLOCKS * 4];
+
+    for (int i = 0; i < SLICE_BLOCKS * 4; ++i) {
+        w[i] = GETU32LE(data + i * 4);
+    }
+    for (int i = 0; i < SLICE_BLOCKS; ++i) {
+        interleaveIn(&q[i], &q[i + 4], w + (i * 4));
+    }
+    ortho(q);
+}
+
+
+/**
+ * Stores one set of bit planes back into four blocks.
+ */
+static void storeSlice(uint64_t *q, byte *data) {
+    uint32_t w[SLICE_BLOCKS * 4];
+
+    ortho(q);
+    for (int i = 0; i < SLICE_BLOCKS; ++i) {
+        interleaveOut(w + (i * 4), q[i], q[i + 4]);
+    }
+    for (int i = 0; i < SLICE_BLOCKS * 4; ++i) {
+        PUTU32LE(data + i * 4, w[i]);
+    }
+}
+
+
+/**
+ * Converts the round keys into bit planes, every round key is repeated for the four blocks of a set.
+ */
+static void sliceRoundKey(const byte *roundKey, int rounds, uint64_t *sk) {
+    for (int round = 0; round <= rounds; ++round) {
+        byte copies[SLICE_BLOCKS * AES_BLOCK_SIZE];
+
+        for (int i = 0; i < SLICE_BLOCKS; ++i) {
+            memcpy(copies + i * AES_BLOCK_SIZE, roundKey + round * AES_BLOCK_SIZE, AES_BLOCK_SIZE);
+        }
+        loadSlice(sk + round * 8, copies);
+    }
+}
+
+
+/**
+ * S-box as a circuit of 113 gates (Boyar and Peralta), applied to all bytes of the set.
+ */
+static void sliceSbox(uint64_t *q) {
+    uint64_t x0, x1, x2, x3, x4, x5, x6, x7;
+    uint64_t y1, y2, y3, y4, y5, y6, y7, y8, y9;
+    uint64_t y10, y11, y12, y13, y14, y15, y16, y17, y18, y19;
+    uint64_t y20, y21;
+    uint64_t z0, z1, z2, z3, z4, z5, z6, z7, z8, z9;
+    uint64_t z10, z11, z12, z13, z14, z15, z16, z17;
+    uint64_t t0, t1, t2, t3, t4, t5, t6, t7, t8, t9;
+    uint64_t t10, t11, t12, t13, t14, t15, t16, t17, t18, t19;
+    uint64_t t20, t21, t22, t23, t24, t25, t26, t27, t28, t29;
+    uint64_t t30, t31, t32, t33, t34, t35, t36, t37, t38, t39;
+    uint64_t t40, t41, t42, t43, t44, t45, t46, t47, t48, t49;
+    uint64_t t50, t51, t52, t53, t54, t55, t56, t57, t58, t59;
+    uint64_t t60, t61, t62, t63, t64, t65, t66, t67;
+    uint64_t s0, s1, s2, s3, s4, s5, s6, s7;
+
+    x0 = q[7];
+    x1 = q[6];
+    x2 = q[5];
+    x3 = q[4];
+    x4 = q[3];
+    x5 = q[2];
+    x6 = q[1];
+    x7 = q[0];
+
+    // top linear transformation
+    y14 = x3 ^ x5;
+    y13 = x0 ^ x6;
+    y9 = x0 ^ x3;
+    y8 = x0 ^ x5;
+    t0 = x1 ^ x2;
+    y1 = t0 ^ x7;
+    y4 = y1 ^ x3;
+    y12 = y13 ^ y14;
+    y2 = y1 ^ x0;
+    y5 = y1 ^ x6;
+    y3 = y5 ^ y8;
+    t1 = x4 ^ y12;
+    y15 = t1 ^ x5;
+    y20 = t1 ^ x1;
+    y6 = y15 ^ x7;
+    y10 = y15 ^ t0;
+    y11 = y20 ^ y9;
+    y7 = x7 ^ y11;
+    y17 = y10 ^ y11;
+    y19 = y10 ^ y8;
+    y16 = t0 ^ y11;
+    y21 = y13 ^ y16;
+    y18 = x0 ^ y16;
+
+    // non-linear section
+    t2 = y12 & y15;
+    t3 = y3 & y6;
+    t4 = t3 ^ t2;
+    t5 = y4 & x7;
+    t6 = t5 ^ t2;
+    t7 = y13 & y16;
+    t8 = y5 & y1;
+    t9 = t8 ^ t7;
+    t10 = y2 & y7;
+    t11 = t10 ^ t7;
+    t12 = y9 & y11;
+    t13 = y14 & y17;
+    t14 = t13 ^ t12;
+    t15 = y8 & y10;
+    t16 = t15 ^ t12;
+    t17 = t4 ^ t14;
+    t18 = t6 ^ t16;
+    t19 = t9 ^ t14;
+    t20 = t11 ^ t16;
+    t21 = t17 ^ y20;
+    t22 = t18 ^ y19;
+    t23 = t19 ^ y21;
+    t24 = t20 ^ y18;
+
+    t25 = t21 ^ t22;
+    t26 = t21 & t23;
+    t27 = t24 ^ t26;
+    t28 = t25 & t27;
+    t29 = t28 ^ t22;
+    t30 = t23 ^ t24;
+    t31 = t22 ^ t26;
+    t32 = t31 & t30;
+    t33 = t32 ^ t24;
+    t34 = t23 ^ t33;
+    t35 = t27 ^ t33;
+    t36 = t24 & t35;
+    t37 = t36 ^ t34;
+    t38 = t27 ^ t36;
+    t39 = t29 & t38;
+    t40 = t25 ^ t39;
+
+    t41 = t40 ^ t37;
+    t42 = t29 ^ t33;
+    t43 = t29 ^ t40;
+    t44 = t33 ^ t37;
+    t45 = t42 ^ t41;
+    z0 = t44 & y15;
+    z1 = t37 & y6;
+    z2 = t33 & x7;
+    z3 = t43 & y16;
+    z4 = t40 & y1;
+    z5 = t29 & y7;
+    z6 = t42 & y11;
+    z7 = t45 & y17;
+    z8 = t41 & y10;
+    z9 = t44 & y12;
+    z10 = t37 & y3;
+    z11 = t33 & y4;
+    z12 = t43 & y13;
+    z13 = t40 & y5;
+    z14 = t29 & y2;
+    z15 = t42 & y9;
+    z16 = t45 & y14;
+    z17 = t41 & y8;
+
+    // bottom linear transformation
+    t46 = z15 ^ z16;
+    t47 = z10 ^ z11;
+    t48 = z5 ^ z13;
+    t49 = z9 ^ z10;
+    t50 = z2 ^ z12;
+    t51 = z2 ^ z5;
+    t52 = z7 ^ z8;
+    t53 = z0 ^ z3;
+    t54 = z6 ^ z7;
+    t55 = z16 ^ z17;
+    t56 = z12 ^ t48;
+    t57 = t50 ^ t53;
+    t58 = z4 ^ t46;
+    t59 = z3 ^ t54;
+    t60 = t46 ^ t57;
+    t61 = z14 ^ t57;
+    t62 = t52 ^ t58;
+    t63 = t49 ^ t58;
+    t64 = z4 ^ t59;
+    t65 = t61 ^ t62;
+    t66 = z1 ^ t63;
+    s0 = t59 ^ t63;
+    s6 = t56 ^ ~t62;
+    s7 = t48 ^ ~t60;
+    t67 = t64 ^ t65;
+    s3 = t53 ^ t66;
+    s4 = t51 ^ t66;
+    s5 = t47 ^ t65;
+    s1 = t64 ^ ~s3;
+    s2 = t55 ^ ~t67;
+
+    q[7] = s0;
+    q[6] = s1;
+    q[5] = s2;
+    q[4] = s3;
+    q[3] = s4;
+    q[2] = s5;
+    q[1] = s6;
+    q[0] = s7;
+}
+
+
+/**
+ * The inverse of the affine transformation of the S-box.
+ */
+static void sliceInvAffine(uint64_t *q) {
+    uint64_t x0 = q[0], x1 = q[1], x2 = q[2], x3 = q[3];
+    uint64_t x4 = q[4], x5 = q[5], x6 = q[6], x7 = q[7];
+
+    // bit i = bit (i + 2) ^ bit (i + 5) ^ bit (i + 7) ^ bit i of 0x05
+    q[0] = ~(x2 ^ x5 ^ x7);
+    q[1] = x3 ^ x6 ^ x0;
+    q[2] = ~(x4 ^ x7 ^ x1);
+    q[3] = x5 ^ x0 ^ x2;
+    q[4] = x6 ^ x1 ^ x3;
+    q[5] = x7 ^ x2 ^ x4;
+    q[6] = x0 ^ x3 ^ x5;
+    q[7] = x1 ^ x4 ^ x6;
+}
+
+
+/**
+ * InvS-box: InvS(x) = A^-1(S(A^-1(x))), where A is the affine transformation of the S-box.
+ */
+static void sliceInvSbox(uint64_t *q) {
+    sliceInvAffine(q);
+    sliceSbox(q);
+    sliceInvAffine(q);
+}
+
+
+static void sliceShiftRows(uint64_t *q) {
+    for (int i = 0; i < 8; ++i) {
+        uint64_t x = q[i];
+
+        q[i] = (x & (uint64_t) 0x000000000000FFFF)
+               | ((x & (uint64_t) 0x00000000FFF00000) >> 4)
+               | ((x & (uint64_t) 0x00000000000F0000) << 12)
+               | ((x & (uint64_t) 0x0000FF0000000000) >> 8)
+               | ((x & (uint64_t) 0x000000FF00000000) << 8)
+               | ((x & (uint64_t) 0xF000000000000000) >> 12)
+               | ((x & (uint64_t) 0x0FFF000000000000) << 4);
+    }
+}
+
+
+static void sliceInvShiftRows(uint64_t *q) {
+    for (int i = 0; i < 8; ++i) {
+        uint64_t x = q[i];
+
+        q[i] = (x & (uint64_t) 0x000000000000FFFF)
+               | ((x & (uint64_t) 0x000000000FFF0000) << 4)
+               | ((x & (uint64_t) 0x00000000F0000000) >> 12)
+               | ((x & (uint64_t) 0x000000FF00000000) << 8)
+               | ((x & (uint64_t) 0x0000FF0000000000) >> 8)
+               | ((x & (uint64_t) 0x000F000000000000) << 12)
+               | ((x & (uint64_t) 0xFFF0000000000000) >> 4);
+    }
+}
+
+
+static uint64_t rotr32(uint64_t x) {
+    return (x << 32) | (x >> 32);
+}
+
+
+static void sliceMixColumns(uint64_t *q) {
+    uint64_t q0 = q[0], q1 = q[1], q2 = q[2], q3 = q[3];
+    uint64_t q4 = q[4], q5 = q[5], q6 = q[6], q7 = q[7];
+    uint64_t r0 = (q0 >> 16) | (q0 << 48);
+    uint64_t r1 = (q1 >> 16) | (q1 << 48);
+    uint64_t r2 = (q2 >> 16) | (q2 << 48);
+    uint64_t r3 = (q3 >> 16) | (q3 << 48);
+    uint64_t r4 = (q4 >> 16) | (q4 << 48);
+    uint64_t r5 = (q5 >> 16) | (q5 << 48);
+    uint64_t r6 = (q6 >> 16) | (q6 << 48);
+    uint64_t r7 = (q7 >> 16) | (q7 << 48);
+
+    q[0] = q7 ^ r7 ^ r0 ^ rotr32(q0 ^ r0);
+    q[1] = q0 ^ r0 ^ q7 ^ r7 ^ r1 ^ rotr32(q1 ^ r1);
+    q[2] = q1 ^ r1 ^ r2 ^ rotr32(q2 ^ r2);
+    q[3] = q2 ^ r2 ^ q7 ^ r7 ^ r3 ^ rotr32(q3 ^ r3);
+    q[4] = q3 ^ r3 ^ q7 ^ r7 ^ r4 ^ rotr32(q4 ^ r4);
+    q[5] = q4 ^ r4 ^ r5 ^ rotr32(q5 ^ r5);
+    q[6] = q5 ^ r5 ^ r6 ^ rotr32(q6 ^ r6);
+    q[7] = q6 ^ r6 ^ r7 ^ rotr32(q7 ^ r7);
+}
+
+
+static void sliceInvMixColumns(uint64_t *q) {
+    uint64_t q0 = q[0], q1 = q[1], q2 = q[2], q3 = q[3];
+    uint64_t q4 = q[4], q5 = q[5], q6 = q[6], q7 = q[7];
+    uint64_t r0 = (q0 >> 16) | (q0 << 48);
+    uint64_t r1 = (q1 >> 16) | (q1 << 48);
+    uint64_t r2 = (q2 >> 16) | (q2 << 48);
+    uint64_t r3 = (q3 >> 16) | (q3 << 48);
+    uint64_t r4 = (q4 >> 16) | (q4 << 48);
+    uint64_t r5 = (q5 >> 16) | (q5 << 48);
+    uint64_t r6 = (q6 >> 16) | (q6 << 48);
+    uint64_t r7 = (q7 >> 16) | (q7 << 48);
+
+    q[0] = q5 ^ q6 ^ q7 ^ r0 ^ r5 ^ r7 ^ rotr32(q0 ^ q5 ^ q6 ^ r0 ^ r5);
+    q[1] = q0 ^ q5 ^ r0 ^ r1 ^ r5 ^ r6 ^ r7 ^ rotr32(q1 ^ q5 ^ q7 ^ r1 ^ r5 ^ r6);
+    q[2] = q0 ^ q1 ^ q6 ^ r1 ^ r2 ^ r6 ^ r7 ^ rotr32(q0 ^ q2 ^ q6 ^ r2 ^ r6 ^ r7);
+    q[3] = q0 ^ q1 ^ q2 ^ q5 ^ q6 ^ r0 ^ r2 ^ r3 ^ r5 ^ rotr32(q0 ^ q1 ^ q3 ^ q5 ^ q6 ^ q7 ^ r0 ^ r3 ^ r5 ^ r7);
+    q[4] = q1 ^ q2 ^ q3 ^ q5 ^ r1 ^ r3 ^ r4 ^ r5 ^ r6 ^ r7 ^ rotr32(q1 ^ q2 ^ q4 ^ q5 ^ q7 ^ r1 ^ r4 ^ r5 ^ r6);
+    q[5] = q2 ^ q3 ^ q4 ^ q6 ^ r2 ^ r4 ^ r5 ^ r6 ^ r7 ^ rotr32(q2 ^ q3 ^ q5 ^ q6 ^ r2 ^ r5 ^ r6 ^ r7);
+    q[6] = q3 ^ q4 ^ q5 ^ q7 ^ r3 ^ r5 ^ r6 ^ r7 ^ rotr32(q3 ^ q4 ^ q6 ^ q7 ^ r3 ^ r6 ^ r7);
+    q[7] = q4 ^ q5 ^ q6 ^ r4 ^ r6 ^ r7 ^ rotr32(q4 ^ q5 ^ q7 ^ r4 ^ r7);
+}
+
+
+static void sliceAddRoundKey(uint64_t *q, const uint64_t *sk) {
+    for (int i = 0; i < 8; ++i) {
+        q[i] ^= sk[i];
+    }
+}
+
+
+/**
+ * Runs the blocks through the rounds in groups of BITSLICE_BLOCKS, the last group is completed with zero blocks.
+ */
+static void bitsliceBlocks(const byte *roundKey, int rounds, byte *data, size_t blockCount, int decrypt) {
+    uint64_t sk[(MAX_ROUNDS + 1) * 8];
+
+    sliceRoundKey(roundKey, rounds, sk);
+
+    for (size_t block = 0; block < blockCount; block += BITSLICE_BLOCKS) {
+        size_t count = blockCount - block < BITSLICE_BLOCKS ? blockCount - block : BITSLICE_BLOCKS;
+        byte buf[BITSLICE_BLOCKS * AES_BLOCK_SIZE];
+        byte *ptr = data + block * AES_BLOCK_SIZE;
+        uint64_t q[16];
+
+        if (count < BITSLICE_BLOCKS) {
+            memset(buf, 0, sizeof(buf));
+            memcpy(buf, ptr, count * AES_BLOCK_SIZE);
+            ptr = buf;
+        }
+        loadSlice(q, ptr);
+        loadSlice(q + 8, ptr + SLICE_BLOCKS * AES_BLOCK_SIZE);
+
+        if (!decrypt) {
+            sliceAddRoundKey(q, sk);
+            sliceAddRoundKey(q + 8, sk);
+            for (int round = 1; round < rounds; ++round) {
+                sliceSbox(q);
+                sliceSbox(q + 8);
+                sliceShiftRows(q);
+                sliceShiftRows(q + 8);
+                sliceMixColumns(q);
+                sliceMixColumns(q + 8);
+                sliceAddRoundKey(q, sk + round * 8);
+                sliceAddRoundKey(q + 8, sk + round * 8);
+            }
+            sliceSbox(q);
+            sliceSbox(q + 8);
+            sliceShiftRows(q);
+            sliceShiftRows(q + 8);
+            sliceAddRoundKey(q, sk + rounds * 8);
+            sliceAddRoundKey(q + 8, sk + rounds * 8);
+        } else {
+            sliceAddRoundKey(q, sk);
+            sliceAddRoundKey(q + 8, sk);
+            for (int round = 1; round < rounds; ++round) {
+                sliceInvSbox(q);
+                sliceInvSbox(q + 8);
+                sliceInvShiftRows(q);
+                sliceInvShiftRows(q + 8);
+                sliceInvMixColumns(q);
+                sliceInvMixColumns(q + 8);
+                sliceAddRoundKey(q, sk + round * 8);
+                sliceAddRoundKey(q + 8, sk + round * 8);
+            }
+            sliceInvSbox(q);
+            sliceInvSbox(q + 8);
+            sliceInvShiftRows(q);
+            sliceInvShiftRows(q + 8);
+            sliceAddRoundKey(q, sk + rounds * 8);
+            sliceAddRoundKey(q + 8, sk + rounds * 8);
+        }
+
+        storeSlice(q, ptr);
+        storeSlice(q + 8, ptr + SLICE_BLOCKS * AES_BLOCK_SIZE);
+        if (ptr == buf) {
+            memcpy(data + block * AES_BLOCK_SIZE, buf, count * AES_BLOCK_SIZE);
+        }
+    }
+}
+
+
+static void bitsliceEncryptBlocks(const byte *roundKey, int rounds, byte *data, size_t blockCount) {
+    bitsliceBlocks(roundKey, rounds, data, blockCount, 0);
+}
+
+
+static void bitsliceDecryptBlocks(const byte *roundKey, int rounds, byte *data, size_t blockCount) {
+    bitsliceBlocks(roundKey, rounds, data, blockCount, 1);
+}
+
+
+const EngineAES bitsliceEngineAES = {
+        "bitslice",
+        0,
+        NULL,
+        bitsliceEncryptBlocks,
+        bitsliceDecryptBlocks,
+        NULL
+};
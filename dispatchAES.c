@@ -0,0 +1,252 @@
+/*
+ * AES crypter
+ *
+ * Detection of the processor features and the choice of the engines.
+ *
+ * The features are detected once, on the first call of dispatchAES. Then the engines are bound:
+ * the best engine for the calls with many independent blocks and the best engine for the calls
+ * with one block at a time. The environment variable AES_ENGINE or setEngineAES can force
+ * one engine for all calls.
+ */
+#include <string.h>
+
+#include "engineAES.h"
+
+#ifdef _HARDWARE_AES
+#ifdef _MSC_VER
+#include <intrin.h>
+#else // _MSC_VER
+#include <cpuid.h>
+#endif // _MSC_VER
+#endif // _HARDWARE_AES
+
+#ifndef _WIN32
+#include <pthread.h>
+#endif // _WIN32
+
+// all engines, the automatic choice takes the first supported engine of each list
+static const EngineAES *const parallelEngines[] = {
+#ifdef _WIDE_AES
+        &wide512EngineAES,
+        &wide256EngineAES,
+#endif // _WIDE_AES
+#ifdef _HARDWARE_AES
+        &hardwareEngineAES,
+#endif // _HARDWARE_AES
+        &bitsliceEngineAES,
+        NULL
+};
+
+static const EngineAES *const serialEngines[] = {
+#ifdef _HARDWARE_AES
+        &hardwareEngineAES,
+        &vpermEngineAES,
+#endif // _HARDWARE_AES
+        &tableEngineAES,
+        &referenceEngineAES,
+        NULL
+};
+
+static DispatchAES dispatch;
+
+// the name of the active engines for getEngineAES
+static char engineName[64];
+
+
+#ifdef _HARDWARE_AES
+static void dispatchCpuid(unsigned int leaf, unsigned int *regs) {
+    regs[0] = regs[1] = regs[2] = regs[3] = 0;
+#ifdef _MSC_VER
+    __cpuidex((int *) regs, (int) leaf, 0);
+#else // _MSC_VER
+    __cpuid_count(leaf, 0, regs[0], regs[1], regs[2], regs[3]);
+#endif // _MSC_VER
+}
+
+
+static unsigned long long dispatchXgetbv(void) {
+#ifdef _MSC_VER
+    return _xgetbv(0);
+#else // _MSC_VER
+    unsigned int eax, edx;
+
+    __asm__ volatile ("xgetbv" : "=a" (eax), "=d" (edx) : "c" (0));
+    return ((unsigned long long) edx << 32) | eax;
+#endif // _MSC_VER
+}
+#endif // _HARDWARE_AES
+
+
+/**
+ * Detects the processor features with CPUID, the AVX features also need the support of the system (XGETBV).
+ */
+static unsigned int detectFeatures(void) {
+    unsigned int features = 0;
+#ifdef _HARDWARE_AES
+    unsigned int regs[4];
+    unsigned int maxLeaf;
+    unsigned long long xcr0 = 0;
+
+    dispatchCpuid(0, regs);
+    maxLeaf = regs[0];
+    if (maxLeaf < 1) {
+        return 0;
+    }
+
+    // CPUID.1:ECX: PCLMULQDQ[bit 1], SSSE3[bit 9], AES[bit 25], OSXSAVE[bit 27]
+    dispatchCpuid(1, regs);
+    if ((regs[2] >> 1) & 1) {
+        features |= FEATURE_PCLMULQDQ;
+    }
+    if ((regs[2] >> 9) & 1) {
+        features |= FEATURE_SSSE3;
+    }
+    if ((regs[2] >> 25) & 1) {
+        features |= FEATURE_AESNI;
+    }
+    if ((regs[2] >> 27) & 1) {
+        xcr0 = dispatchXgetbv();
+    }
+
+    // CPUID.7:EBX: AVX2[bit 5], AVX512F[bit 16], CPUID.7:ECX.VAES[bit 9]
+    if (maxLeaf >= 7) {
+        dispatchCpuid(7, regs);
+        // the system must save the YMM registers, and also the opmask and ZMM registers for AVX-512
+        if ((xcr0 & 0x06) == 0x06) {
+            if ((regs[1] >> 5) & 1) {
+                features |= FEATURE_AVX2;
+            }
+            if ((regs[2] >> 9) & 1) {
+                features |= FEATURE_VAES;
+            }
+            if (((regs[1] >> 16) & 1) && (xcr0 & 0xE0) == 0xE0) {
+                features |= FEATURE_AVX512;
+            }
+        }
+    }
+#endif // _HARDWARE_AES
+    return features;
+}
+
+
+static int supported(const EngineAES *engine) {
+    return (dispatch.features & engine->features) == engine->features;
+}
+
+
+static const EngineAES *findEngine(lpcstr name) {
+    for (int i = 0; parallelEngines[i] != NULL; ++i) {
+        if (strcmp(parallelEngines[i]->name, name) == 0) {
+            return parallelEngines[i];
+        }
+    }
+    for (int i = 0; serialEngines[i] != NULL; ++i) {
+        if (strcmp(serialEngines[i]->name, name) == 0) {
+            return serialEngines[i];
+        }
+    }
+    return NULL;
+}
+
+
+static void bindEngines(const EngineAES *serial, const EngineAES *parallel) {
+    dispatch.serial = serial;
+    dispatch.parallel = parallel;
+
+    if (serial == parallel) {
+        snprintf(engineName, sizeof(engineName), "%s", serial->name);
+    } else {
+        snprintf(engineName, sizeof(engineName), "%s+%s", parallel->name, serial->name);
+    }
+}
+
+
+static void bindAutomatic(void) {
+    const EngineAES *serial = NULL, *parallel = NULL;
+
+    for (int i = 0; parallel == NULL; ++i) {
+        if (supported(parallelEngines[i])) {
+            parallel = parallelEngines[i];
+        }
+    }
+    for (int i = 0; serial == NULL; ++i) {
+        if (supported(serialEngines[i])) {
+            serial = serialEngines[i];
+        }
+    }
+    bindEngines(serial, parallel);
+}
+
+
+static void dispatchInit(void) {
+    lpcstr forced = getenv("AES_ENGINE");
+
+    dispatch.features = detectFeatures();
+
+    // the tables of all supported engines are built here, so that a forced engine is ready at once
+    for (int i = 0; serialEngines[i] != NULL; ++i) {
+        if (serialEngines[i]->init != NULL && supported(serialEngines[i])) {
+            serialEngines[i]->init();
+        }
+    }
+    for (int i = 0; parallelEngines[i] != NULL; ++i) {
+        if (parallelEngines[i]->init != NULL && supported(parallelEngines[i])) {
+            parallelEngines[i]->init();
+        }
+    }
+
+    bindAutomatic();
+    if (forced != NULL && forced[0] != '\0') {
+        const EngineAES *engine = findEngine(forced);
+
+        if (engine != NULL && supported(engine)) {
+            bindEngines(engine, engine);
+        }
+    }
+}
+
+
+#ifdef _WIN32
+static BOOL CALLBACK dispatchInitOnce(PINIT_ONCE once, PVOID param, PVOID *context) {
+    dispatchInit();
+    return TRUE;
+}
+#endif // _WIN32
+
+
+const DispatchAES *dispatchAES(void) {
+#ifdef _WIN32
+    static INIT_ONCE once = INIT_ONCE_STATIC_INIT;
+
+    InitOnceExecuteOnce(&once, dispatchInitOnce, NULL, NULL);
+#else // _WIN32
+    static pthread_once_t once = PTHREAD_ONCE_INIT;
+
+    pthread_once(&once, dispatchInit);
+#endif // _WIN32
+    return &dispatch;
+}
+
+
+int setEngineAES(lpcstr name) {
+    const EngineAES *engine;
+
+    dispatchAES();
+    if (name == NULL) {
+        bindAutomatic();
+        return 0;
+    }
+
+    engine = findEngine(name);
+    if (engine == NULL || !supported(engine)) {
+        return 1;
+    }
+    bindEngines(engine, engine);
+    return 0;
+}
+
+
+lpcstr getEngineAES(void) {
+    dispatchAES();
+    return engineName;
+}
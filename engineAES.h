@@ -0,0 +1,265 @@
+/*
+ * AES crypter
+ *
+ * Internal interface of the block engines, it is not part of the public API.
+ *
+ * An engine encrypts or decrypts whole blocks in place. The blocks are stored one after another
+ * in the order of the input data (not in the order of expandBlock), the round keys are passed
+ * as 16 bytes per round in the same order.
+ *
+ * Decryption follows the equivalent inverse cipher of FIPS-197 and gets its own round keys
+ * (ContextAES.invRoundKey): the encryption round keys in reverse order, InvMixColumns is applied
+ * to all of them except the first and the last. So each decryption round has the same shape as
+ * an encryption round: InvSubBytes, InvShiftRows, InvMixColumns, AddRoundKey.
+ */
+#ifndef _ENGINE_AES_H_
+#define _ENGINE_AES_H_
+
+#include <stdint.h>
+#include <string.h>
+
+#include "AES.h"
+
+#if (defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)) && \
+    (defined(__GNUC__) || defined(_MSC_VER))
+#define _HARDWARE_AES
+#endif
+
+// VAES needs GCC 8 or newer for the 256 and 512-bit intrinsics
+#if defined(_HARDWARE_AES) && (defined(_MSC_VER) || defined(__clang__) || __GNUC__ >= 8)
+#define _WIDE_AES
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// processor features, detected once by dispatchAES
+#define FEATURE_AESNI     0x01
+#define FEATURE_PCLMULQDQ 0x02
+#define FEATURE_SSSE3     0x04
+#define FEATURE_AVX2      0x08
+#define FEATURE_VAES      0x10
+#define FEATURE_AVX512    0x20
+
+typedef void (*CryptBlocksAES)(const byte *roundKey, int rounds, byte *data, size_t blockCount);
+
+/*
+ * Encrypts one block in place in each lane, each lane has its own round keys (all with the same number of rounds).
+ * The blocks of different keys are independent, so they are processed together like the blocks of one key.
+ */
+typedef void (*CryptLanesAES)(const byte *const *roundKey, int rounds, byte *const *block, size_t laneCount);
+
+/*
+ * The middle rounds (all rounds except the first key addition and the last round) of each version of AES.
+ * ROUND(n) is expanded once for each round, so a round written once as a macro is unrolled
+ * with the number of rounds known at compile time.
+ */
+#define ROUNDS_AES_128(ROUND) ROUND(1) ROUND(2) ROUND(3) ROUND(4) ROUND(5) ROUND(6) ROUND(7) ROUND(8) ROUND(9)
+#define ROUNDS_AES_192(ROUND) ROUNDS_AES_128(ROUND) ROUND(10) ROUND(11)
+#define ROUNDS_AES_256(ROUND) ROUNDS_AES_192(ROUND) ROUND(12) ROUND(13)
+
+/*
+ * Generates the CryptBlocksAES function "name" that passes the call to the function specialized
+ * for the number of rounds: prefix##128, prefix##192 or prefix##256.
+ */
+#define DISPATCH_ROUNDS(name, prefix)                                                   \
+static void name(const byte *roundKey, int rounds, byte *data, size_t blockCount) {     \
+    switch (rounds) {                                                                   \
+        case ROUND_AES_128:                                                             \
+            prefix##128(roundKey, data, blockCount);                                    \
+            break;                                                                      \
+        case ROUND_AES_192:                                                             \
+            prefix##192(roundKey, data, blockCount);                                    \
+            break;                                                                      \
+        default:                                                                        \
+            prefix##256(roundKey, data, blockCount);                                    \
+            break;                                                                      \
+    }                                                                                   \
+}
+
+typedef struct {
+    lpcstr name;
+    // the processor features the engine needs
+    unsigned int features;
+    // builds the tables of the engine, NULL if it has none
+    void (*init)(void);
+    CryptBlocksAES encryptBlocks;
+    CryptBlocksAES decryptBlocks;
+    // encrypts the blocks of many keys at once, NULL if the engine takes one key at a time
+    CryptLanesAES encryptLanes;
+} EngineAES;
+
+typedef struct {
+    // the features of the processor
+    unsigned int features;
+    // takes one block at a time, when each block depends on the previous one (CBC encryption)
+    const EngineAES *serial;
+    // takes many independent blocks at once
+    const EngineAES *parallel;
+} DispatchAES;
+
+/**
+ * Returns the dispatch table. On the first call the processor features are detected (CPUID) and the
+ * engines are bound, the environment variable AES_ENGINE can force one engine for all calls.
+ */
+const DispatchAES *dispatchAES(void);
+
+/*
+ * Atomic operations of the worker pool and the scheduler of batches, the counters are long long and the locks long.
+ */
+#ifdef _MSC_VER
+#include <intrin.h>
+#define atomicFetchAddAES(value, add) ((size_t) _InterlockedExchangeAdd64((volatile long long *) (value), (add)))
+#define atomicLoadAES(value) _InterlockedOr64((volatile long long *) (value), 0)
+#define atomicLockAES(lock) while (_InterlockedExchange((volatile long *) (lock), 1)) _mm_pause()
+#define atomicUnlockAES(lock) _InterlockedExchange((volatile long *) (lock), 0)
+#else // _MSC_VER
+#define atomicFetchAddAES(value, add) ((size_t) __atomic_fetch_add(value, add, __ATOMIC_ACQ_REL))
+#define atomicLoadAES(value) __atomic_load_n(value, __ATOMIC_ACQUIRE)
+#define atomicLockAES(lock) while (__atomic_exchange_n(lock, 1, __ATOMIC_ACQUIRE)) continue
+#define atomicUnlockAES(lock) __atomic_store_n(lock, 0, __ATOMIC_RELEASE)
+#endif // _MSC_VER
+
+/**
+ * XORs size bytes of other into data, eight bytes at a time. It is in the header so that the calls
+ * for one block are inlined.
+ */
+static inline void xorBytesAES(byte *data, const byte *other, size_t size) {
+    size_t i = 0;
+
+    // memcpy does not need the alignment
+    for (; i + 8 <= size; i += 8) {
+        uint64_t a, b;
+
+        memcpy(&a, data + i, 8);
+        memcpy(&b, other + i, 8);
+        a ^= b;
+        memcpy(data + i, &a, 8);
+    }
+    for (; i < size; ++i) {
+        data[i] ^= other[i];
+    }
+}
+
+/**
+ * Prepares the tables of GHASH in the context from its round keys, called by initContextAES.
+ */
+void initGhashAES(ContextAES *context);
+
+/**
+ * Decrypts whole blocks of CBC in place, chain accepts the IV and returns the last ciphertext block.
+ * cipher accepts the ciphertext of the data if it is kept in another buffer, otherwise NULL.
+ */
+void decryptCbcBlocksAES(const ContextAES *context, byte *data, const byte *cipher, size_t blockCount, byte *chain);
+
+// the calls that the worker pool splits into chunks, their blocks do not depend on each other
+typedef enum {
+    POOL_ENCRYPT_ECB,
+    POOL_DECRYPT_ECB,
+    POOL_DECRYPT_CBC
+} PoolTaskAES;
+
+/**
+ * Processes blockCount blocks of data into output (it can be the same as data, otherwise they must not overlap)
+ * on the worker pool. For CBC chain accepts the IV and returns the last ciphertext block.
+ * Returns 1 and does nothing if the data is smaller than the threshold, the pool has one thread or it is busy
+ * with another call, then the caller processes the data itself.
+ */
+int poolCryptAES(const ContextAES *context, PoolTaskAES task, const byte *data, byte *output, size_t blockCount,
+                 byte *chain);
+
+/**
+ * The function that poolRunAES gives to every thread, worker is the number of the thread.
+ */
+typedef void (*PoolRunAES)(void *arg, int worker);
+
+/**
+ * Takes the worker pool for a call of dataSize bytes. Returns the number of threads with the calling thread,
+ * or 0 if the call stays on the calling thread (see poolCryptAES), then poolRunAES and poolEndAES are not called.
+ */
+int poolBeginAES(size_t dataSize);
+
+/**
+ * Runs run(arg, worker) on every thread of the pool, the calling thread is worker 0, and waits for all of them.
+ */
+void poolRunAES(PoolRunAES run, void *arg);
+
+/**
+ * Gives the worker pool back after poolBeginAES.
+ */
+void poolEndAES(void);
+
+/**
+ * Returns a monotonic time in nanoseconds, for the statistics of the scheduler and of the files.
+ */
+uint64_t clockAES(void);
+
+/**
+ * Encrypts or decrypts the data in place in the mode on the calling thread, chain accepts the IV and returns the IV
+ * for the data that follows. The modes with padding take whole blocks, GCM is not supported.
+ */
+void cryptModeAES(const ContextAES *context, byte *data, size_t dataSize, ModeAES mode, int decrypt, byte *chain);
+
+/**
+ * GCM in parts for CipherAES: startGcmAES prepares the state for the 96-bit IV (without AAD), cryptGcmAES encrypts
+ * or decrypts the next part (every part except the last is a multiple of 16 bytes), tagGcmAES computes the full tag
+ * for dataSize bytes of all parts.
+ */
+void startGcmAES(const ContextAES *context, GcmStateAES *state, const byte *iv);
+
+void cryptGcmAES(const ContextAES *context, GcmStateAES *state, byte *data, size_t dataSize, int decrypt);
+
+void tagGcmAES(const ContextAES *context, GcmStateAES *state, uint64_t dataSize, byte *tag);
+
+/**
+ * Prepares the subkeys of CMAC and PMAC in the context from its round keys, called by initContextAES.
+ */
+void initMacAES(ContextAES *context);
+
+/**
+ * The S-box and InvS-box tables from AES.c, the engines build their tables from them.
+ */
+extern const byte Sbox[256];
+extern const byte invSbox[256];
+
+/**
+ * Engine on the round functions of AES.c.
+ */
+extern const EngineAES referenceEngineAES;
+
+/**
+ * Engine on 32-bit tables, works on any processor.
+ */
+extern const EngineAES tableEngineAES;
+
+/**
+ * Bitsliced engine working in constant time, processes eight blocks at once.
+ */
+extern const EngineAES bitsliceEngineAES;
+
+#ifdef _HARDWARE_AES
+/**
+ * Engine on the AES-NI instructions.
+ */
+extern const EngineAES hardwareEngineAES;
+
+/**
+ * Engine on the SSSE3 vector permutation, works in constant time without AES-NI.
+ */
+extern const EngineAES vpermEngineAES;
+#endif // _HARDWARE_AES
+
+#ifdef _WIDE_AES
+/**
+ * Engines on the VAES instructions, four and two blocks per instruction.
+ */
+extern const EngineAES wide512EngineAES;
+extern const EngineAES wide256EngineAES;
+#endif // _WIDE_AES
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif //_ENGINE_AES_H_
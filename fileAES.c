@@ -0,0 +1,505 @@
+/*
+ * AES crypter
+ *
+ * Encryption and decryption of files in chunks, the memory does not depend on the size of the file.
+ *
+ * On Linux the reads and the writes go through io_uring: a fixed ring of FILE_DEPTH chunks is registered once
+ * as the buffers of the kernel, the reads of the next chunks and the writes of the previous ones are in flight
+ * while the calling thread encrypts the current chunk. The chunks are encrypted in order, so CBC carries its chain
+ * from one chunk to the next, and only the last chunk gets PKCS7 Padding (or loses it). Chunk k always takes
+ * buffer k % FILE_DEPTH, and when its write is finished the buffer reads chunk k + FILE_DEPTH.
+ *
+ * If io_uring is not available (an old kernel, a sandbox, another system), the file is processed with stdio,
+ * one chunk after another.
+ */
+#ifndef _GNU_SOURCE
+// syscall, MAP_POPULATE and O_CLOEXEC are not in strict C11
+#define _GNU_SOURCE
+#endif // _GNU_SOURCE
+#include <string.h>
+
+#include "engineAES.h"
+
+#ifdef __linux__
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#endif // __linux__
+
+// the size of one chunk, 1 MiB
+#define FILE_CHUNK (1024 * 1024)
+
+// the number of chunks in flight
+#define FILE_DEPTH 8
+
+// 0 if setFileUringAES turned io_uring off
+static int fileUringEnabled = 1;
+
+typedef struct {
+    const ContextAES *context;
+    ModeAES mode;
+    int decrypt;
+    byte chain[IV_SIZE];
+} FileCrypt;
+
+
+/**
+ * Encrypts or decrypts one chunk in place, the last chunk gets or loses the padding.
+ * size accepts the size of the chunk and returns the size to write, the buffer has a block more for the padding.
+ * Returns 1 if the last chunk of the encrypted data of ECB or CBC is not a multiple of 16 bytes.
+ */
+static int fileChunk(FileCrypt *crypt, byte *buffer, size_t *size, int last) {
+    if (!last) {
+        cryptModeAES(crypt->context, buffer, *size, crypt->mode, crypt->decrypt, crypt->chain);
+        return 0;
+    }
+    if (crypt->decrypt) {
+        return decryptInPlaceAES(crypt->context, buffer, size, crypt->mode, crypt->chain);
+    }
+    return encryptInPlaceAES(crypt->context, buffer, size, *size + AES_BLOCK_SIZE, crypt->mode, crypt->chain);
+}
+
+
+/**
+ * The portable path: reads one chunk ahead, so the last chunk is known before it is encrypted.
+ */
+static int fileStdio(FileCrypt *crypt, lpcstr inputPath, lpcstr outputPath, FileStatsAES *stats) {
+    FILE *input = fopen(inputPath, "rb");
+    FILE *output = input != NULL ? fopen(outputPath, "wb") : NULL;
+    byte *buffer = malloc(2 * (FILE_CHUNK + AES_BLOCK_SIZE));
+    byte *current, *next;
+    size_t currentSize, nextSize;
+    int result = 0;
+
+    if (input == NULL || output == NULL || buffer == NULL) {
+        result = 1;
+    } else {
+        current = buffer;
+        next = buffer + FILE_CHUNK + AES_BLOCK_SIZE;
+        currentSize = fread(current, 1, FILE_CHUNK, input);
+        while (currentSize > 0) {
+            byte *swap = current;
+
+            nextSize = currentSize == FILE_CHUNK ? fread(next, 1, FILE_CHUNK, input) : 0;
+            stats->inputSize += currentSize;
+            if ((nextSize > 0 && currentSize % AES_BLOCK_SIZE != 0) ||
+                fileChunk(crypt, current, &currentSize, nextSize == 0) ||
+                fwrite(current, 1, currentSize, output) != currentSize) {
+                result = 1;
+                break;
+            }
+            stats->outputSize += currentSize;
+
+            current = next;
+            next = swap;
+            currentSize = nextSize;
+        }
+        result |= ferror(input) != 0;
+    }
+
+    if (input != NULL) {
+        fclose(input);
+    }
+    if (output != NULL && fclose(output) != 0) {
+        result = 1;
+    }
+    free(buffer);
+    return result;
+}
+
+
+#ifdef __linux__
+
+typedef enum {
+    FILE_FREE,
+    FILE_READING,
+    FILE_READY,
+    FILE_WRITING
+} FileState;
+
+typedef struct {
+    byte *buffer;
+    FileState state;
+    // the chunk in the buffer, its size and the bytes of the current read or write that are done
+    size_t chunk;
+    size_t size;
+    size_t done;
+} FileSlot;
+
+typedef struct {
+    int fd;
+    // the rings shared with the kernel
+    unsigned *sqHead, *sqTail, *sqMask, *sqArray;
+    unsigned *cqHead, *cqTail, *cqMask;
+    struct io_uring_sqe *sqes;
+    struct io_uring_cqe *cqes;
+    void *sqRing, *cqRing;
+    size_t sqRingSize, cqRingSize, sqesSize;
+    // the submissions that are not passed to the kernel yet
+    unsigned pending;
+    // the reads and writes whose completions are not reaped yet, the buffers are used by the kernel until it is 0
+    unsigned inFlight;
+    // the buffers are registered, the fixed reads and writes can be used
+    int fixed;
+} FileRing;
+
+
+/**
+ * Returns 1 if the kernel has no plain reads and writes of io_uring (before Linux 5.6), they are needed
+ * when the buffers cannot be registered.
+ */
+static int fileProbe(int fd) {
+    struct io_uring_probe *probe = calloc(1, sizeof(struct io_uring_probe) + 256 * sizeof(struct io_uring_probe_op));
+    int supported;
+
+    if (probe == NULL) {
+        return 1;
+    }
+    // the kernels without the plain reads and writes do not have the probe either
+    supported = syscall(__NR_io_uring_register, fd, IORING_REGISTER_PROBE, probe, 256) == 0 &&
+                probe->ops_len > IORING_OP_WRITE && (probe->ops[IORING_OP_READ].flags & IO_URING_OP_SUPPORTED) &&
+                (probe->ops[IORING_OP_WRITE].flags & IO_URING_OP_SUPPORTED);
+    free(probe);
+    return !supported;
+}
+
+
+static int fileRingSetup(FileRing *ring, byte *buffer) {
+    struct io_uring_params params;
+    struct iovec iov[FILE_DEPTH];
+
+    memset(ring, 0, sizeof(FileRing));
+    memset(&params, 0, sizeof(params));
+    ring->fd = (int) syscall(__NR_io_uring_setup, 2 * FILE_DEPTH, &params);
+    if (ring->fd < 0) {
+        return 1;
+    }
+
+    ring->sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    ring->cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        ring->sqRingSize = ring->cqRingSize > ring->sqRingSize ? ring->cqRingSize : ring->sqRingSize;
+        ring->cqRingSize = ring->sqRingSize;
+    }
+    ring->sqesSize = params.sq_entries * sizeof(struct io_uring_sqe);
+
+    ring->sqRing = mmap(NULL, ring->sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd,
+                        IORING_OFF_SQ_RING);
+    ring->cqRing = ring->sqRing;
+    if (ring->sqRing != MAP_FAILED && !(params.features & IORING_FEAT_SINGLE_MMAP)) {
+        ring->cqRing = mmap(NULL, ring->cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd,
+                            IORING_OFF_CQ_RING);
+    }
+    ring->sqes = mmap(NULL, ring->sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd,
+                      IORING_OFF_SQES);
+    if (ring->sqRing == MAP_FAILED || ring->cqRing == MAP_FAILED || ring->sqes == MAP_FAILED) {
+        return 1;
+    }
+
+    ring->sqHead = (unsigned *) ((byte *) ring->sqRing + params.sq_off.head);
+    ring->sqTail = (unsigned *) ((byte *) ring->sqRing + params.sq_off.tail);
+    ring->sqMask = (unsigned *) ((byte *) ring->sqRing + params.sq_off.ring_mask);
+    ring->sqArray = (unsigned *) ((byte *) ring->sqRing + params.sq_off.array);
+    ring->cqHead = (unsigned *) ((byte *) ring->cqRing + params.cq_off.head);
+    ring->cqTail = (unsigned *) ((byte *) ring->cqRing + params.cq_off.tail);
+    ring->cqMask = (unsigned *) ((byte *) ring->cqRing + params.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe *) ((byte *) ring->cqRing + params.cq_off.cqes);
+
+    // without the registration (for example the limit of locked memory) the plain reads and writes are used
+    for (int i = 0; i < FILE_DEPTH; ++i) {
+        iov[i].iov_base = buffer + (size_t) i * (FILE_CHUNK + AES_BLOCK_SIZE);
+        iov[i].iov_len = FILE_CHUNK + AES_BLOCK_SIZE;
+    }
+    ring->fixed = syscall(__NR_io_uring_register, ring->fd, IORING_REGISTER_BUFFERS, iov, FILE_DEPTH) == 0;
+    return !ring->fixed && fileProbe(ring->fd);
+}
+
+
+static void fileRingFree(FileRing *ring) {
+    if (ring->sqes != NULL && ring->sqes != MAP_FAILED) {
+        munmap(ring->sqes, ring->sqesSize);
+    }
+    if (ring->cqRing != NULL && ring->cqRing != MAP_FAILED && ring->cqRing != ring->sqRing) {
+        munmap(ring->cqRing, ring->cqRingSize);
+    }
+    if (ring->sqRing != NULL && ring->sqRing != MAP_FAILED) {
+        munmap(ring->sqRing, ring->sqRingSize);
+    }
+    if (ring->fd >= 0) {
+        close(ring->fd);
+    }
+}
+
+
+/**
+ * Adds the read or the write of the rest of the slot to the submission ring.
+ */
+static void fileSubmit(FileRing *ring, FileSlot *slot, int index, int fd, int write) {
+    unsigned tail = *ring->sqTail;
+    unsigned position = tail & *ring->sqMask;
+    struct io_uring_sqe *sqe = &ring->sqes[position];
+
+    memset(sqe, 0, sizeof(struct io_uring_sqe));
+    if (ring->fixed) {
+        sqe->opcode = write ? IORING_OP_WRITE_FIXED : IORING_OP_READ_FIXED;
+        sqe->buf_index = (unsigned short) index;
+    } else {
+        sqe->opcode = write ? IORING_OP_WRITE : IORING_OP_READ;
+    }
+    sqe->fd = fd;
+    sqe->addr = (uint64_t) (uintptr_t) (slot->buffer + slot->done);
+    sqe->len = (unsigned) (slot->size - slot->done);
+    sqe->off = (uint64_t) slot->chunk * FILE_CHUNK + slot->done;
+    sqe->user_data = (uint64_t) index;
+
+    ring->sqArray[position] = position;
+    __atomic_store_n(ring->sqTail, tail + 1, __ATOMIC_RELEASE);
+    ++ring->pending;
+    ++ring->inFlight;
+}
+
+
+/**
+ * Passes the submissions to the kernel and waits for at least wait completions, returns 1 on an error.
+ */
+static int fileEnter(FileRing *ring, unsigned wait) {
+    long result;
+
+    do {
+        result = syscall(__NR_io_uring_enter, ring->fd, ring->pending, wait, wait > 0 ? IORING_ENTER_GETEVENTS : 0,
+                         NULL, 0);
+    } while (result < 0 && errno == EINTR);
+    if (result < 0) {
+        return 1;
+    }
+    ring->pending -= (unsigned) result < ring->pending ? (unsigned) result : ring->pending;
+    return 0;
+}
+
+
+/**
+ * Waits for the completions of all reads and writes after an error, without new submissions.
+ * Returns 1 if the kernel can still use the buffers.
+ */
+static int fileDrain(FileRing *ring) {
+    while (ring->inFlight > 0) {
+        unsigned head = *ring->cqHead;
+        unsigned tail = __atomic_load_n(ring->cqTail, __ATOMIC_ACQUIRE);
+
+        if (head == tail) {
+            if (fileEnter(ring, 1)) {
+                return 1;
+            }
+            continue;
+        }
+        ring->inFlight -= tail - head;
+        __atomic_store_n(ring->cqHead, tail, __ATOMIC_RELEASE);
+    }
+    return 0;
+}
+
+
+/**
+ * Starts the read of the chunk into the slot.
+ */
+static void fileRead(FileRing *ring, FileSlot *slot, int index, int fd, size_t chunk, uint64_t fileSize) {
+    uint64_t offset = (uint64_t) chunk * FILE_CHUNK;
+
+    slot->state = FILE_READING;
+    slot->chunk = chunk;
+    slot->size = fileSize - offset < FILE_CHUNK ? (size_t) (fileSize - offset) : FILE_CHUNK;
+    slot->done = 0;
+    fileSubmit(ring, slot, index, fd, 0);
+}
+
+
+static int fileUring(FileCrypt *crypt, lpcstr inputPath, lpcstr outputPath, FileStatsAES *stats) {
+    FileSlot slot[FILE_DEPTH];
+    FileRing ring;
+    struct stat info;
+    byte *buffer;
+    uint64_t fileSize;
+    size_t chunkCount, nextCrypt = 0, finished = 0;
+    int input, output, result = 0;
+
+    // the pipeline needs the size, the number of chunks and the last chunk are known before the first read
+    input = open(inputPath, O_RDONLY | O_CLOEXEC);
+    if (input < 0) {
+        return 1;
+    }
+    if (fstat(input, &info) != 0) {
+        close(input);
+        return 1;
+    }
+    if (!S_ISREG(info.st_mode) || info.st_size == 0) {
+        // a pipe, a FIFO or a file of procfs has no size, stdio reads it to the end
+        close(input);
+        return -1;
+    }
+    fileSize = (uint64_t) info.st_size;
+    chunkCount = (size_t) ((fileSize + FILE_CHUNK - 1) / FILE_CHUNK);
+
+    buffer = malloc((size_t) FILE_DEPTH * (FILE_CHUNK + AES_BLOCK_SIZE));
+    if (buffer == NULL || fileRingSetup(&ring, buffer)) {
+        if (buffer != NULL) {
+            fileRingFree(&ring);
+        }
+        free(buffer);
+        close(input);
+        // io_uring is not available
+        return -1;
+    }
+    output = open(outputPath, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (output < 0) {
+        fileRingFree(&ring);
+        free(buffer);
+        close(input);
+        return 1;
+    }
+    stats->uring = 1;
+
+    for (int i = 0; i < FILE_DEPTH; ++i) {
+        slot[i].buffer = buffer + (size_t) i * (FILE_CHUNK + AES_BLOCK_SIZE);
+        slot[i].state = FILE_FREE;
+        if ((size_t) i < chunkCount) {
+            fileRead(&ring, &slot[i], i, input, (size_t) i, fileSize);
+        }
+    }
+
+    while (finished < chunkCount && result == 0) {
+        FileSlot *next = &slot[nextCrypt % FILE_DEPTH];
+        unsigned head = *ring.cqHead;
+
+        // the completions: a short read or write continues, a finished write gives the buffer to the next chunk
+        for (; head != __atomic_load_n(ring.cqTail, __ATOMIC_ACQUIRE); ++head) {
+            struct io_uring_cqe *cqe = &ring.cqes[head & *ring.cqMask];
+            int index = (int) cqe->user_data;
+            FileSlot *done = &slot[index];
+
+            --ring.inFlight;
+            if (cqe->res <= 0) {
+                result = 1;
+            }
+            if (result != 0) {
+                // after an error nothing new is submitted, the rest is drained below
+                continue;
+            }
+            done->done += (size_t) cqe->res;
+            if (done->done < done->size) {
+                fileSubmit(&ring, done, index, done->state == FILE_WRITING ? output : input,
+                           done->state == FILE_WRITING);
+            } else if (done->state == FILE_READING) {
+                done->state = FILE_READY;
+            } else {
+                done->state = FILE_FREE;
+                ++finished;
+                if (done->chunk + FILE_DEPTH < chunkCount) {
+                    fileRead(&ring, done, index, input, done->chunk + FILE_DEPTH, fileSize);
+                }
+            }
+        }
+        __atomic_store_n(ring.cqHead, head, __ATOMIC_RELEASE);
+
+        // the next chunk in order is encrypted while the other reads and writes are in flight
+        if (result == 0 && nextCrypt < chunkCount && next->state == FILE_READY) {
+            int last = nextCrypt + 1 == chunkCount;
+
+            stats->inputSize += next->size;
+            if ((!last && next->size % AES_BLOCK_SIZE != 0) || fileChunk(crypt, next->buffer, &next->size, last)) {
+                result = 1;
+                continue;
+            }
+            stats->outputSize += next->size;
+            ++nextCrypt;
+
+            next->state = FILE_WRITING;
+            next->done = 0;
+            fileSubmit(&ring, next, (int) (nextCrypt - 1) % FILE_DEPTH, output, 1);
+            if (fileEnter(&ring, 0)) {
+                result = 1;
+            }
+        } else if (result == 0 && finished < chunkCount && fileEnter(&ring, 1)) {
+            result = 1;
+        }
+    }
+
+    // the kernel must not use the buffers after they are freed, if it still can they are left allocated
+    if (result != 0 && fileDrain(&ring)) {
+        buffer = NULL;
+    }
+    fileRingFree(&ring);
+    free(buffer);
+    close(input);
+    if (close(output) != 0) {
+        result = 1;
+    }
+    return result;
+}
+
+#endif // __linux__
+
+
+/**
+ * Runs the pipeline of io_uring or the portable path and fills the statistics.
+ */
+static int fileCrypt(const ContextAES *context, lpcstr inputPath, lpcstr outputPath, ModeAES mode, const byte *iv,
+                     int decrypt, FileStatsAES *stats) {
+    FileStatsAES local;
+    FileCrypt crypt;
+    uint64_t start = clockAES();
+    int result = -1;
+
+    if (stats == NULL) {
+        stats = &local;
+    }
+    memset(stats, 0, sizeof(FileStatsAES));
+    if (context == NULL || inputPath == NULL || outputPath == NULL || mode == AES_GCM ||
+        (mode != AES_ECB && iv == NULL)) {
+        return 1;
+    }
+
+    crypt.context = context;
+    crypt.mode = mode;
+    crypt.decrypt = decrypt;
+    memset(crypt.chain, 0, IV_SIZE);
+    if (iv != NULL) {
+        memcpy(crypt.chain, iv, IV_SIZE);
+    }
+
+#ifdef __linux__
+    if (fileUringEnabled) {
+        result = fileUring(&crypt, inputPath, outputPath, stats);
+    }
+#endif // __linux__
+    if (result < 0) {
+        result = fileStdio(&crypt, inputPath, outputPath, stats);
+    }
+
+    stats->time = clockAES() - start;
+    if (stats->time > 0) {
+        stats->megabytesPerSecond = (double) stats->inputSize / 1e6 / ((double) stats->time / 1e9);
+    }
+    return result;
+}
+
+
+int encryptFileAES(const ContextAES *context, lpcstr inputPath, lpcstr outputPath, ModeAES mode, const byte *iv,
+                   FileStatsAES *stats) {
+    return fileCrypt(context, inputPath, outputPath, mode, iv, 0, stats);
+}
+
+
+int decryptFileAES(const ContextAES *context, lpcstr inputPath, lpcstr outputPath, ModeAES mode, const byte *iv,
+                   FileStatsAES *stats) {
+    return fileCrypt(context, inputPath, outputPath, mode, iv, 1, stats);
+}
+
+
+void setFileUringAES(int enabled) {
+    fileUringEnabled = enabled != 0;
+}
@@ -0,0 +1,515 @@
+/*
+ * AES crypter
+ *
+ * GCM mode: CTR encryption and the GHASH authentication over the AAD and the ciphertext, in one pass over the data.
+ *
+ * GHASH multiplies by the hash key H = E(K, 0^128) in GF(2^128). Without PCLMULQDQ it runs on the 4-bit tables
+ * (multiples of H by each 4-bit number), they are built once in initContextAES. With AES-NI and PCLMULQDQ
+ * the counter blocks and GHASH are stitched: eight counter blocks go through the AES rounds while the carry-less
+ * products of eight ciphertext blocks are accumulated, and the sum of the products is reduced once (with the powers
+ * H^1 ... H^8).
+ */
+#include <string.h>
+
+#include "engineAES.h"
+
+#ifdef _HARDWARE_AES
+
+#include <wmmintrin.h>
+#include <emmintrin.h>
+#include <tmmintrin.h>
+
+#ifdef _MSC_VER
+#define TARGET_GCM
+#else // _MSC_VER
+#define TARGET_GCM __attribute__((target("aes,pclmul,ssse3")))
+#endif // _MSC_VER
+
+#endif // _HARDWARE_AES
+
+// the number of blocks that the stitched loop and the aggregated reduction take at once
+#define GCM_BLOCKS 8
+
+// the number of counter blocks that the portable path passes to the engine at once
+#define GCM_CHUNK 32
+
+// reduction of the four bits that are shifted out of the 4-bit tables
+static const uint64_t last4[16] = {
+        0x0000, 0x1c20, 0x3840, 0x2460, 0x7080, 0x6ca0, 0x48c0, 0x54e0,
+        0xe100, 0xfd20, 0xd940, 0xc560, 0x9180, 0x8da0, 0xa9c0, 0xb5e0
+};
+
+
+static uint64_t gcmLoad64(const byte *data) {
+    uint64_t value = 0;
+
+    for (int i = 0; i < 8; ++i) {
+        value = (value << 8) | data[i];
+    }
+    return value;
+}
+
+
+static void gcmStore64(byte *data, uint64_t value) {
+    for (int i = 7; i >= 0; --i) {
+        data[i] = (byte) value;
+        value >>= 8;
+    }
+}
+
+
+/**
+ * Adds one to the last 32 bits of the counter block (inc32 of the specification).
+ */
+static void gcmIncrement(byte *counter) {
+    for (int i = AES_BLOCK_SIZE - 1; i >= AES_BLOCK_SIZE - 4; --i) {
+        if (++counter[i] != 0) {
+            break;
+        }
+    }
+}
+
+
+/**
+ * Multiplies x by H with the 4-bit tables: table[i] and table[16 + i] are the low and high halves of i * H.
+ */
+static void gcmMultiplyTable(const uint64_t *table, byte *x) {
+    const uint64_t *low = table, *high = table + 16;
+    int lo = x[15] & 0x0F, hi;
+    uint64_t zl = low[lo], zh = high[lo];
+    byte rem;
+
+    for (int i = 15; i >= 0; --i) {
+        lo = x[i] & 0x0F;
+        hi = x[i] >> 4;
+
+        if (i != 15) {
+            rem = (byte) (zl & 0x0F);
+            zl = (zh << 60) | (zl >> 4);
+            zh = (zh >> 4) ^ (last4[rem] << 48);
+            zh ^= high[lo];
+            zl ^= low[lo];
+        }
+        rem = (byte) (zl & 0x0F);
+        zl = (zh << 60) | (zl >> 4);
+        zh = (zh >> 4) ^ (last4[rem] << 48);
+        zh ^= high[hi];
+        zl ^= low[hi];
+    }
+
+    gcmStore64(x, zh);
+    gcmStore64(x + 8, zl);
+}
+
+
+/**
+ * GHASH of whole blocks on the 4-bit tables.
+ */
+static void gcmHashTable(const ContextAES *context, byte *hash, const byte *data, size_t blockCount) {
+    for (size_t block = 0; block < blockCount; ++block) {
+        for (int i = 0; i < AES_BLOCK_SIZE; ++i) {
+            hash[i] ^= data[block * AES_BLOCK_SIZE + i];
+        }
+        gcmMultiplyTable(context->ghashTable, hash);
+    }
+}
+
+
+void initGhashAES(ContextAES *context) {
+    uint64_t *low = context->ghashTable, *high = context->ghashTable + 16;
+    byte h[AES_BLOCK_SIZE] = {0};
+    uint64_t vh, vl;
+
+    dispatchAES()->serial->encryptBlocks((const byte *) context->roundKey, context->rounds, h, 1);
+
+    // table[8] is H, table[4], table[2] and table[1] are H multiplied by x, x^2 and x^3
+    vh = gcmLoad64(h);
+    vl = gcmLoad64(h + 8);
+    low[8] = vl;
+    high[8] = vh;
+    low[0] = 0;
+    high[0] = 0;
+    for (int i = 4; i > 0; i >>= 1) {
+        uint64_t reduce = (vl & 1) * 0xe100000000000000ULL;
+
+        vl = (vh << 63) | (vl >> 1);
+        vh = (vh >> 1) ^ reduce;
+        low[i] = vl;
+        high[i] = vh;
+    }
+    // the other entries are the sums of these four
+    for (int i = 2; i <= 8; i *= 2) {
+        for (int j = 1; j < i; ++j) {
+            high[i + j] = high[i] ^ high[j];
+            low[i + j] = low[i] ^ low[j];
+        }
+    }
+
+    // the powers of H for the aggregated reduction: ghashKey[i] = H^(i + 1)
+    memcpy(context->ghashKey, h, AES_BLOCK_SIZE);
+    for (int i = 1; i < GCM_BLOCKS; ++i) {
+        memcpy(context->ghashKey + i * AES_BLOCK_SIZE, context->ghashKey + (i - 1) * AES_BLOCK_SIZE, AES_BLOCK_SIZE);
+        gcmMultiplyTable(context->ghashTable, context->ghashKey + i * AES_BLOCK_SIZE);
+    }
+}
+
+
+#ifdef _HARDWARE_AES
+/**
+ * The blocks of GCM are multiplied with the reversed order of the bytes, so that the bits of each 64-bit
+ * half go from the low to the high one.
+ */
+TARGET_GCM
+static inline __m128i gcmSwap(__m128i x) {
+    return _mm_shuffle_epi8(x, _mm_set_epi8(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15));
+}
+
+
+/**
+ * Adds the 256-bit carry-less product of a and b to low and high.
+ */
+TARGET_GCM
+static inline void gcmClmul(__m128i a, __m128i b, __m128i *low, __m128i *high) {
+    __m128i lo = _mm_clmulepi64_si128(a, b, 0x00);
+    __m128i hi = _mm_clmulepi64_si128(a, b, 0x11);
+    __m128i mid = _mm_xor_si128(_mm_clmulepi64_si128(a, b, 0x10), _mm_clmulepi64_si128(a, b, 0x01));
+
+    *low = _mm_xor_si128(*low, _mm_xor_si128(lo, _mm_slli_si128(mid, 8)));
+    *high = _mm_xor_si128(*high, _mm_xor_si128(hi, _mm_srli_si128(mid, 8)));
+}
+
+
+/**
+ * Reduces the 256-bit product modulo x^128 + x^7 + x^2 + x + 1, the bits of GCM are reflected,
+ * so the product is first shifted left by one bit.
+ */
+TARGET_GCM
+static inline __m128i gcmReduce(__m128i low, __m128i high) {
+    __m128i carryLow = _mm_srli_epi32(low, 31);
+    __m128i carryHigh = _mm_srli_epi32(high, 31);
+    __m128i t, u;
+
+    low = _mm_or_si128(_mm_slli_epi32(low, 1), _mm_slli_si128(carryLow, 4));
+    high = _mm_or_si128(_mm_or_si128(_mm_slli_epi32(high, 1), _mm_slli_si128(carryHigh, 4)),
+                        _mm_srli_si128(carryLow, 12));
+
+    t = _mm_xor_si128(_mm_xor_si128(_mm_slli_epi32(low, 31), _mm_slli_epi32(low, 30)), _mm_slli_epi32(low, 25));
+    u = _mm_srli_si128(t, 4);
+    low = _mm_xor_si128(low, _mm_slli_si128(t, 12));
+
+    t = _mm_xor_si128(_mm_xor_si128(_mm_srli_epi32(low, 1), _mm_srli_epi32(low, 2)), _mm_srli_epi32(low, 7));
+    low = _mm_xor_si128(low, _mm_xor_si128(t, u));
+    return _mm_xor_si128(high, low);
+}
+
+
+/**
+ * GHASH of whole blocks with PCLMULQDQ, GCM_BLOCKS blocks share one reduction.
+ */
+TARGET_GCM
+static __m128i gcmHashClmul(const __m128i *power, __m128i hash, const byte *data, size_t blockCount) {
+    size_t block = 0;
+
+    for (; block + GCM_BLOCKS <= blockCount; block += GCM_BLOCKS) {
+        __m128i low = _mm_setzero_si128(), high = _mm_setzero_si128();
+
+        for (int j = 0; j < GCM_BLOCKS; ++j) {
+            __m128i x = gcmSwap(_mm_loadu_si128((const __m128i *) (data + (block + j) * AES_BLOCK_SIZE)));
+
+            if (j == 0) {
+                x = _mm_xor_si128(x, hash);
+            }
+            gcmClmul(x, power[GCM_BLOCKS - 1 - j], &low, &high);
+        }
+        hash = gcmReduce(low, high);
+    }
+
+    for (; block < blockCount; ++block) {
+        __m128i low = _mm_setzero_si128(), high = _mm_setzero_si128();
+        __m128i x = gcmSwap(_mm_loadu_si128((const __m128i *) (data + block * AES_BLOCK_SIZE)));
+
+        gcmClmul(_mm_xor_si128(x, hash), power[0], &low, &high);
+        hash = gcmReduce(low, high);
+    }
+    return hash;
+}
+
+
+TARGET_GCM
+static void gcmLoadPowers(const ContextAES *context, __m128i *power) {
+    for (int i = 0; i < GCM_BLOCKS; ++i) {
+        power[i] = gcmSwap(_mm_loadu_si128((const __m128i *) (context->ghashKey + i * AES_BLOCK_SIZE)));
+    }
+}
+
+
+TARGET_GCM
+static void gcmHashHardware(const ContextAES *context, byte *hash, const byte *data, size_t blockCount) {
+    __m128i power[GCM_BLOCKS];
+    __m128i x = gcmSwap(_mm_loadu_si128((const __m128i *) hash));
+
+    gcmLoadPowers(context, power);
+    x = gcmHashClmul(power, x, data, blockCount);
+    _mm_storeu_si128((__m128i *) hash, gcmSwap(x));
+}
+
+
+// one round of the GCM_BLOCKS counter blocks, written out so that the blocks stay in registers
+#define GCM_ENCRYPT_GROUP(round)                            \
+        ctr[0] = _mm_aesenc_si128(ctr[0], key[round]);      \
+        ctr[1] = _mm_aesenc_si128(ctr[1], key[round]);      \
+        ctr[2] = _mm_aesenc_si128(ctr[2], key[round]);      \
+        ctr[3] = _mm_aesenc_si128(ctr[3], key[round]);      \
+        ctr[4] = _mm_aesenc_si128(ctr[4], key[round]);      \
+        ctr[5] = _mm_aesenc_si128(ctr[5], key[round]);      \
+        ctr[6] = _mm_aesenc_si128(ctr[6], key[round]);      \
+        ctr[7] = _mm_aesenc_si128(ctr[7], key[round]);
+
+/**
+ * CTR encryption and GHASH of whole groups of GCM_BLOCKS blocks, stitched: while the counter blocks of a group go
+ * through the rounds, the products of the ciphertext of the group are accumulated (for encryption the ciphertext of
+ * the previous group). Returns the number of blocks that were processed.
+ */
+TARGET_GCM
+static size_t gcmCryptHardware(const ContextAES *context, GcmStateAES *state, byte *data, size_t blockCount,
+                               int decrypt) {
+    const int rounds = context->rounds;
+    const __m128i one = _mm_set_epi32(0, 0, 0, 1);
+    __m128i key[ROUND_AES_256 + 1];
+    __m128i power[GCM_BLOCKS];
+    // the counter with the reversed bytes: its last 32 bits are the low lane, _mm_add_epi32 does inc32
+    __m128i counter = gcmSwap(_mm_loadu_si128((const __m128i *) state->counter));
+    __m128i hash = gcmSwap(_mm_loadu_si128((const __m128i *) state->hash));
+    size_t block = 0;
+    // the ciphertext group that is hashed during the next group, for encryption
+    byte *pending = NULL;
+
+    for (int i = 0; i <= rounds; ++i) {
+        key[i] = _mm_loadu_si128((const __m128i *) (context->roundKey + i * 4));
+    }
+    gcmLoadPowers(context, power);
+
+    for (; block + GCM_BLOCKS <= blockCount; block += GCM_BLOCKS) {
+        __m128i *ptr = (__m128i *) (data + block * AES_BLOCK_SIZE);
+        const byte *hashed = decrypt ? (const byte *) ptr : pending;
+        __m128i low = _mm_setzero_si128(), high = _mm_setzero_si128();
+        __m128i ctr[GCM_BLOCKS];
+
+        for (int j = 0; j < GCM_BLOCKS; ++j) {
+            ctr[j] = _mm_xor_si128(gcmSwap(counter), key[0]);
+            counter = _mm_add_epi32(counter, one);
+        }
+        // one product of GHASH in each of the first rounds
+        for (int round = 1; round <= GCM_BLOCKS; ++round) {
+            GCM_ENCRYPT_GROUP(round)
+            if (hashed != NULL) {
+                __m128i x = gcmSwap(_mm_loadu_si128((const __m128i *) (hashed + (round - 1) * AES_BLOCK_SIZE)));
+
+                if (round == 1) {
+                    x = _mm_xor_si128(x, hash);
+                }
+                gcmClmul(x, power[GCM_BLOCKS - round], &low, &high);
+            }
+        }
+        for (int round = GCM_BLOCKS + 1; round < rounds; ++round) {
+            GCM_ENCRYPT_GROUP(round)
+        }
+        if (hashed != NULL) {
+            hash = gcmReduce(low, high);
+        }
+        for (int j = 0; j < GCM_BLOCKS; ++j) {
+            __m128i stream = _mm_aesenclast_si128(ctr[j], key[rounds]);
+
+            _mm_storeu_si128(ptr + j, _mm_xor_si128(_mm_loadu_si128(ptr + j), stream));
+        }
+        pending = (byte *) ptr;
+    }
+
+    // the last group of encryption is hashed after the loop
+    if (!decrypt && pending != NULL) {
+        hash = gcmHashClmul(power, hash, pending, GCM_BLOCKS);
+    }
+
+    _mm_storeu_si128((__m128i *) state->counter, gcmSwap(counter));
+    _mm_storeu_si128((__m128i *) state->hash, gcmSwap(hash));
+    return block;
+}
+#endif // _HARDWARE_AES
+
+
+/**
+ * Returns 1 if the stitched path can be used: the bound engine runs on AES-NI and the processor has PCLMULQDQ.
+ * A forced software engine keeps all of GCM in portable code.
+ */
+static int gcmHardware(void) {
+#ifdef _HARDWARE_AES
+    const DispatchAES *dispatch = dispatchAES();
+
+    return (dispatch->parallel->features & FEATURE_AESNI) &&
+           (dispatch->features & (FEATURE_PCLMULQDQ | FEATURE_SSSE3)) == (FEATURE_PCLMULQDQ | FEATURE_SSSE3);
+#else // _HARDWARE_AES
+    return 0;
+#endif // _HARDWARE_AES
+}
+
+
+static void gcmHash(const ContextAES *context, byte *hash, const byte *data, size_t blockCount, int hardware) {
+#ifdef _HARDWARE_AES
+    if (hardware) {
+        gcmHashHardware(context, hash, data, blockCount);
+        return;
+    }
+#endif // _HARDWARE_AES
+    gcmHashTable(context, hash, data, blockCount);
+}
+
+
+/**
+ * GHASH of data of any size, the last partial block is completed with zeros.
+ */
+static void gcmHashData(const ContextAES *context, byte *hash, const byte *data, size_t dataSize, int hardware) {
+    size_t whole = dataSize / AES_BLOCK_SIZE;
+
+    gcmHash(context, hash, data, whole, hardware);
+    if (dataSize % AES_BLOCK_SIZE != 0) {
+        byte last[AES_BLOCK_SIZE] = {0};
+
+        memcpy(last, data + whole * AES_BLOCK_SIZE, dataSize % AES_BLOCK_SIZE);
+        gcmHash(context, hash, last, 1, hardware);
+    }
+}
+
+
+/**
+ * Encrypts or decrypts the data with the counter blocks from state->counter and adds the ciphertext to GHASH.
+ * Every part except the last must be a multiple of 16 bytes.
+ */
+static void gcmCrypt(const ContextAES *context, GcmStateAES *state, byte *data, size_t dataSize, int decrypt,
+                     int hardware) {
+    const EngineAES *engine = dispatchAES()->parallel;
+    byte stream[GCM_CHUNK * AES_BLOCK_SIZE];
+    size_t done = 0;
+
+#ifdef _HARDWARE_AES
+    if (hardware) {
+        done = gcmCryptHardware(context, state, data, dataSize / AES_BLOCK_SIZE, decrypt) * AES_BLOCK_SIZE;
+    }
+#endif // _HARDWARE_AES
+
+    for (; done < dataSize; done += sizeof(stream)) {
+        size_t size = dataSize - done < sizeof(stream) ? dataSize - done : sizeof(stream);
+        size_t blockCount = (size + AES_BLOCK_SIZE - 1) / AES_BLOCK_SIZE;
+
+        if (decrypt) {
+            gcmHashData(context, state->hash, data + done, size, hardware);
+        }
+        for (size_t block = 0; block < blockCount; ++block) {
+            memcpy(stream + block * AES_BLOCK_SIZE, state->counter, AES_BLOCK_SIZE);
+            gcmIncrement(state->counter);
+        }
+        engine->encryptBlocks((const byte *) context->roundKey, context->rounds, stream, blockCount);
+        for (size_t i = 0; i < size; ++i) {
+            data[done + i] ^= stream[i];
+        }
+        if (!decrypt) {
+            gcmHashData(context, state->hash, data + done, size, hardware);
+        }
+    }
+}
+
+
+/**
+ * Computes the tag: GHASH of the lengths in bits, encrypted with the counter block J0.
+ */
+static void gcmTag(const ContextAES *context, GcmStateAES *state, uint64_t aadSize, uint64_t dataSize, byte *tag,
+                   int hardware) {
+    byte lengths[AES_BLOCK_SIZE];
+
+    gcmStore64(lengths, aadSize * 8);
+    gcmStore64(lengths + 8, dataSize * 8);
+    gcmHash(context, state->hash, lengths, 1, hardware);
+
+    memcpy(tag, state->j0, AES_BLOCK_SIZE);
+    dispatchAES()->serial->encryptBlocks((const byte *) context->roundKey, context->rounds, tag, 1);
+    for (int i = 0; i < AES_BLOCK_SIZE; ++i) {
+        tag[i] ^= state->hash[i];
+    }
+}
+
+
+static void gcmStart(const ContextAES *context, GcmStateAES *state, const byte *iv, const byte *aad, size_t aadSize,
+                     int hardware) {
+    // J0 = IV || 0^31 || 1 for the IV of 96 bits
+    memcpy(state->j0, iv, GCM_IV_SIZE);
+    memset(state->j0 + GCM_IV_SIZE, 0, AES_BLOCK_SIZE - GCM_IV_SIZE);
+    state->j0[AES_BLOCK_SIZE - 1] = 1;
+    memcpy(state->counter, state->j0, AES_BLOCK_SIZE);
+    gcmIncrement(state->counter);
+    memset(state->hash, 0, AES_BLOCK_SIZE);
+
+    if (aad != NULL) {
+        gcmHashData(context, state->hash, aad, aadSize, hardware);
+    }
+}
+
+
+int encryptGcmAES(const ContextAES *context, const byte *iv, const byte *aad, size_t aadSize,
+                  byte *data, size_t dataSize, byte *tag, size_t tagSize) {
+    int hardware = gcmHardware();
+    byte fullTag[AES_BLOCK_SIZE];
+    GcmStateAES state;
+
+    if (iv == NULL || tag == NULL || tagSize < GCM_MIN_TAG_SIZE || tagSize > GCM_TAG_SIZE) {
+        return 1;
+    }
+
+    gcmStart(context, &state, iv, aad, aadSize, hardware);
+    gcmCrypt(context, &state, data, dataSize, 0, hardware);
+    gcmTag(context, &state, aadSize, dataSize, fullTag, hardware);
+
+    memcpy(tag, fullTag, tagSize);
+    return 0;
+}
+
+
+int decryptGcmAES(const ContextAES *context, const byte *iv, const byte *aad, size_t aadSize,
+                  byte *data, size_t dataSize, const byte *tag, size_t tagSize) {
+    int hardware = gcmHardware();
+    byte fullTag[AES_BLOCK_SIZE];
+    byte diff = 0;
+    GcmStateAES state;
+
+    if (iv == NULL || tag == NULL || tagSize < GCM_MIN_TAG_SIZE || tagSize > GCM_TAG_SIZE) {
+        return 1;
+    }
+
+    gcmStart(context, &state, iv, aad, aadSize, hardware);
+    gcmCrypt(context, &state, data, dataSize, 1, hardware);
+    gcmTag(context, &state, aadSize, dataSize, fullTag, hardware);
+
+    // the comparison takes the same time wherever the tags differ
+    for (size_t i = 0; i < tagSize; ++i) {
+        diff |= fullTag[i] ^ tag[i];
+    }
+    if (diff != 0) {
+        // the data that is not authentic is not returned
+        memset(data, 0, dataSize);
+        return 1;
+    }
+    return 0;
+}
+
+
+void startGcmAES(const ContextAES *context, GcmStateAES *state, const byte *iv) {
+    gcmStart(context, state, iv, NULL, 0, gcmHardware());
+}
+
+
+void cryptGcmAES(const ContextAES *context, GcmStateAES *state, byte *data, size_t dataSize, int decrypt) {
+    gcmCrypt(context, state, data, dataSize, decrypt, gcmHardware());
+}
+
+
+void tagGcmAES(const ContextAES *context, GcmStateAES *state, uint64_t dataSize, byte *tag) {
+    gcmTag(context, state, 0, dataSize, tag, gcmHardware());
+}
@@ -0,0 +1,185 @@
+/*
+ * AES crypter
+ *
+ * Engine on the AES-NI instructions (AESENC, AESENCLAST, AESDEC, AESDECLAST).
+ *
+ * Round keys are taken from keyExpansion, so all three versions of AES are supported.
+ * Several blocks are processed at once so that the latency of the instructions is hidden.
+ */
+#include "engineAES.h"
+
+#ifdef _HARDWARE_AES
+
+#include <wmmintrin.h>
+#include <emmintrin.h>
+
+#ifdef _MSC_VER
+#define TARGET_AES
+#else // _MSC_VER
+#define TARGET_AES __attribute__((target("aes,sse2")))
+#endif // _MSC_VER
+
+// the number of blocks processed at once
+#define HARDWARE_BLOCKS 8
+
+// one middle round on the group of blocks and on the single block, expanded for each round by ROUNDS_AES_*
+#define HARDWARE_ENCRYPT_GROUP(round)                       \
+        state[0] = _mm_aesenc_si128(state[0], key[round]);  \
+        state[1] = _mm_aesenc_si128(state[1], key[round]);  \
+        state[2] = _mm_aesenc_si128(state[2], key[round]);  \
+        state[3] = _mm_aesenc_si128(state[3], key[round]);  \
+        state[4] = _mm_aesenc_si128(state[4], key[round]);  \
+        state[5] = _mm_aesenc_si128(state[5], key[round]);  \
+        state[6] = _mm_aesenc_si128(state[6], key[round]);  \
+        state[7] = _mm_aesenc_si128(state[7], key[round]);
+#define HARDWARE_ENCRYPT_ONE(round) state = _mm_aesenc_si128(state, key[round]);
+#define HARDWARE_DECRYPT_GROUP(round)                       \
+        state[0] = _mm_aesdec_si128(state[0], key[round]);  \
+        state[1] = _mm_aesdec_si128(state[1], key[round]);  \
+        state[2] = _mm_aesdec_si128(state[2], key[round]);  \
+        state[3] = _mm_aesdec_si128(state[3], key[round]);  \
+        state[4] = _mm_aesdec_si128(state[4], key[round]);  \
+        state[5] = _mm_aesdec_si128(state[5], key[round]);  \
+        state[6] = _mm_aesdec_si128(state[6], key[round]);  \
+        state[7] = _mm_aesdec_si128(state[7], key[round]);
+#define HARDWARE_DECRYPT_ONE(round) state = _mm_aesdec_si128(state, key[round]);
+
+/*
+ * Generates the function for one number of rounds, all rounds are unrolled so the round keys stay in registers.
+ * AESDEC works like AESENC with the round keys of the equivalent inverse cipher, so both directions have one shape.
+ */
+#define HARDWARE_SPECIALIZE(name, rounds, ROUNDS, GROUP, ONE, last)                     \
+TARGET_AES                                                                              \
+static void name(const byte *roundKey, byte *data, size_t blockCount) {                 \
+    __m128i key[rounds + 1];                                                            \
+    size_t block = 0;                                                                   \
+                                                                                        \
+    for (int i = 0; i <= rounds; ++i) {                                                 \
+        key[i] = _mm_loadu_si128((const __m128i *) (roundKey + i * AES_BLOCK_SIZE));    \
+    }                                                                                   \
+                                                                                        \
+    for (; block + HARDWARE_BLOCKS <= blockCount; block += HARDWARE_BLOCKS) {           \
+        __m128i *ptr = (__m128i *) (data + block * AES_BLOCK_SIZE);                     \
+        __m128i state[HARDWARE_BLOCKS];                                                 \
+                                                                                        \
+        for (int j = 0; j < HARDWARE_BLOCKS; ++j) {                                     \
+            state[j] = _mm_xor_si128(_mm_loadu_si128(ptr + j), key[0]);                 \
+        }                                                                               \
+        ROUNDS(GROUP)                                                                   \
+        for (int j = 0; j < HARDWARE_BLOCKS; ++j) {                                     \
+            _mm_storeu_si128(ptr + j, last(state[j], key[rounds]));                     \
+        }                                                                               \
+    }                                                                                   \
+                                                                                        \
+    for (; block < blockCount; ++block) {                                               \
+        __m128i *ptr = (__m128i *) (data + block * AES_BLOCK_SIZE);                     \
+        __m128i state = _mm_xor_si128(_mm_loadu_si128(ptr), key[0]);                    \
+                                                                                        \
+        ROUNDS(ONE)                                                                     \
+        _mm_storeu_si128(ptr, last(state, key[rounds]));                                \
+    }                                                                                   \
+}
+
+HARDWARE_SPECIALIZE(hardwareEncrypt128, ROUND_AES_128, ROUNDS_AES_128, HARDWARE_ENCRYPT_GROUP, HARDWARE_ENCRYPT_ONE,
+                    _mm_aesenclast_si128)
+HARDWARE_SPECIALIZE(hardwareEncrypt192, ROUND_AES_192, ROUNDS_AES_192, HARDWARE_ENCRYPT_GROUP, HARDWARE_ENCRYPT_ONE,
+                    _mm_aesenclast_si128)
+HARDWARE_SPECIALIZE(hardwareEncrypt256, ROUND_AES_256, ROUNDS_AES_256, HARDWARE_ENCRYPT_GROUP, HARDWARE_ENCRYPT_ONE,
+                    _mm_aesenclast_si128)
+HARDWARE_SPECIALIZE(hardwareDecrypt128, ROUND_AES_128, ROUNDS_AES_128, HARDWARE_DECRYPT_GROUP, HARDWARE_DECRYPT_ONE,
+                    _mm_aesdeclast_si128)
+HARDWARE_SPECIALIZE(hardwareDecrypt192, ROUND_AES_192, ROUNDS_AES_192, HARDWARE_DECRYPT_GROUP, HARDWARE_DECRYPT_ONE,
+                    _mm_aesdeclast_si128)
+HARDWARE_SPECIALIZE(hardwareDecrypt256, ROUND_AES_256, ROUNDS_AES_256, HARDWARE_DECRYPT_GROUP, HARDWARE_DECRYPT_ONE,
+                    _mm_aesdeclast_si128)
+
+DISPATCH_ROUNDS(hardwareEncryptBlocks, hardwareEncrypt)
+DISPATCH_ROUNDS(hardwareDecryptBlocks, hardwareDecrypt)
+
+
+// one middle round on a full group of lanes, each lane takes the round key from its own schedule
+#define HARDWARE_LANE_KEY(j, round) _mm_loadu_si128((const __m128i *) (key[j] + (round) * AES_BLOCK_SIZE))
+#define HARDWARE_LANES_GROUP(round)                                         \
+        state[0] = _mm_aesenc_si128(state[0], HARDWARE_LANE_KEY(0, round)); \
+        state[1] = _mm_aesenc_si128(state[1], HARDWARE_LANE_KEY(1, round)); \
+        state[2] = _mm_aesenc_si128(state[2], HARDWARE_LANE_KEY(2, round)); \
+        state[3] = _mm_aesenc_si128(state[3], HARDWARE_LANE_KEY(3, round)); \
+        state[4] = _mm_aesenc_si128(state[4], HARDWARE_LANE_KEY(4, round)); \
+        state[5] = _mm_aesenc_si128(state[5], HARDWARE_LANE_KEY(5, round)); \
+        state[6] = _mm_aesenc_si128(state[6], HARDWARE_LANE_KEY(6, round)); \
+        state[7] = _mm_aesenc_si128(state[7], HARDWARE_LANE_KEY(7, round));
+
+/*
+ * Generates the function that encrypts the blocks of the lanes for one number of rounds. The lanes go in groups
+ * of HARDWARE_BLOCKS with all rounds unrolled, each AESENC takes the round key of its lane from memory.
+ * The lanes that are left are processed together round by round.
+ */
+#define HARDWARE_LANES_SPECIALIZE(name, rounds, ROUNDS)                                                         \
+TARGET_AES                                                                                                      \
+static void name(const byte *const *roundKey, byte *const *block, size_t laneCount) {                          \
+    size_t lane = 0;                                                                                            \
+                                                                                                                \
+    for (; lane + HARDWARE_BLOCKS <= laneCount; lane += HARDWARE_BLOCKS) {                                      \
+        const byte *const *key = roundKey + lane;                                                               \
+        __m128i state[HARDWARE_BLOCKS];                                                                         \
+                                                                                                                \
+        for (int j = 0; j < HARDWARE_BLOCKS; ++j) {                                                             \
+            state[j] = _mm_xor_si128(_mm_loadu_si128((const __m128i *) block[lane + j]), HARDWARE_LANE_KEY(j, 0)); \
+        }                                                                                                       \
+        ROUNDS(HARDWARE_LANES_GROUP)                                                                            \
+        for (int j = 0; j < HARDWARE_BLOCKS; ++j) {                                                             \
+            _mm_storeu_si128((__m128i *) block[lane + j],                                                       \
+                             _mm_aesenclast_si128(state[j], HARDWARE_LANE_KEY(j, rounds)));                     \
+        }                                                                                                       \
+    }                                                                                                           \
+                                                                                                                \
+    if (lane < laneCount) {                                                                                     \
+        size_t count = laneCount - lane;                                                                        \
+        const byte *const *key = roundKey + lane;                                                               \
+        __m128i state[HARDWARE_BLOCKS];                                                                         \
+                                                                                                                \
+        for (size_t j = 0; j < count; ++j) {                                                                    \
+            state[j] = _mm_xor_si128(_mm_loadu_si128((const __m128i *) block[lane + j]), HARDWARE_LANE_KEY(j, 0)); \
+        }                                                                                                       \
+        for (int round = 1; round < rounds; ++round) {                                                          \
+            for (size_t j = 0; j < count; ++j) {                                                                \
+                state[j] = _mm_aesenc_si128(state[j], HARDWARE_LANE_KEY(j, round));                             \
+            }                                                                                                   \
+        }                                                                                                       \
+        for (size_t j = 0; j < count; ++j) {                                                                    \
+            _mm_storeu_si128((__m128i *) block[lane + j],                                                       \
+                             _mm_aesenclast_si128(state[j], HARDWARE_LANE_KEY(j, rounds)));                     \
+        }                                                                                                       \
+    }                                                                                                           \
+}
+
+HARDWARE_LANES_SPECIALIZE(hardwareLanes128, ROUND_AES_128, ROUNDS_AES_128)
+HARDWARE_LANES_SPECIALIZE(hardwareLanes192, ROUND_AES_192, ROUNDS_AES_192)
+HARDWARE_LANES_SPECIALIZE(hardwareLanes256, ROUND_AES_256, ROUNDS_AES_256)
+
+
+static void hardwareEncryptLanes(const byte *const *roundKey, int rounds, byte *const *block, size_t laneCount) {
+    switch (rounds) {
+        case ROUND_AES_128:
+            hardwareLanes128(roundKey, block, laneCount);
+            break;
+        case ROUND_AES_192:
+            hardwareLanes192(roundKey, block, laneCount);
+            break;
+        default:
+            hardwareLanes256(roundKey, block, laneCount);
+            break;
+    }
+}
+
+
+const EngineAES hardwareEngineAES = {
+        "aes-ni",
+        FEATURE_AESNI,
+        NULL,
+        hardwareEncryptBlocks,
+        hardwareDecryptBlocks,
+        hardwareEncryptLanes
+};
+
+#endif // _HARDWARE_AES
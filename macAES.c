@@ -0,0 +1,211 @@
+/*
+ * AES crypter
+ *
+ * Message authentication codes: CMAC (RFC 4493) and PMAC.
+ *
+ * Both are built on L = E(K, 0^128) multiplied by powers of x in GF(2^128), these subkeys are prepared once
+ * in the context (initMacAES). CMAC chains the blocks, so each block waits for the previous one; many short
+ * messages under one key are interleaved instead (cmacBatchContextAES), one block of each message per engine call.
+ * In PMAC every block is masked with its own offset and encrypted independently, so the blocks of one message
+ * go through the parallel engine at once.
+ */
+#include <string.h>
+
+#include "engineAES.h"
+
+// the number of blocks (or messages of the batch) that are passed to the engine at once
+#define MAC_BLOCKS 32
+
+
+/**
+ * Multiplies the block by x, the block is a 128-bit big-endian number.
+ */
+static void macDouble(const byte *value, byte *result) {
+    byte carry = value[0] >> 7;
+
+    for (int i = 0; i < AES_BLOCK_SIZE - 1; ++i) {
+        result[i] = (byte) ((value[i] << 1) | (value[i + 1] >> 7));
+    }
+    result[AES_BLOCK_SIZE - 1] = (byte) ((value[AES_BLOCK_SIZE - 1] << 1) ^ (carry ? 0x87 : 0x00));
+}
+
+
+/**
+ * Multiplies the block by x^-1, the inverse of macDouble.
+ */
+static void macHalve(const byte *value, byte *result) {
+    byte carry = value[AES_BLOCK_SIZE - 1] & 1;
+
+    for (int i = AES_BLOCK_SIZE - 1; i > 0; --i) {
+        result[i] = (byte) ((value[i] >> 1) | (value[i - 1] << 7));
+    }
+    result[0] = value[0] >> 1;
+    if (carry) {
+        result[0] ^= 0x80;
+        result[AES_BLOCK_SIZE - 1] ^= 0x43;
+    }
+}
+
+
+void initMacAES(ContextAES *context) {
+    byte *level = context->macKey;
+
+    memset(level, 0, AES_BLOCK_SIZE);
+    dispatchAES()->serial->encryptBlocks((const byte *) context->roundKey, context->rounds, level, 1);
+    for (int i = 1; i < MAC_LEVELS; ++i) {
+        macDouble(level + (i - 1) * AES_BLOCK_SIZE, level + i * AES_BLOCK_SIZE);
+    }
+    macHalve(level, context->macInverse);
+}
+
+
+/**
+ * The last block of CMAC: a whole block is masked with K1, a partial block is completed with 10...0
+ * and masked with K2.
+ */
+static void cmacLast(const ContextAES *context, const byte *data, size_t size, byte *last) {
+    if (size == AES_BLOCK_SIZE) {
+        memcpy(last, data, AES_BLOCK_SIZE);
+        xorBytesAES(last, context->macKey + AES_BLOCK_SIZE, AES_BLOCK_SIZE);
+    } else {
+        memset(last, 0, AES_BLOCK_SIZE);
+        memcpy(last, data, size);
+        last[size] = 0x80;
+        xorBytesAES(last, context->macKey + 2 * AES_BLOCK_SIZE, AES_BLOCK_SIZE);
+    }
+}
+
+
+void cmacContextAES(const ContextAES *context, const byte *data, size_t dataSize, byte *mac) {
+    const EngineAES *engine = dispatchAES()->serial;
+    size_t blockCount = dataSize == 0 ? 1 : (dataSize + AES_BLOCK_SIZE - 1) / AES_BLOCK_SIZE;
+    byte last[AES_BLOCK_SIZE];
+
+    memset(mac, 0, AES_BLOCK_SIZE);
+    for (size_t block = 0; block + 1 < blockCount; ++block) {
+        xorBytesAES(mac, data + block * AES_BLOCK_SIZE, AES_BLOCK_SIZE);
+        engine->encryptBlocks((const byte *) context->roundKey, context->rounds, mac, 1);
+    }
+
+    cmacLast(context, data + (blockCount - 1) * AES_BLOCK_SIZE, dataSize - (blockCount - 1) * AES_BLOCK_SIZE, last);
+    xorBytesAES(mac, last, AES_BLOCK_SIZE);
+    engine->encryptBlocks((const byte *) context->roundKey, context->rounds, mac, 1);
+}
+
+
+void cmacBatchContextAES(const ContextAES *context, const byte *const *data, const size_t *dataSize, size_t count,
+                         byte *mac) {
+    const EngineAES *engine = dispatchAES()->parallel;
+    byte state[MAC_BLOCKS * AES_BLOCK_SIZE];
+    size_t message[MAC_BLOCKS];
+    size_t block[MAC_BLOCKS];
+    size_t laneCount = 0, next = 0;
+
+    for (;;) {
+        // the free lanes take the next messages
+        for (; laneCount < MAC_BLOCKS && next < count; ++next) {
+            memset(state + laneCount * AES_BLOCK_SIZE, 0, AES_BLOCK_SIZE);
+            message[laneCount] = next;
+            block[laneCount] = 0;
+            ++laneCount;
+        }
+        if (laneCount == 0) {
+            break;
+        }
+
+        for (size_t i = 0; i < laneCount; ++i) {
+            size_t size = dataSize[message[i]];
+            size_t blockCount = size == 0 ? 1 : (size + AES_BLOCK_SIZE - 1) / AES_BLOCK_SIZE;
+            const byte *ptr = data[message[i]] + block[i] * AES_BLOCK_SIZE;
+
+            if (block[i] + 1 < blockCount) {
+                xorBytesAES(state + i * AES_BLOCK_SIZE, ptr, AES_BLOCK_SIZE);
+            } else {
+                byte last[AES_BLOCK_SIZE];
+
+                cmacLast(context, ptr, size - block[i] * AES_BLOCK_SIZE, last);
+                xorBytesAES(state + i * AES_BLOCK_SIZE, last, AES_BLOCK_SIZE);
+            }
+        }
+
+        engine->encryptBlocks((const byte *) context->roundKey, context->rounds, state, laneCount);
+
+        // the finished messages return the code, their lanes are dropped
+        for (size_t i = 0; i < laneCount;) {
+            size_t size = dataSize[message[i]];
+
+            if ((block[i] + 1) * AES_BLOCK_SIZE < size) {
+                ++block[i];
+                ++i;
+                continue;
+            }
+            memcpy(mac + message[i] * AES_BLOCK_SIZE, state + i * AES_BLOCK_SIZE, AES_BLOCK_SIZE);
+            --laneCount;
+            memcpy(state + i * AES_BLOCK_SIZE, state + laneCount * AES_BLOCK_SIZE, AES_BLOCK_SIZE);
+            message[i] = message[laneCount];
+            block[i] = block[laneCount];
+        }
+    }
+}
+
+
+/**
+ * Adds L * x^level to the offset, the levels above MAC_LEVELS are doubled from the last prepared one.
+ */
+static void pmacOffset(const ContextAES *context, byte *offset, int level) {
+    if (level < MAC_LEVELS) {
+        xorBytesAES(offset, context->macKey + level * AES_BLOCK_SIZE, AES_BLOCK_SIZE);
+    } else {
+        byte value[AES_BLOCK_SIZE];
+
+        memcpy(value, context->macKey + (MAC_LEVELS - 1) * AES_BLOCK_SIZE, AES_BLOCK_SIZE);
+        for (int i = MAC_LEVELS - 1; i < level; ++i) {
+            macDouble(value, value);
+        }
+        xorBytesAES(offset, value, AES_BLOCK_SIZE);
+    }
+}
+
+
+void pmacContextAES(const ContextAES *context, const byte *data, size_t dataSize, byte *mac) {
+    const EngineAES *engine = dispatchAES()->parallel;
+    size_t blockCount = dataSize == 0 ? 1 : (dataSize + AES_BLOCK_SIZE - 1) / AES_BLOCK_SIZE;
+    size_t lastSize = dataSize - (blockCount - 1) * AES_BLOCK_SIZE;
+    byte buffer[MAC_BLOCKS * AES_BLOCK_SIZE];
+    byte offset[AES_BLOCK_SIZE] = {0};
+    byte sum[AES_BLOCK_SIZE] = {0};
+
+    // all blocks except the last one are masked with their offsets and encrypted independently
+    for (size_t block = 0; block + 1 < blockCount; block += MAC_BLOCKS) {
+        size_t count = blockCount - 1 - block < MAC_BLOCKS ? blockCount - 1 - block : MAC_BLOCKS;
+
+        for (size_t j = 0; j < count; ++j) {
+            // the offset of block i is the offset of block i - 1 plus L * x^ntz(i), i counts from 1
+            size_t index = block + j + 1;
+            int level = 0;
+
+            for (; (index & 1) == 0; index >>= 1) {
+                ++level;
+            }
+            pmacOffset(context, offset, level);
+            memcpy(buffer + j * AES_BLOCK_SIZE, data + (block + j) * AES_BLOCK_SIZE, AES_BLOCK_SIZE);
+            xorBytesAES(buffer + j * AES_BLOCK_SIZE, offset, AES_BLOCK_SIZE);
+        }
+
+        engine->encryptBlocks((const byte *) context->roundKey, context->rounds, buffer, count);
+        for (size_t j = 0; j < count; ++j) {
+            xorBytesAES(sum, buffer + j * AES_BLOCK_SIZE, AES_BLOCK_SIZE);
+        }
+    }
+
+    // the last block is added without encryption: a whole block with L * x^-1, a partial one with 10...0
+    xorBytesAES(sum, data + (blockCount - 1) * AES_BLOCK_SIZE, lastSize);
+    if (lastSize == AES_BLOCK_SIZE) {
+        xorBytesAES(sum, context->macInverse, AES_BLOCK_SIZE);
+    } else {
+        sum[lastSize] ^= 0x80;
+    }
+
+    memcpy(mac, sum, AES_BLOCK_SIZE);
+    dispatchAES()->serial->encryptBlocks((const byte *) context->roundKey, context->rounds, mac, 1);
+}
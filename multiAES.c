@@ -0,0 +1,94 @@
+/*
+ * AES crypter
+ *
+ * Multi-buffer CBC encryption of independent streams.
+ *
+ * A block of CBC encryption depends on the previous ciphertext block, so one stream keeps only one block
+ * in the AES pipeline. Here each lane takes one stream (job), and each step encrypts the next block
+ * of every lane at once with the round keys of its own context. When a job is finished its lane
+ * takes the next job, and the lanes are dropped when there are no more jobs.
+ */
+#include <string.h>
+
+#include "engineAES.h"
+
+// the number of streams that are encrypted at once
+#define MULTI_LANES 8
+
+
+/**
+ * Encrypts the jobs with the given number of rounds, the lanes of one engine call need the same number of rounds.
+ */
+static void multiEncryptCBC(JobAES *jobs, size_t jobCount, int rounds) {
+    const EngineAES *engine = dispatchAES()->serial;
+    JobAES *lane[MULTI_LANES];
+    size_t position[MULTI_LANES];
+    const byte *roundKey[MULTI_LANES];
+    byte *block[MULTI_LANES];
+    size_t laneCount = 0, next = 0;
+
+    for (;;) {
+        // the free lanes take the next jobs
+        for (; laneCount < MULTI_LANES && next < jobCount; ++next) {
+            if (jobs[next].context->rounds == rounds && jobs[next].dataSize > 0) {
+                lane[laneCount] = &jobs[next];
+                position[laneCount] = 0;
+                ++laneCount;
+            }
+        }
+        if (laneCount == 0) {
+            break;
+        }
+
+        for (size_t i = 0; i < laneCount; ++i) {
+            byte *ptr = lane[i]->data + position[i];
+
+            // using the previous block of initialization vector
+            xorBytesAES(ptr, position[i] > 0 ? ptr - AES_BLOCK_SIZE : lane[i]->iv, AES_BLOCK_SIZE);
+            block[i] = ptr;
+            roundKey[i] = (const byte *) lane[i]->context->roundKey;
+        }
+
+        if (engine->encryptLanes != NULL) {
+            engine->encryptLanes(roundKey, rounds, block, laneCount);
+        } else {
+            for (size_t i = 0; i < laneCount; ++i) {
+                engine->encryptBlocks(roundKey[i], rounds, block[i], 1);
+            }
+        }
+
+        // the finished jobs return the IV for the data that follows, their lanes are dropped
+        for (size_t i = 0; i < laneCount;) {
+            position[i] += AES_BLOCK_SIZE;
+            if (position[i] < lane[i]->dataSize) {
+                ++i;
+                continue;
+            }
+            memcpy(lane[i]->iv, block[i], IV_SIZE);
+            --laneCount;
+            lane[i] = lane[laneCount];
+            position[i] = position[laneCount];
+            block[i] = block[laneCount];
+        }
+    }
+}
+
+
+int encryptMultiAES_CBC(JobAES *jobs, size_t jobCount) {
+    static const int rounds[] = {ROUND_AES_128, ROUND_AES_192, ROUND_AES_256};
+
+    if (jobs == NULL && jobCount > 0) {
+        return 1;
+    }
+    for (size_t i = 0; i < jobCount; ++i) {
+        if (jobs[i].context == NULL || jobs[i].iv == NULL || jobs[i].dataSize % AES_BLOCK_SIZE != 0 ||
+            (jobs[i].data == NULL && jobs[i].dataSize > 0)) {
+            return 1;
+        }
+    }
+
+    for (int i = 0; i < 3; ++i) {
+        multiEncryptCBC(jobs, jobCount, rounds[i]);
+    }
+    return 0;
+}
@@ -0,0 +1,431 @@
+/*
+ * AES crypter
+ *
+ * The worker pool for large calls whose blocks do not depend on each other: ECB encryption and decryption,
+ * and CBC decryption (each block needs only the previous ciphertext block).
+ *
+ * The data is split into chunks that stay in the cache, the workers and the calling thread take the next chunk
+ * until none is left. A chunk of CBC starts from the last ciphertext block of the previous chunk, and these blocks
+ * are saved before the work starts, because in place the previous chunk can be decrypted first. The chunks are
+ * given out in rounds, so the saved blocks take a fixed place whatever the size of the data.
+ *
+ * The threads are started on the first large call and wait for the next one. A call smaller than the threshold,
+ * or a call made while the pool is busy with another one, stays on the calling thread. The scheduler of batches
+ * (stealAES.c) runs on the same threads: poolBeginAES, poolRunAES and poolEndAES give a function to every thread.
+ */
+#ifndef _POSIX_C_SOURCE
+// clock_gettime and CLOCK_MONOTONIC are not in strict C11
+#define _POSIX_C_SOURCE 200809L
+#endif // _POSIX_C_SOURCE
+#include <string.h>
+
+#include "engineAES.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#else // _WIN32
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+#endif // _WIN32
+
+// the number of blocks in one chunk, 64 KiB
+#define POOL_CHUNK (4096)
+
+// the number of chunks in one round, their first chain blocks are saved together
+#define POOL_ROUND 1024
+
+// the size below which the calls stay on the calling thread
+#define POOL_THRESHOLD (1024 * 1024)
+
+#define POOL_MAX_THREADS 256
+
+#ifdef _WIN32
+typedef CRITICAL_SECTION PoolMutex;
+typedef CONDITION_VARIABLE PoolCondition;
+typedef HANDLE PoolThread;
+#define poolLock(mutex) EnterCriticalSection(mutex)
+#define poolUnlock(mutex) LeaveCriticalSection(mutex)
+#define poolWait(condition, mutex) SleepConditionVariableCS(condition, mutex, INFINITE)
+#define poolBroadcast(condition) WakeAllConditionVariable(condition)
+#else // _WIN32
+typedef pthread_mutex_t PoolMutex;
+typedef pthread_cond_t PoolCondition;
+typedef pthread_t PoolThread;
+#define poolLock(mutex) pthread_mutex_lock(mutex)
+#define poolUnlock(mutex) pthread_mutex_unlock(mutex)
+#define poolWait(condition, mutex) pthread_cond_wait(condition, mutex)
+#define poolBroadcast(condition) pthread_cond_broadcast(condition)
+#endif // _WIN32
+
+/**
+ * One round of a call: up to POOL_ROUND chunks.
+ */
+typedef struct {
+    const ContextAES *context;
+    PoolTaskAES task;
+    const byte *data;
+    byte *output;
+    size_t blockCount;
+    size_t chunkCount;
+    // CBC: the block before each chunk, the IV or the ciphertext
+    byte chain[POOL_ROUND * AES_BLOCK_SIZE];
+    // the next chunk that is not taken yet
+    volatile long long next;
+} PoolWork;
+
+/**
+ * The start parameters of a worker thread.
+ */
+typedef struct {
+    // the number of the thread in poolRunAES, the calling thread is 0
+    int index;
+    // the round that was running when the thread was started, the thread takes only the rounds after it
+    unsigned long generation;
+} PoolWorker;
+
+static struct {
+    PoolMutex mutex;
+    // the workers wait here for the next round
+    PoolCondition wake;
+    // the calling thread waits here for the workers
+    PoolCondition finished;
+    PoolThread thread[POOL_MAX_THREADS];
+    PoolWorker worker[POOL_MAX_THREADS];
+    // the threads of the calls, with the calling thread, and the number of started workers
+    int threadCount;
+    int started;
+    size_t threshold;
+    // the function of the round for every thread
+    PoolRunAES run;
+    void *arg;
+    // the number of the round, a worker takes each round once
+    unsigned long generation;
+    // the workers that have not finished the round yet
+    int active;
+    int busy;
+    int stop;
+} pool;
+
+
+/**
+ * Processes one chunk of the round.
+ */
+static void poolChunk(const PoolWork *work, size_t chunk) {
+    const EngineAES *engine = dispatchAES()->parallel;
+    const ContextAES *context = work->context;
+    size_t first = chunk * POOL_CHUNK;
+    size_t count = work->blockCount - first < POOL_CHUNK ? work->blockCount - first : POOL_CHUNK;
+    const byte *data = work->data + first * AES_BLOCK_SIZE;
+    byte *output = work->output + first * AES_BLOCK_SIZE;
+
+    if (output != data) {
+        memcpy(output, data, count * AES_BLOCK_SIZE);
+    }
+
+    switch (work->task) {
+        case POOL_ENCRYPT_ECB:
+            engine->encryptBlocks((const byte *) context->roundKey, context->rounds, output, count);
+            break;
+        case POOL_DECRYPT_ECB:
+            engine->decryptBlocks((const byte *) context->invRoundKey, context->rounds, output, count);
+            break;
+        case POOL_DECRYPT_CBC: {
+            byte chain[IV_SIZE];
+
+            memcpy(chain, work->chain + chunk * AES_BLOCK_SIZE, IV_SIZE);
+            decryptCbcBlocksAES(context, output, output != data ? data : NULL, count, chain);
+            break;
+        }
+    }
+}
+
+
+/**
+ * Takes the chunks of the round until none is left.
+ */
+static void poolRun(void *arg, int worker) {
+    PoolWork *work = arg;
+
+    // the chunks are shared, it does not matter which thread takes them
+    (void) worker;
+    for (;;) {
+        size_t chunk = atomicFetchAddAES(&work->next, 1);
+
+        if (chunk >= work->chunkCount) {
+            break;
+        }
+        poolChunk(work, chunk);
+    }
+}
+
+
+/**
+ * The loop of a worker thread, param is its PoolWorker.
+ */
+#ifdef _WIN32
+static DWORD WINAPI poolWorker(LPVOID param) {
+#else // _WIN32
+static void *poolWorker(void *param) {
+#endif // _WIN32
+    const PoolWorker *worker = param;
+    unsigned long seen = worker->generation;
+
+    poolLock(&pool.mutex);
+    for (;;) {
+        PoolRunAES run;
+        void *arg;
+
+        while (pool.generation == seen && !pool.stop) {
+            poolWait(&pool.wake, &pool.mutex);
+        }
+        if (pool.stop) {
+            break;
+        }
+        seen = pool.generation;
+        run = pool.run;
+        arg = pool.arg;
+        poolUnlock(&pool.mutex);
+
+        run(arg, worker->index);
+
+        poolLock(&pool.mutex);
+        if (--pool.active == 0) {
+            poolBroadcast(&pool.finished);
+        }
+    }
+    poolUnlock(&pool.mutex);
+    return 0;
+}
+
+
+/**
+ * Returns the number of processors, from 1 to POOL_MAX_THREADS.
+ */
+static int poolProcessors(void) {
+    int count;
+
+#ifdef _WIN32
+    SYSTEM_INFO info;
+
+    GetSystemInfo(&info);
+    count = (int) info.dwNumberOfProcessors;
+#else // _WIN32
+    count = (int) sysconf(_SC_NPROCESSORS_ONLN);
+#endif // _WIN32
+    return count < 1 ? 1 : count > POOL_MAX_THREADS ? POOL_MAX_THREADS : count;
+}
+
+
+/**
+ * Prepares the pool once: the thread count is the number of processors or AES_THREADS.
+ */
+static void poolInit(void) {
+    lpcstr threads = getenv("AES_THREADS");
+
+#ifdef _WIN32
+    InitializeCriticalSection(&pool.mutex);
+    InitializeConditionVariable(&pool.wake);
+    InitializeConditionVariable(&pool.finished);
+#else // _WIN32
+    pthread_mutex_init(&pool.mutex, NULL);
+    pthread_cond_init(&pool.wake, NULL);
+    pthread_cond_init(&pool.finished, NULL);
+#endif // _WIN32
+
+    pool.threadCount = poolProcessors();
+    if (threads != NULL && threads[0] != '\0') {
+        int count = atoi(threads);
+
+        pool.threadCount = count < 1 ? 1 : count > POOL_MAX_THREADS ? POOL_MAX_THREADS : count;
+    }
+    pool.threshold = POOL_THRESHOLD;
+}
+
+
+#ifdef _WIN32
+static BOOL CALLBACK poolInitOnce(PINIT_ONCE once, PVOID param, PVOID *context) {
+    poolInit();
+    return TRUE;
+}
+#endif // _WIN32
+
+
+static void poolOnce(void) {
+#ifdef _WIN32
+    static INIT_ONCE once = INIT_ONCE_STATIC_INIT;
+
+    InitOnceExecuteOnce(&once, poolInitOnce, NULL, NULL);
+#else // _WIN32
+    static pthread_once_t once = PTHREAD_ONCE_INIT;
+
+    pthread_once(&once, poolInit);
+#endif // _WIN32
+}
+
+
+/**
+ * Starts the missing workers, called with the mutex locked. If a thread cannot be started, the pool works
+ * with the threads it has.
+ */
+static void poolStart(void) {
+    for (; pool.started < pool.threadCount - 1; ++pool.started) {
+        PoolWorker *worker = &pool.worker[pool.started];
+
+        worker->index = pool.started + 1;
+        worker->generation = pool.generation;
+#ifdef _WIN32
+        pool.thread[pool.started] = CreateThread(NULL, 0, poolWorker, worker, 0, NULL);
+        if (pool.thread[pool.started] == NULL) {
+            break;
+        }
+#else // _WIN32
+        if (pthread_create(&pool.thread[pool.started], NULL, poolWorker, worker) != 0) {
+            break;
+        }
+#endif // _WIN32
+    }
+}
+
+
+/**
+ * Stops and joins all workers, the next large call starts them again.
+ */
+static void poolStop(void) {
+    poolLock(&pool.mutex);
+    pool.stop = 1;
+    poolBroadcast(&pool.wake);
+    poolUnlock(&pool.mutex);
+
+    for (int i = 0; i < pool.started; ++i) {
+#ifdef _WIN32
+        WaitForSingleObject(pool.thread[i], INFINITE);
+        CloseHandle(pool.thread[i]);
+#else // _WIN32
+        pthread_join(pool.thread[i], NULL);
+#endif // _WIN32
+    }
+
+    poolLock(&pool.mutex);
+    pool.started = 0;
+    pool.stop = 0;
+    poolUnlock(&pool.mutex);
+}
+
+
+int poolBeginAES(size_t dataSize) {
+    poolOnce();
+    poolLock(&pool.mutex);
+    if (pool.threadCount < 2 || pool.busy || dataSize < pool.threshold || dataSize == 0) {
+        poolUnlock(&pool.mutex);
+        return 0;
+    }
+    pool.busy = 1;
+    poolStart();
+    poolUnlock(&pool.mutex);
+    return pool.started + 1;
+}
+
+
+void poolRunAES(PoolRunAES run, void *arg) {
+    poolLock(&pool.mutex);
+    pool.run = run;
+    pool.arg = arg;
+    pool.active = pool.started;
+    ++pool.generation;
+    poolBroadcast(&pool.wake);
+    poolUnlock(&pool.mutex);
+
+    run(arg, 0);
+
+    poolLock(&pool.mutex);
+    while (pool.active > 0) {
+        poolWait(&pool.finished, &pool.mutex);
+    }
+    poolUnlock(&pool.mutex);
+}
+
+
+void poolEndAES(void) {
+    poolLock(&pool.mutex);
+    pool.busy = 0;
+    poolUnlock(&pool.mutex);
+}
+
+
+int poolCryptAES(const ContextAES *context, PoolTaskAES task, const byte *data, byte *output, size_t blockCount,
+                 byte *chain) {
+    static PoolWork work;
+
+    if (poolBeginAES(blockCount * AES_BLOCK_SIZE) == 0) {
+        return 1;
+    }
+
+    // only one call uses the pool at a time, so the work can stay in one place
+    work.context = context;
+    work.task = task;
+    for (size_t block = 0; block < blockCount; block += (size_t) POOL_ROUND * POOL_CHUNK) {
+        size_t count = blockCount - block;
+
+        work.data = data + block * AES_BLOCK_SIZE;
+        work.output = output + block * AES_BLOCK_SIZE;
+        work.blockCount = count < (size_t) POOL_ROUND * POOL_CHUNK ? count : (size_t) POOL_ROUND * POOL_CHUNK;
+        work.chunkCount = (work.blockCount + POOL_CHUNK - 1) / POOL_CHUNK;
+        work.next = 0;
+        if (task == POOL_DECRYPT_CBC) {
+            memcpy(work.chain, chain, IV_SIZE);
+            for (size_t i = 1; i < work.chunkCount; ++i) {
+                memcpy(work.chain + i * AES_BLOCK_SIZE, work.data + (i * POOL_CHUNK - 1) * AES_BLOCK_SIZE, IV_SIZE);
+            }
+            // the next round and the data that follows start from the last block, in place it is overwritten
+            memcpy(chain, work.data + (work.blockCount - 1) * AES_BLOCK_SIZE, IV_SIZE);
+        }
+
+        poolRunAES(poolRun, &work);
+    }
+
+    poolEndAES();
+    return 0;
+}
+
+
+int setThreadsAES(int threadCount, size_t threshold) {
+    if (threadCount < 0 || threadCount > POOL_MAX_THREADS) {
+        return 1;
+    }
+
+    poolOnce();
+    poolStop();
+    if (threadCount == 0) {
+        threadCount = poolProcessors();
+    }
+
+    poolLock(&pool.mutex);
+    pool.threadCount = threadCount;
+    pool.threshold = threshold == 0 ? POOL_THRESHOLD : threshold;
+    poolUnlock(&pool.mutex);
+    return 0;
+}
+
+
+int getThreadsAES(void) {
+    poolOnce();
+    return pool.threadCount;
+}
+
+
+uint64_t clockAES(void) {
+#ifdef _WIN32
+    LARGE_INTEGER counter, frequency;
+
+    QueryPerformanceCounter(&counter);
+    QueryPerformanceFrequency(&frequency);
+    return (uint64_t) (counter.QuadPart / frequency.QuadPart * 1000000000 +
+                       counter.QuadPart % frequency.QuadPart * 1000000000 / frequency.QuadPart);
+#else // _WIN32
+    struct timespec time;
+
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return (uint64_t) time.tv_sec * 1000000000 + (uint64_t) time.tv_nsec;
+#endif // _WIN32
+}
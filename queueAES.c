@@ -0,0 +1,296 @@
+/*
+ * AES crypter
+ *
+ * The asynchronous queue: the callers submit jobs and go on, a worker thread of the queue encrypts or decrypts them
+ * and puts the completions into a ring that the event loop polls.
+ *
+ * The submission ring takes jobs from any number of threads without a lock: a caller takes the next slot with
+ * an atomic counter, writes the job and publishes it with the sequence number of the slot, the worker reads the slots
+ * in order. The completion ring has one writer (the worker) and one reader (the event loop). A job stays counted
+ * until its completion is polled, and the queue takes at most its capacity of such jobs, so neither ring overflows.
+ *
+ * The worker sleeps on a semaphore that every submission posts. On Linux every completion also increments
+ * an eventfd, so the event loop can wait for completions with epoll together with its sockets.
+ */
+#include <limits.h>
+#include <string.h>
+
+#include "engineAES.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#else // _WIN32
+#include <pthread.h>
+#include <sched.h>
+#include <semaphore.h>
+#include <unistd.h>
+#endif // _WIN32
+
+#ifdef __linux__
+#include <sys/eventfd.h>
+#endif // __linux__
+
+#ifdef _WIN32
+typedef HANDLE QueueThread;
+typedef HANDLE QueueSemaphore;
+#define queuePost(semaphore) ReleaseSemaphore(*(semaphore), 1, NULL)
+#define queueWait(semaphore) WaitForSingleObject(*(semaphore), INFINITE)
+#define queueYield() SwitchToThread()
+#else // _WIN32
+typedef pthread_t QueueThread;
+typedef sem_t QueueSemaphore;
+#define queuePost(semaphore) sem_post(semaphore)
+#define queueWait(semaphore) while (sem_wait(semaphore) != 0) continue
+#define queueYield() sched_yield()
+#endif // _WIN32
+
+typedef struct {
+    // the position of the slot: i while it is free, i + 1 when the job of position i is published,
+    // i + capacity when the job is taken
+    volatile long long sequence;
+    AsyncJobAES job;
+} QueueSlot;
+
+struct QueueAES {
+    size_t capacity;
+    QueueSlot *submission;
+    CompletionAES *completion;
+    // the next position of the submission ring for the callers and for the worker
+    volatile long long submitTail;
+    size_t submitHead;
+    // the completion ring: the worker writes at tail, the event loop reads at head
+    volatile long long completeTail;
+    volatile long long completeHead;
+    // the jobs that are submitted and whose completions are not polled yet
+    volatile long long inFlight;
+    volatile long long stop;
+    QueueSemaphore semaphore;
+    QueueThread thread;
+    int event;
+};
+
+
+/**
+ * Processes one job with the functions into the caller's buffer.
+ */
+static void queueProcess(const AsyncJobAES *job, CompletionAES *completion) {
+    size_t outputSize = job->outputSize;
+
+    completion->userData = job->userData;
+    if (job->decrypt) {
+        completion->result = decryptIntoAES(job->context, job->data, job->dataSize, job->output, &outputSize,
+                                            job->mode, job->iv);
+    } else {
+        completion->result = encryptIntoAES(job->context, job->data, job->dataSize, job->output, &outputSize,
+                                            job->mode, job->iv);
+    }
+    completion->outputSize = completion->result ? 0 : outputSize;
+}
+
+
+/**
+ * The loop of the worker of the queue: each post of the semaphore is one job, or the stop.
+ */
+#ifdef _WIN32
+static DWORD WINAPI queueWorker(LPVOID param) {
+#else // _WIN32
+static void *queueWorker(void *param) {
+#endif // _WIN32
+    QueueAES *queue = param;
+
+    for (;;) {
+        QueueSlot *slot;
+        size_t tail;
+
+        queueWait(&queue->semaphore);
+        if (queue->submitHead == (size_t) atomicLoadAES(&queue->submitTail) && atomicLoadAES(&queue->stop)) {
+            break;
+        }
+
+        // the caller that took the slot can still be writing the job
+        slot = &queue->submission[queue->submitHead & (queue->capacity - 1)];
+        while ((size_t) atomicLoadAES(&slot->sequence) != queue->submitHead + 1) {
+            queueYield();
+        }
+
+        tail = (size_t) atomicLoadAES(&queue->completeTail);
+        queueProcess(&slot->job, &queue->completion[tail & (queue->capacity - 1)]);
+        atomicFetchAddAES(&slot->sequence, (long long) queue->capacity - 1);
+        ++queue->submitHead;
+        atomicFetchAddAES(&queue->completeTail, 1);
+
+#ifdef __linux__
+        {
+            uint64_t one = 1;
+            ssize_t written = write(queue->event, &one, sizeof(one));
+
+            // the counter of the eventfd cannot overflow, the poll resets it
+            (void) written;
+        }
+#endif // __linux__
+    }
+    return 0;
+}
+
+
+/**
+ * Frees the memory of a queue whose thread is not running.
+ */
+static void queueRelease(QueueAES *queue) {
+#ifdef __linux__
+    if (queue->event >= 0) {
+        close(queue->event);
+    }
+#endif // __linux__
+    free(queue->submission);
+    free(queue->completion);
+    free(queue);
+}
+
+
+/**
+ * Starts the worker of the queue, returns 1 if the semaphore or the thread cannot be created.
+ */
+static int queueStart(QueueAES *queue) {
+#ifdef _WIN32
+    queue->semaphore = CreateSemaphore(NULL, 0, LONG_MAX, NULL);
+    if (queue->semaphore == NULL) {
+        return 1;
+    }
+    queue->thread = CreateThread(NULL, 0, queueWorker, queue, 0, NULL);
+    if (queue->thread == NULL) {
+        CloseHandle(queue->semaphore);
+        return 1;
+    }
+#else // _WIN32
+    if (sem_init(&queue->semaphore, 0, 0) != 0) {
+        return 1;
+    }
+    if (pthread_create(&queue->thread, NULL, queueWorker, queue) != 0) {
+        sem_destroy(&queue->semaphore);
+        return 1;
+    }
+#endif // _WIN32
+    return 0;
+}
+
+
+QueueAES *createQueueAES(size_t capacity) {
+    QueueAES *queue;
+    size_t size = 1;
+
+    if (capacity == 0) {
+        return NULL;
+    }
+    // the positions are taken modulo the capacity, so it is a power of two
+    while (size < capacity) {
+        size <<= 1;
+    }
+
+    queue = calloc(1, sizeof(QueueAES));
+    if (queue == NULL) {
+        return NULL;
+    }
+    queue->capacity = size;
+    queue->submission = calloc(size, sizeof(QueueSlot));
+    queue->completion = calloc(size, sizeof(CompletionAES));
+    queue->event = -1;
+#ifdef __linux__
+    queue->event = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+#endif // __linux__
+
+    if (queue->submission == NULL || queue->completion == NULL) {
+        queueRelease(queue);
+        return NULL;
+    }
+#ifdef __linux__
+    if (queue->event < 0) {
+        queueRelease(queue);
+        return NULL;
+    }
+#endif // __linux__
+
+    for (size_t i = 0; i < size; ++i) {
+        queue->submission[i].sequence = (long long) i;
+    }
+    if (queueStart(queue)) {
+        queueRelease(queue);
+        return NULL;
+    }
+    return queue;
+}
+
+
+void freeQueueAES(QueueAES *queue) {
+    if (queue == NULL) {
+        return;
+    }
+
+    // the worker finishes the submitted jobs first
+    atomicFetchAddAES(&queue->stop, 1);
+    queuePost(&queue->semaphore);
+#ifdef _WIN32
+    WaitForSingleObject(queue->thread, INFINITE);
+    CloseHandle(queue->thread);
+    CloseHandle(queue->semaphore);
+#else // _WIN32
+    pthread_join(queue->thread, NULL);
+    sem_destroy(&queue->semaphore);
+#endif // _WIN32
+    queueRelease(queue);
+}
+
+
+int submitQueueAES(QueueAES *queue, const AsyncJobAES *job) {
+    QueueSlot *slot;
+    size_t position;
+
+    if (queue == NULL || job == NULL || job->context == NULL || job->output == NULL ||
+        (job->data == NULL && job->dataSize > 0)) {
+        return 1;
+    }
+    // a place in both rings is reserved until the completion is polled
+    if (atomicFetchAddAES(&queue->inFlight, 1) >= queue->capacity) {
+        atomicFetchAddAES(&queue->inFlight, -1);
+        return 1;
+    }
+
+    position = atomicFetchAddAES(&queue->submitTail, 1);
+    slot = &queue->submission[position & (queue->capacity - 1)];
+    slot->job = *job;
+    atomicFetchAddAES(&slot->sequence, 1);
+
+    queuePost(&queue->semaphore);
+    return 0;
+}
+
+
+size_t pollQueueAES(QueueAES *queue, CompletionAES *completions, size_t maxCount) {
+    size_t head = (size_t) atomicLoadAES(&queue->completeHead);
+    size_t count;
+
+#ifdef __linux__
+    {
+        uint64_t value;
+        ssize_t size = read(queue->event, &value, sizeof(value));
+
+        // the event is cleared before the ring is read, so a later completion sets it again
+        (void) size;
+    }
+#endif // __linux__
+
+    count = (size_t) atomicLoadAES(&queue->completeTail) - head;
+    count = count < maxCount ? count : maxCount;
+    for (size_t i = 0; i < count; ++i) {
+        completions[i] = queue->completion[(head + i) & (queue->capacity - 1)];
+    }
+
+    atomicFetchAddAES(&queue->completeHead, (long long) count);
+    atomicFetchAddAES(&queue->inFlight, -(long long) count);
+    return count;
+}
+
+
+int getEventQueueAES(const QueueAES *queue) {
+    return queue->event;
+}
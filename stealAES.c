@@ -0,0 +1,335 @@
+/*
+ * AES crypter
+ *
+ * The work-stealing scheduler of batches: many independent jobs of any size, from tiny records to blobs
+ * of gigabytes, are processed by the threads of the worker pool.
+ *
+ * Every thread has its own deque of tasks, a task is a range of blocks of one job. A thread takes the next job
+ * of the batch, and when the jobs run out it takes the tasks from the top of the deques of other threads. The jobs
+ * whose blocks are independent (ECB and CBC decryption) are split in halves down to the grain: the thread keeps
+ * one half and pushes the other to the bottom of its deque, so a thread that has no work steals the largest part
+ * that is left. A half of CBC takes the ciphertext block before it, because the first half can be decrypted first.
+ * The chained jobs (CBC encryption, CTR, CFB, OFB) are processed whole by one thread.
+ *
+ * A thread that finds no work yields for a few rounds and then sleeps, longer after each round up to a millisecond,
+ * so the threads that wait for the end of a long chained job do not take the processor from it.
+ */
+#ifndef _POSIX_C_SOURCE
+// nanosleep is not in strict C11
+#define _POSIX_C_SOURCE 200809L
+#endif // _POSIX_C_SOURCE
+#include <string.h>
+
+#include "engineAES.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#else // _WIN32
+#include <sched.h>
+#include <time.h>
+#endif // _WIN32
+
+// the default grain: tasks of ECB and CBC decryption are not split below this size, 64 KiB
+#define STEAL_GRAIN (4096 * AES_BLOCK_SIZE)
+
+// the capacity of one deque, the halves of the splits of one task take log2 of its size
+#define STEAL_DEPTH 64
+
+// the rounds without work that a thread yields before it sleeps, and the longest sleep in microseconds
+#define STEAL_SPINS 64
+#define STEAL_MAX_SLEEP 1000
+
+/**
+ * A range of blocks of one job, a chained job is one task.
+ */
+typedef struct {
+    BatchJobAES *job;
+    size_t first;
+    size_t blockCount;
+    // CBC decryption: the IV or the ciphertext block before the range
+    byte chain[IV_SIZE];
+} StealTask;
+
+/**
+ * The deque of one thread: the thread pushes and pops at the bottom, other threads steal from the top.
+ */
+typedef struct {
+    volatile long lock;
+    size_t top;
+    size_t bottom;
+    StealTask task[STEAL_DEPTH];
+    WorkerStatsAES stats;
+    // keeps the deques of different threads in different cache lines
+    byte padding[64];
+} StealDeque;
+
+typedef struct {
+    BatchJobAES *jobs;
+    size_t jobCount;
+    size_t grain;
+    StealDeque *deque;
+    int threadCount;
+    // the next job that no thread has taken yet
+    volatile long long next;
+    // the blocks that are not processed yet, the threads stop when it is 0
+    volatile long long remaining;
+} StealBatch;
+
+
+/**
+ * Waits after the round of the given number without work: yields first, then sleeps from 1 microsecond
+ * up to STEAL_MAX_SLEEP.
+ */
+static void stealBackoff(unsigned round) {
+#ifdef _WIN32
+    if (round < STEAL_SPINS) {
+        SwitchToThread();
+    } else {
+        Sleep(1);
+    }
+#else // _WIN32
+    if (round < STEAL_SPINS) {
+        sched_yield();
+    } else {
+        unsigned shift = round - STEAL_SPINS;
+        struct timespec delay = {0, (shift < 10 ? 1L << shift : STEAL_MAX_SLEEP) * 1000};
+
+        nanosleep(&delay, NULL);
+    }
+#endif // _WIN32
+}
+
+
+/**
+ * Returns 1 if the blocks of the job do not depend on each other, then its tasks can be split.
+ */
+static int stealSplittable(const BatchJobAES *job) {
+    return job->mode == AES_ECB || (job->mode == AES_CBC && job->decrypt);
+}
+
+
+/**
+ * The number of blocks of the job, the last partial block of a stream counts as a block.
+ */
+static size_t stealBlocks(const BatchJobAES *job) {
+    return (job->dataSize + AES_BLOCK_SIZE - 1) / AES_BLOCK_SIZE;
+}
+
+
+/**
+ * Pushes the task to the bottom of the deque, returns 1 if the deque is full.
+ */
+static int stealPush(StealDeque *deque, const StealTask *task) {
+    int full;
+
+    atomicLockAES(&deque->lock);
+    full = deque->bottom - deque->top == STEAL_DEPTH;
+    if (!full) {
+        deque->task[deque->bottom % STEAL_DEPTH] = *task;
+        ++deque->bottom;
+    }
+    atomicUnlockAES(&deque->lock);
+    return full;
+}
+
+
+/**
+ * Takes the task from the bottom of the deque (own = 1) or from the top (own = 0), returns 0 if the deque is empty.
+ */
+static int stealTake(StealDeque *deque, StealTask *task, int own) {
+    int found;
+
+    atomicLockAES(&deque->lock);
+    found = deque->bottom != deque->top;
+    if (found && own) {
+        --deque->bottom;
+        *task = deque->task[deque->bottom % STEAL_DEPTH];
+    } else if (found) {
+        *task = deque->task[deque->top % STEAL_DEPTH];
+        ++deque->top;
+    }
+    atomicUnlockAES(&deque->lock);
+    return found;
+}
+
+
+/**
+ * Takes the next job of the batch as one task, the jobs without data are skipped.
+ */
+static int stealNext(StealBatch *batch, StealTask *task) {
+    for (;;) {
+        size_t index = atomicFetchAddAES(&batch->next, 1);
+        BatchJobAES *job;
+
+        if (index >= batch->jobCount) {
+            return 0;
+        }
+        job = &batch->jobs[index];
+        if (job->dataSize == 0) {
+            continue;
+        }
+
+        task->job = job;
+        task->first = 0;
+        task->blockCount = stealBlocks(job);
+        if (job->mode == AES_CBC && job->decrypt) {
+            // the IV for the data that follows is the last ciphertext block, it is overwritten in place
+            memcpy(task->chain, job->iv, IV_SIZE);
+            memcpy(job->iv, job->data + job->dataSize - AES_BLOCK_SIZE, IV_SIZE);
+        }
+        return 1;
+    }
+}
+
+
+/**
+ * Steals a task from the top of another deque, the search starts from the next thread.
+ */
+static int stealFrom(StealBatch *batch, int worker, StealTask *task) {
+    for (int i = 1; i < batch->threadCount; ++i) {
+        if (stealTake(&batch->deque[(worker + i) % batch->threadCount], task, 0)) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+
+/**
+ * Processes the task: a splittable task is halved while it is larger than the grain, the upper halves
+ * go to the deque of the thread.
+ */
+static void stealProcess(StealBatch *batch, StealDeque *deque, StealTask *task) {
+    BatchJobAES *job = task->job;
+    const ContextAES *context = job->context;
+    size_t grain = batch->grain / AES_BLOCK_SIZE;
+    byte *data = job->data + task->first * AES_BLOCK_SIZE;
+
+    if (!stealSplittable(job)) {
+        cryptModeAES(context, job->data, job->dataSize, job->mode, job->decrypt, job->iv);
+    } else {
+        while (task->blockCount > grain) {
+            size_t half = task->blockCount / 2;
+            StealTask upper = {job, task->first + half, task->blockCount - half, {0}};
+
+            if (job->mode == AES_CBC) {
+                memcpy(upper.chain, data + (half - 1) * AES_BLOCK_SIZE, IV_SIZE);
+            }
+            if (stealPush(deque, &upper)) {
+                break;
+            }
+            task->blockCount = half;
+            ++deque->stats.splits;
+        }
+
+        if (job->mode == AES_CBC) {
+            decryptCbcBlocksAES(context, data, NULL, task->blockCount, task->chain);
+        } else if (job->decrypt) {
+            dispatchAES()->parallel->decryptBlocks((const byte *) context->invRoundKey, context->rounds, data,
+                                                   task->blockCount);
+        } else {
+            dispatchAES()->parallel->encryptBlocks((const byte *) context->roundKey, context->rounds, data,
+                                                   task->blockCount);
+        }
+    }
+
+    ++deque->stats.tasks;
+    deque->stats.blocks += task->blockCount;
+    atomicFetchAddAES(&batch->remaining, -(long long) task->blockCount);
+}
+
+
+/**
+ * The loop of one thread: its own deque, then the next job, then the deques of other threads.
+ */
+static void stealWorker(void *arg, int worker) {
+    StealBatch *batch = arg;
+    StealDeque *deque = &batch->deque[worker];
+    uint64_t idle = 0;
+    unsigned rounds = 0;
+    StealTask task;
+
+    for (;;) {
+        if (stealTake(deque, &task, 1) || stealNext(batch, &task)) {
+            // found without stealing
+        } else if (stealFrom(batch, worker, &task)) {
+            ++deque->stats.steals;
+        } else {
+            ++deque->stats.failedSteals;
+            if (atomicLoadAES(&batch->remaining) == 0) {
+                break;
+            }
+            if (idle == 0) {
+                idle = clockAES();
+            }
+            stealBackoff(rounds++);
+            continue;
+        }
+
+        if (idle != 0) {
+            deque->stats.idleTime += clockAES() - idle;
+            idle = 0;
+            rounds = 0;
+        }
+        stealProcess(batch, deque, &task);
+    }
+
+    if (idle != 0) {
+        deque->stats.idleTime += clockAES() - idle;
+    }
+}
+
+
+int cryptBatchAES(BatchJobAES *jobs, size_t jobCount, size_t grain, WorkerStatsAES *stats) {
+    StealBatch batch = {jobs, jobCount, grain == 0 ? STEAL_GRAIN : grain, NULL, 1, 0, 0};
+    size_t dataSize = 0;
+    long long blockCount = 0;
+
+    if (jobs == NULL && jobCount > 0) {
+        return 1;
+    }
+    for (size_t i = 0; i < jobCount; ++i) {
+        const BatchJobAES *job = &jobs[i];
+
+        if (job->context == NULL || job->mode == AES_GCM || (job->mode != AES_ECB && job->iv == NULL) ||
+            (job->data == NULL && job->dataSize > 0)) {
+            return 1;
+        }
+        if ((job->mode == AES_ECB || job->mode == AES_CBC) && job->dataSize % AES_BLOCK_SIZE != 0) {
+            return 1;
+        }
+        dataSize += job->dataSize;
+        blockCount += (long long) stealBlocks(job);
+    }
+    if (batch.grain < AES_BLOCK_SIZE) {
+        batch.grain = AES_BLOCK_SIZE;
+    }
+
+    batch.threadCount = poolBeginAES(dataSize);
+    batch.deque = calloc(batch.threadCount == 0 ? 1 : (size_t) batch.threadCount, sizeof(StealDeque));
+    if (batch.deque == NULL) {
+        if (batch.threadCount != 0) {
+            poolEndAES();
+        }
+        return 1;
+    }
+    batch.remaining = blockCount;
+
+    if (batch.threadCount == 0) {
+        // a small batch, or the pool is busy with another call
+        batch.threadCount = 1;
+        stealWorker(&batch, 0);
+    } else {
+        poolRunAES(stealWorker, &batch);
+        poolEndAES();
+    }
+
+    if (stats != NULL) {
+        memset(stats, 0, sizeof(WorkerStatsAES) * (size_t) getThreadsAES());
+        for (int i = 0; i < batch.threadCount; ++i) {
+            stats[i] = batch.deque[i].stats;
+        }
+    }
+    free(batch.deque);
+    return 0;
+}
@@ -0,0 +1,179 @@
+/*
+ * AES crypter
+ *
+ * CFB (CFB-128) and OFB modes, they turn the cipher into a stream and take data of any size without padding.
+ *
+ * OFB encrypts the previous keystream block to get the next one, the keystream does not depend on the data.
+ * So it is generated ahead into the ring of the stream (fillStreamAES, for example while the connection is idle)
+ * and then the data only needs an XOR. CFB encrypts the previous ciphertext block: encryption waits for each block,
+ * but for decryption all ciphertext blocks are known, so they go through the parallel engine at once.
+ */
+#include <string.h>
+
+#include "engineAES.h"
+
+// the number of blocks that CFB decryption passes to the engine at once
+#define STREAM_BLOCKS 32
+
+
+/**
+ * Generates the next keystream blocks of OFB at the end of the ring, at most blockCount blocks and only
+ * as many as fit into the free part. The ring is a multiple of 16 bytes and the generated data always ends
+ * on a block, so a block never wraps around.
+ */
+static void ofbGenerate(StreamAES *stream, size_t blockCount) {
+    const EngineAES *engine = dispatchAES()->serial;
+    const ContextAES *context = stream->context;
+
+    for (; blockCount > 0 && stream->count + AES_BLOCK_SIZE <= STREAM_RING_SIZE; --blockCount) {
+        byte *tail = stream->ring + (stream->head + stream->count) % STREAM_RING_SIZE;
+
+        engine->encryptBlocks((const byte *) context->roundKey, context->rounds, stream->feedback, 1);
+        memcpy(tail, stream->feedback, AES_BLOCK_SIZE);
+        stream->count += AES_BLOCK_SIZE;
+    }
+}
+
+
+/**
+ * The next keystream block of CFB, the encrypted feedback block, it is stored at the start of the ring.
+ */
+static void cfbNext(StreamAES *stream) {
+    const ContextAES *context = stream->context;
+
+    memcpy(stream->ring, stream->feedback, AES_BLOCK_SIZE);
+    dispatchAES()->serial->encryptBlocks((const byte *) context->roundKey, context->rounds, stream->ring, 1);
+    stream->head = 0;
+    stream->count = AES_BLOCK_SIZE;
+}
+
+
+/**
+ * Decrypts whole blocks of CFB, the stream must be at the start of a block. Each block of the keystream
+ * is the previous ciphertext block encrypted, so the blocks of a group are encrypted by the parallel engine at once.
+ */
+static void cfbDecryptBlocks(StreamAES *stream, byte *data, size_t blockCount) {
+    const EngineAES *engine = dispatchAES()->parallel;
+    const ContextAES *context = stream->context;
+    byte keystream[STREAM_BLOCKS * AES_BLOCK_SIZE];
+
+    for (size_t block = 0; block < blockCount; block += STREAM_BLOCKS) {
+        size_t count = blockCount - block < STREAM_BLOCKS ? blockCount - block : STREAM_BLOCKS;
+        byte *ptr = data + block * AES_BLOCK_SIZE;
+
+        memcpy(keystream, stream->feedback, AES_BLOCK_SIZE);
+        memcpy(keystream + AES_BLOCK_SIZE, ptr, (count - 1) * AES_BLOCK_SIZE);
+        memcpy(stream->feedback, ptr + (count - 1) * AES_BLOCK_SIZE, AES_BLOCK_SIZE);
+
+        engine->encryptBlocks((const byte *) context->roundKey, context->rounds, keystream, count);
+        xorBytesAES(ptr, keystream, count * AES_BLOCK_SIZE);
+    }
+}
+
+
+int initStreamAES(StreamAES *stream, const ContextAES *context, ModeAES mode, const byte *iv) {
+    if (stream == NULL || context == NULL || iv == NULL || (mode != AES_CFB && mode != AES_OFB)) {
+        return 1;
+    }
+
+    stream->context = context;
+    stream->mode = mode;
+    memcpy(stream->feedback, iv, IV_SIZE);
+    stream->head = 0;
+    stream->count = 0;
+    return 0;
+}
+
+
+size_t fillStreamAES(StreamAES *stream) {
+    if (stream->mode == AES_OFB) {
+        ofbGenerate(stream, STREAM_RING_SIZE / AES_BLOCK_SIZE);
+    }
+    return stream->count;
+}
+
+
+/**
+ * Encrypts or decrypts the data with the stream, the data of any size continues the data of the previous call.
+ */
+static void streamCrypt(StreamAES *stream, byte *data, size_t dataSize, int decrypt) {
+    while (dataSize > 0) {
+        size_t size;
+
+        if (stream->count == 0) {
+            if (stream->mode == AES_OFB) {
+                // only the keystream that is needed, so that the feedback block follows the data
+                ofbGenerate(stream, (dataSize + AES_BLOCK_SIZE - 1) / AES_BLOCK_SIZE);
+            } else if (decrypt && dataSize >= AES_BLOCK_SIZE) {
+                size_t blockCount = dataSize / AES_BLOCK_SIZE;
+
+                cfbDecryptBlocks(stream, data, blockCount);
+                data += blockCount * AES_BLOCK_SIZE;
+                dataSize -= blockCount * AES_BLOCK_SIZE;
+                continue;
+            } else {
+                cfbNext(stream);
+            }
+        }
+
+        // the part of the keystream up to the end of the ring
+        size = STREAM_RING_SIZE - stream->head;
+        size = stream->count < size ? stream->count : size;
+        size = dataSize < size ? dataSize : size;
+
+        if (stream->mode == AES_CFB) {
+            // the ciphertext becomes the next feedback block, head is the position in the block
+            if (decrypt) {
+                memcpy(stream->feedback + stream->head, data, size);
+            }
+            xorBytesAES(data, stream->ring + stream->head, size);
+            if (!decrypt) {
+                memcpy(stream->feedback + stream->head, data, size);
+            }
+        } else {
+            xorBytesAES(data, stream->ring + stream->head, size);
+        }
+
+        stream->head = (stream->head + size) % STREAM_RING_SIZE;
+        stream->count -= size;
+        data += size;
+        dataSize -= size;
+    }
+}
+
+
+void encryptStreamAES(StreamAES *stream, byte *data, size_t dataSize) {
+    streamCrypt(stream, data, dataSize, 0);
+}
+
+
+void decryptStreamAES(StreamAES *stream, byte *data, size_t dataSize) {
+    streamCrypt(stream, data, dataSize, 1);
+}
+
+
+/**
+ * The functions with the IV run a stream and return its feedback block as the IV for the data that follows.
+ */
+static void streamOnce(const ContextAES *context, ModeAES mode, byte *data, size_t dataSize, byte *iv, int decrypt) {
+    StreamAES stream;
+
+    initStreamAES(&stream, context, mode, iv);
+    streamCrypt(&stream, data, dataSize, decrypt);
+    memcpy(iv, stream.feedback, IV_SIZE);
+}
+
+
+void encryptContextAES_CFB(const ContextAES *context, byte *data, size_t dataSize, byte *iv) {
+    streamOnce(context, AES_CFB, data, dataSize, iv, 0);
+}
+
+
+void decryptContextAES_CFB(const ContextAES *context, byte *data, size_t dataSize, byte *iv) {
+    streamOnce(context, AES_CFB, data, dataSize, iv, 1);
+}
+
+
+void cryptContextAES_OFB(const ContextAES *context, byte *data, size_t dataSize, byte *iv) {
+    streamOnce(context, AES_OFB, data, dataSize, iv, 0);
+}
@@ -0,0 +1,153 @@
+/*
+ * AES crypter
+ *
+ * Engine on 32-bit tables (T-tables).
+ *
+ * SubBytes, ShiftRows and MixColumns of one round are combined into four table lookups and XOR
+ * for each column. The tables are built once from the Sbox and invSbox tables of AES.c.
+ */
+#include "engineAES.h"
+
+#define GETU32(p) (((uint32_t) (p)[0] << 24) | ((uint32_t) (p)[1] << 16) | \
+                   ((uint32_t) (p)[2] << 8) | ((uint32_t) (p)[3]))
+
+#define PUTU32(p, v) do {               \
+        (p)[0] = (byte) ((v) >> 24);    \
+        (p)[1] = (byte) ((v) >> 16);    \
+        (p)[2] = (byte) ((v) >> 8);     \
+        (p)[3] = (byte) (v);            \
+    } while (0)
+
+#define ROR8(v) (((v) >> 8) | ((v) << 24))
+
+// encryption tables: Te0[x] = {02, 01, 01, 03} * S[x], the rest are rotations of Te0
+static uint32_t Te0[256], Te1[256], Te2[256], Te3[256];
+
+// decryption tables: Td0[x] = {0e, 09, 0d, 0b} * InvS[x], the rest are rotations of Td0
+static uint32_t Td0[256], Td1[256], Td2[256], Td3[256];
+
+
+/**
+ * Multiplication in GF(2^8), only used to build the tables.
+ */
+static byte tableMultiply(byte a, byte b) {
+    byte result = 0;
+    for (int i = 0; i < 8; i++) {
+        if (b & 1) {
+            result ^= a;
+        }
+        a = (byte) ((a << 1) ^ ((a & 0x80) ? 0x1B : 0x00));
+        b >>= 1;
+    }
+    return result;
+}
+
+
+static void tableInit(void) {
+    for (int x = 0; x < 256; ++x) {
+        byte s = Sbox[x];
+        byte is = invSbox[x];
+
+        Te0[x] = ((uint32_t) tableMultiply(s, 0x02) << 24) | ((uint32_t) s << 16) |
+                 ((uint32_t) s << 8) | (uint32_t) tableMultiply(s, 0x03);
+        Te1[x] = ROR8(Te0[x]);
+        Te2[x] = ROR8(Te1[x]);
+        Te3[x] = ROR8(Te2[x]);
+
+        Td0[x] = ((uint32_t) tableMultiply(is, 0x0e) << 24) | ((uint32_t) tableMultiply(is, 0x09) << 16) |
+                 ((uint32_t) tableMultiply(is, 0x0d) << 8) | (uint32_t) tableMultiply(is, 0x0b);
+        Td1[x] = ROR8(Td0[x]);
+        Td2[x] = ROR8(Td1[x]);
+        Td3[x] = ROR8(Td2[x]);
+    }
+}
+
+
+// one middle round, expanded for each round by ROUNDS_AES_*
+#define TABLE_ENCRYPT_ROUND(round)                                                                                  \
+        t0 = Te0[s0 >> 24] ^ Te1[(s1 >> 16) & 0xFF] ^ Te2[(s2 >> 8) & 0xFF] ^ Te3[s3 & 0xFF] ^ rk[(round) * 4];     \
+        t1 = Te0[s1 >> 24] ^ Te1[(s2 >> 16) & 0xFF] ^ Te2[(s3 >> 8) & 0xFF] ^ Te3[s0 & 0xFF] ^ rk[(round) * 4 + 1]; \
+        t2 = Te0[s2 >> 24] ^ Te1[(s3 >> 16) & 0xFF] ^ Te2[(s0 >> 8) & 0xFF] ^ Te3[s1 & 0xFF] ^ rk[(round) * 4 + 2]; \
+        t3 = Te0[s3 >> 24] ^ Te1[(s0 >> 16) & 0xFF] ^ Te2[(s1 >> 8) & 0xFF] ^ Te3[s2 & 0xFF] ^ rk[(round) * 4 + 3]; \
+        s0 = t0;                                                                                                    \
+        s1 = t1;                                                                                                    \
+        s2 = t2;                                                                                                    \
+        s3 = t3;
+#define TABLE_DECRYPT_ROUND(round)                                                                                  \
+        t0 = Td0[s0 >> 24] ^ Td1[(s3 >> 16) & 0xFF] ^ Td2[(s2 >> 8) & 0xFF] ^ Td3[s1 & 0xFF] ^ rk[(round) * 4];     \
+        t1 = Td0[s1 >> 24] ^ Td1[(s0 >> 16) & 0xFF] ^ Td2[(s3 >> 8) & 0xFF] ^ Td3[s2 & 0xFF] ^ rk[(round) * 4 + 1]; \
+        t2 = Td0[s2 >> 24] ^ Td1[(s1 >> 16) & 0xFF] ^ Td2[(s0 >> 8) & 0xFF] ^ Td3[s3 & 0xFF] ^ rk[(round) * 4 + 2]; \
+        t3 = Td0[s3 >> 24] ^ Td1[(s2 >> 16) & 0xFF] ^ Td2[(s1 >> 8) & 0xFF] ^ Td3[s0 & 0xFF] ^ rk[(round) * 4 + 3]; \
+        s0 = t0;                                                                                                    \
+        s1 = t1;                                                                                                    \
+        s2 = t2;                                                                                                    \
+        s3 = t3;
+
+// the last round has no MixColumns
+#define TABLE_ENCRYPT_LAST()                                                                                        \
+        t0 = ((uint32_t) Sbox[s0 >> 24] << 24) | ((uint32_t) Sbox[(s1 >> 16) & 0xFF] << 16) |                       \
+             ((uint32_t) Sbox[(s2 >> 8) & 0xFF] << 8) | (uint32_t) Sbox[s3 & 0xFF];                                 \
+        t1 = ((uint32_t) Sbox[s1 >> 24] << 24) | ((uint32_t) Sbox[(s2 >> 16) & 0xFF] << 16) |                       \
+             ((uint32_t) Sbox[(s3 >> 8) & 0xFF] << 8) | (uint32_t) Sbox[s0 & 0xFF];                                 \
+        t2 = ((uint32_t) Sbox[s2 >> 24] << 24) | ((uint32_t) Sbox[(s3 >> 16) & 0xFF] << 16) |                       \
+             ((uint32_t) Sbox[(s0 >> 8) & 0xFF] << 8) | (uint32_t) Sbox[s1 & 0xFF];                                 \
+        t3 = ((uint32_t) Sbox[s3 >> 24] << 24) | ((uint32_t) Sbox[(s0 >> 16) & 0xFF] << 16) |                       \
+             ((uint32_t) Sbox[(s1 >> 8) & 0xFF] << 8) | (uint32_t) Sbox[s2 & 0xFF];
+#define TABLE_DECRYPT_LAST()                                                                                        \
+        t0 = ((uint32_t) invSbox[s0 >> 24] << 24) | ((uint32_t) invSbox[(s3 >> 16) & 0xFF] << 16) |                 \
+             ((uint32_t) invSbox[(s2 >> 8) & 0xFF] << 8) | (uint32_t) invSbox[s1 & 0xFF];                           \
+        t1 = ((uint32_t) invSbox[s1 >> 24] << 24) | ((uint32_t) invSbox[(s0 >> 16) & 0xFF] << 16) |                 \
+             ((uint32_t) invSbox[(s3 >> 8) & 0xFF] << 8) | (uint32_t) invSbox[s2 & 0xFF];                           \
+        t2 = ((uint32_t) invSbox[s2 >> 24] << 24) | ((uint32_t) invSbox[(s1 >> 16) & 0xFF] << 16) |                 \
+             ((uint32_t) invSbox[(s0 >> 8) & 0xFF] << 8) | (uint32_t) invSbox[s3 & 0xFF];                           \
+        t3 = ((uint32_t) invSbox[s3 >> 24] << 24) | ((uint32_t) invSbox[(s2 >> 16) & 0xFF] << 16) |                 \
+             ((uint32_t) invSbox[(s1 >> 8) & 0xFF] << 8) | (uint32_t) invSbox[s0 & 0xFF];
+
+/*
+ * Generates the function for one number of rounds, all rounds are unrolled. The decryption takes the round keys
+ * of the equivalent inverse cipher, so both directions have one shape.
+ */
+#define TABLE_SPECIALIZE(name, rounds, ROUNDS, ROUND, LAST)                                                         \
+static void name(const byte *roundKey, byte *data, size_t blockCount) {                                             \
+    uint32_t rk[(rounds + 1) * 4];                                                                                  \
+                                                                                                                    \
+    for (int i = 0; i < (rounds + 1) * 4; ++i) {                                                                    \
+        rk[i] = GETU32(roundKey + i * 4);                                                                           \
+    }                                                                                                               \
+                                                                                                                    \
+    for (size_t block = 0; block < blockCount; ++block) {                                                           \
+        byte *ptr = data + block * AES_BLOCK_SIZE;                                                                  \
+        uint32_t s0 = GETU32(ptr) ^ rk[0];                                                                          \
+        uint32_t s1 = GETU32(ptr + 4) ^ rk[1];                                                                      \
+        uint32_t s2 = GETU32(ptr + 8) ^ rk[2];                                                                      \
+        uint32_t s3 = GETU32(ptr + 12) ^ rk[3];                                                                     \
+        uint32_t t0, t1, t2, t3;                                                                                    \
+                                                                                                                    \
+        ROUNDS(ROUND)                                                                                               \
+        LAST()                                                                                                      \
+        PUTU32(ptr, t0 ^ rk[(rounds) * 4]);                                                                         \
+        PUTU32(ptr + 4, t1 ^ rk[(rounds) * 4 + 1]);                                                                 \
+        PUTU32(ptr + 8, t2 ^ rk[(rounds) * 4 + 2]);                                                                 \
+        PUTU32(ptr + 12, t3 ^ rk[(rounds) * 4 + 3]);                                                                \
+    }                                                                                                               \
+}
+
+TABLE_SPECIALIZE(tableEncrypt128, ROUND_AES_128, ROUNDS_AES_128, TABLE_ENCRYPT_ROUND, TABLE_ENCRYPT_LAST)
+TABLE_SPECIALIZE(tableEncrypt192, ROUND_AES_192, ROUNDS_AES_192, TABLE_ENCRYPT_ROUND, TABLE_ENCRYPT_LAST)
+TABLE_SPECIALIZE(tableEncrypt256, ROUND_AES_256, ROUNDS_AES_256, TABLE_ENCRYPT_ROUND, TABLE_ENCRYPT_LAST)
+TABLE_SPECIALIZE(tableDecrypt128, ROUND_AES_128, ROUNDS_AES_128, TABLE_DECRYPT_ROUND, TABLE_DECRYPT_LAST)
+TABLE_SPECIALIZE(tableDecrypt192, ROUND_AES_192, ROUNDS_AES_192, TABLE_DECRYPT_ROUND, TABLE_DECRYPT_LAST)
+TABLE_SPECIALIZE(tableDecrypt256, ROUND_AES_256, ROUNDS_AES_256, TABLE_DECRYPT_ROUND, TABLE_DECRYPT_LAST)
+
+DISPATCH_ROUNDS(tableEncryptBlocks, tableEncrypt)
+DISPATCH_ROUNDS(tableDecryptBlocks, tableDecrypt)
+
+
+const EngineAES tableEngineAES = {
+        "t-table",
+        0,
+        tableInit,
+        tableEncryptBlocks,
+        tableDecryptBlocks,
+        NULL
+};
@@ -1,8 +1,890 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "AES.h"
 
+// the engines that the known answers are checked with, the ones that the processor does not support are skipped;
+// the reference engine is always available and goes first, the long messages of the others are compared with it
+static lpcstr engines[] = {"reference", "t-table", "bitslice", "ssse3-vperm", "aes-ni", "vaes-256", "vaes-512"};
+
+
+static int checkVector(lpcstr name, const byte *result, const byte *expected, size_t size) {
+    int failed = memcmp(result, expected, size) != 0;
+
+    printf("    %s: %s\n", name, failed ? "FAILED" : "OK");
+    return failed;
+}
+
+
+/**
+ * GCM test case 4 of the specification (AES-128, AAD and a partial last block), and a long message that goes
+ * through the stitched GHASH, compared with the result of the reference engine.
+ */
+static int checkGcm(byte *longData, byte *longTag, int reference) {
+    byte key[KEY_AES_128] = {0xfe, 0xff, 0xe9, 0x92, 0x86, 0x65, 0x73, 0x1c,
+                             0x6d, 0x6a, 0x8f, 0x94, 0x67, 0x30, 0x83, 0x08};
+    byte iv[GCM_IV_SIZE] = {0xca, 0xfe, 0xba, 0xbe, 0xfa, 0xce, 0xdb, 0xad, 0xde, 0xca, 0xf8, 0x88};
+    byte aad[20] = {0xfe, 0xed, 0xfa, 0xce, 0xde, 0xad, 0xbe, 0xef, 0xfe, 0xed, 0xfa, 0xce, 0xde, 0xad, 0xbe, 0xef,
+                    0xab, 0xad, 0xda, 0xd2};
+    byte plain[60] = {0xd9, 0x31, 0x32, 0x25, 0xf8, 0x84, 0x06, 0xe5, 0xa5, 0x59, 0x09, 0xc5, 0xaf, 0xf5, 0x26, 0x9a,
+                      0x86, 0xa7, 0xa9, 0x53, 0x15, 0x34, 0xf7, 0xda, 0x2e, 0x4c, 0x30, 0x3d, 0x8a, 0x31, 0x8a, 0x72,
+                      0x1c, 0x3c, 0x0c, 0x95, 0x95, 0x68, 0x09, 0x53, 0x2f, 0xcf, 0x0e, 0x24, 0x49, 0xa6, 0xb5, 0x25,
+                      0xb1, 0x6a, 0xed, 0xf5, 0xaa, 0x0d, 0xe6, 0x57, 0xba, 0x63, 0x7b, 0x39};
+    byte cipher[60] = {0x42, 0x83, 0x1e, 0xc2, 0x21, 0x77, 0x74, 0x24, 0x4b, 0x72, 0x21, 0xb7, 0x84, 0xd0, 0xd4, 0x9c,
+                       0xe3, 0xaa, 0x21, 0x2f, 0x2c, 0x02, 0xa4, 0xe0, 0x35, 0xc1, 0x7e, 0x23, 0x29, 0xac, 0xa1, 0x2e,
+                       0x21, 0xd5, 0x14, 0xb2, 0x54, 0x66, 0x93, 0x1c, 0x7d, 0x8f, 0x6a, 0x5a, 0xac, 0x84, 0xaa, 0x05,
+                       0x1b, 0xa3, 0x0b, 0x39, 0x6a, 0x0a, 0xac, 0x97, 0x3d, 0x58, 0xe0, 0x91};
+    byte expectedTag[GCM_TAG_SIZE] = {0x5b, 0xc9, 0x4f, 0xbc, 0x32, 0x21, 0xa5, 0xdb,
+                                      0x94, 0xfa, 0xe9, 0x5a, 0xe7, 0x12, 0x1a, 0x47};
+    byte data[1000];
+    byte tag[GCM_TAG_SIZE];
+    ContextAES context;
+    int failed;
+
+    initContextAES(&context, key, AES_128);
+    memcpy(data, plain, sizeof(plain));
+    encryptGcmAES(&context, iv, aad, sizeof(aad), data, sizeof(plain), tag, GCM_TAG_SIZE);
+    failed = checkVector("GCM encryption", data, cipher, sizeof(cipher));
+    failed |= checkVector("GCM tag", tag, expectedTag, GCM_TAG_SIZE);
+    failed |= decryptGcmAES(&context, iv, aad, sizeof(aad), data, sizeof(cipher), tag, GCM_TAG_SIZE);
+    failed |= checkVector("GCM decryption", data, plain, sizeof(plain));
+
+    for (size_t i = 0; i < sizeof(data); ++i) {
+        data[i] = (byte) i;
+    }
+    encryptGcmAES(&context, iv, aad, sizeof(aad), data, sizeof(data), tag, GCM_TAG_SIZE);
+    if (reference) {
+        memcpy(longData, data, sizeof(data));
+        memcpy(longTag, tag, GCM_TAG_SIZE);
+    }
+    failed |= checkVector("GCM long message", data, longData, sizeof(data));
+    failed |= checkVector("GCM long message tag", tag, longTag, GCM_TAG_SIZE);
+
+    freeContextAES(&context);
+    return failed;
+}
+
+
+/**
+ * XTS vectors 2 and 15 of IEEE 1619: whole blocks, and 17 bytes with ciphertext stealing.
+ */
+static int checkXts(void) {
+    byte key[2 * KEY_AES_128];
+    byte tweak[IV_SIZE] = {0x33, 0x33, 0x33, 0x33, 0x33};
+    byte plain[32];
+    byte cipher[32] = {0xc4, 0x54, 0x18, 0x5e, 0x6a, 0x16, 0x93, 0x6e, 0x39, 0x33, 0x40, 0x38, 0xac, 0xef, 0x83, 0x8b,
+                       0xfb, 0x18, 0x6f, 0xff, 0x74, 0x80, 0xad, 0xc4, 0x28, 0x93, 0x82, 0xec, 0xd6, 0xd3, 0x94, 0xf0};
+    byte stealKey[2 * KEY_AES_128] = {0xff, 0xfe, 0xfd, 0xfc, 0xfb, 0xfa, 0xf9, 0xf8,
+                                      0xf7, 0xf6, 0xf5, 0xf4, 0xf3, 0xf2, 0xf1, 0xf0,
+                                      0xbf, 0xbe, 0xbd, 0xbc, 0xbb, 0xba, 0xb9, 0xb8,
+                                      0xb7, 0xb6, 0xb5, 0xb4, 0xb3, 0xb2, 0xb1, 0xb0};
+    byte stealTweak[IV_SIZE] = {0x9a, 0x78, 0x56, 0x34, 0x12};
+    byte stealPlain[17] = {0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08,
+                           0x09, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e, 0x0f, 0x10};
+    byte stealCipher[17] = {0x6c, 0x16, 0x25, 0xdb, 0x46, 0x71, 0x52, 0x2d, 0x3d,
+                            0x75, 0x99, 0x60, 0x1d, 0xe7, 0xca, 0x09, 0xed};
+    byte data[32];
+    ContextXtsAES context;
+    int failed;
+
+    memset(key, 0x11, KEY_AES_128);
+    memset(key + KEY_AES_128, 0x22, KEY_AES_128);
+    memset(plain, 0x44, sizeof(plain));
+
+    initXtsAES(&context, key, AES_128);
+    memcpy(data, plain, sizeof(plain));
+    encryptXtsAES(&context, tweak, data, sizeof(plain));
+    failed = checkVector("XTS encryption", data, cipher, sizeof(cipher));
+    decryptXtsAES(&context, tweak, data, sizeof(cipher));
+    failed |= checkVector("XTS decryption", data, plain, sizeof(plain));
+    // the same data unit as sector 0x3333333333 of 32 bytes
+    memcpy(data, plain, sizeof(plain));
+    encryptSectorsXtsAES(&context, 0x3333333333, data, sizeof(plain), 1);
+    failed |= checkVector("XTS sectors", data, cipher, sizeof(cipher));
+    freeXtsAES(&context);
+
+    initXtsAES(&context, stealKey, AES_128);
+    memcpy(data, stealPlain, sizeof(stealPlain));
+    encryptXtsAES(&context, stealTweak, data, sizeof(stealPlain));
+    failed |= checkVector("XTS ciphertext stealing", data, stealCipher, sizeof(stealCipher));
+    decryptXtsAES(&context, stealTweak, data, sizeof(stealCipher));
+    failed |= checkVector("XTS ciphertext stealing decryption", data, stealPlain, sizeof(stealPlain));
+    freeXtsAES(&context);
+    return failed;
+}
+
+
+/**
+ * AES-KW of RFC 3394 (section 4.1) and both AES-KWP examples of RFC 5649, wrapped and unwrapped.
+ */
+static int checkKeyWrap(void) {
+    byte kek[KEY_AES_128] = {0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07,
+                             0x08, 0x09, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e, 0x0f};
+    byte key[16] = {0x00, 0x11, 0x22, 0x33, 0x44, 0x55, 0x66, 0x77, 0x88, 0x99, 0xaa, 0xbb, 0xcc, 0xdd, 0xee, 0xff};
+    byte wrapped[24] = {0x1f, 0xa6, 0x8b, 0x0a, 0x81, 0x12, 0xb4, 0x47, 0xae, 0xf3, 0x4b, 0xd8,
+                        0xfb, 0x5a, 0x7b, 0x82, 0x9d, 0x3e, 0x86, 0x23, 0x71, 0xd2, 0xcf, 0xe5};
+    byte padKek[KEY_AES_192] = {0x58, 0x40, 0xdf, 0x6e, 0x29, 0xb0, 0x2a, 0xf1, 0xab, 0x49, 0x3b, 0x70,
+                                0x5b, 0xf1, 0x6e, 0xa1, 0xae, 0x83, 0x38, 0xf4, 0xdc, 0xc1, 0x76, 0xa8};
+    byte padKey[20] = {0xc3, 0x7b, 0x7e, 0x64, 0x92, 0x58, 0x43, 0x40, 0xbe, 0xd1,
+                       0x22, 0x07, 0x80, 0x89, 0x41, 0x15, 0x50, 0x68, 0xf7, 0x38};
+    byte padWrapped[32] = {0x13, 0x8b, 0xde, 0xaa, 0x9b, 0x8f, 0xa7, 0xfc, 0x61, 0xf9, 0x77, 0x42,
+                           0xe7, 0x22, 0x48, 0xee, 0x5a, 0xe6, 0xae, 0x53, 0x60, 0xd1, 0xae, 0x6a,
+                           0x5f, 0x54, 0xf3, 0x73, 0xfa, 0x54, 0x3b, 0x6a};
+    byte shortKey[7] = {0x46, 0x6f, 0x72, 0x50, 0x61, 0x73, 0x69};
+    byte shortWrapped[16] = {0xaf, 0xbe, 0xb0, 0xf0, 0x7d, 0xfb, 0xf5, 0x41,
+                             0x92, 0x00, 0xf2, 0xcc, 0xb5, 0x0b, 0xb2, 0x4f};
+    byte data[32];
+    size_t dataSize;
+    ContextAES context;
+    int failed = 0;
+
+    initContextAES(&context, kek, AES_128);
+    dataSize = sizeof(data);
+    failed |= wrapKeyAES(&context, AES_KW, key, sizeof(key), data, &dataSize) || dataSize != sizeof(wrapped);
+    failed |= checkVector("KW wrap", data, wrapped, sizeof(wrapped));
+    dataSize = sizeof(data);
+    failed |= unwrapKeyAES(&context, AES_KW, wrapped, sizeof(wrapped), data, &dataSize) || dataSize != sizeof(key);
+    failed |= checkVector("KW unwrap", data, key, sizeof(key));
+    freeContextAES(&context);
+
+    initContextAES(&context, padKek, AES_192);
+    dataSize = sizeof(data);
+    failed |= wrapKeyAES(&context, AES_KWP, padKey, sizeof(padKey), data, &dataSize) || dataSize != sizeof(padWrapped);
+    failed |= checkVector("KWP wrap", data, padWrapped, sizeof(padWrapped));
+    dataSize = sizeof(data);
+    failed |= unwrapKeyAES(&context, AES_KWP, padWrapped, sizeof(padWrapped), data, &dataSize) ||
+              dataSize != sizeof(padKey);
+    failed |= checkVector("KWP unwrap", data, padKey, sizeof(padKey));
+    // a key of one semiblock is wrapped with a single encryption
+    dataSize = sizeof(data);
+    failed |= wrapKeyAES(&context, AES_KWP, shortKey, sizeof(shortKey), data, &dataSize) ||
+              dataSize != sizeof(shortWrapped);
+    failed |= checkVector("KWP wrap of 7 bytes", data, shortWrapped, sizeof(shortWrapped));
+    dataSize = sizeof(data);
+    failed |= unwrapKeyAES(&context, AES_KWP, shortWrapped, sizeof(shortWrapped), data, &dataSize) ||
+              dataSize != sizeof(shortKey);
+    failed |= checkVector("KWP unwrap of 7 bytes", data, shortKey, sizeof(shortKey));
+    freeContextAES(&context);
+    return failed;
+}
+
+
+
+/**
+ * The examples of FIPS-197 (appendix C.1, C.2 and C.3) for the three key sizes. The block is repeated,
+ * so that the engines also process it many at once.
+ */
+static int checkBlocks(void) {
+    byte plain[AES_BLOCK_SIZE] = {0x00, 0x11, 0x22, 0x33, 0x44, 0x55, 0x66, 0x77,
+                                  0x88, 0x99, 0xaa, 0xbb, 0xcc, 0xdd, 0xee, 0xff};
+    byte cipher[3][AES_BLOCK_SIZE] = {
+            {0x69, 0xc4, 0xe0, 0xd8, 0x6a, 0x7b, 0x04, 0x30, 0xd8, 0xcd, 0xb7, 0x80, 0x70, 0xb4, 0xc5, 0x5a},
+            {0xdd, 0xa9, 0x7c, 0xa4, 0x86, 0x4c, 0xdf, 0xe0, 0x6e, 0xaf, 0x70, 0xa0, 0xec, 0x0d, 0x71, 0x91},
+            {0x8e, 0xa2, 0xb7, 0xca, 0x51, 0x67, 0x45, 0xbf, 0xea, 0xfc, 0x49, 0x90, 0x4b, 0x49, 0x60, 0x89}
+    };
+    VersionAES versions[3] = {AES_128, AES_192, AES_256};
+    lpcstr names[3] = {"FIPS-197 AES-128", "FIPS-197 AES-192", "FIPS-197 AES-256"};
+    byte key[KEY_AES_256];
+    byte data[37 * AES_BLOCK_SIZE];
+    ContextAES context;
+    int failed = 0;
+
+    for (size_t i = 0; i < sizeof(key); ++i) {
+        key[i] = (byte) i;
+    }
+    for (int i = 0; i < 3; ++i) {
+        size_t dataSize = sizeof(data);
+        int wrong = 0;
+
+        initContextAES(&context, key, versions[i]);
+        for (size_t j = 0; j < sizeof(data); j += AES_BLOCK_SIZE) {
+            memcpy(data + j, plain, AES_BLOCK_SIZE);
+        }
+        encryptInPlaceAES(&context, data, &dataSize, sizeof(data), AES_ECB, NULL);
+        for (size_t j = 0; j < sizeof(data); j += AES_BLOCK_SIZE) {
+            wrong |= memcmp(data + j, cipher[i], AES_BLOCK_SIZE) != 0;
+        }
+        decryptInPlaceAES(&context, data, &dataSize, AES_ECB, NULL);
+        for (size_t j = 0; j < sizeof(data); j += AES_BLOCK_SIZE) {
+            wrong |= memcmp(data + j, plain, AES_BLOCK_SIZE) != 0;
+        }
+        printf("    %s: %s\n", names[i], wrong ? "FAILED" : "OK");
+        failed |= wrong;
+        freeContextAES(&context);
+    }
+    return failed;
+}
+
+
+
+/**
+ * CTR-AES128 of SP 800-38A (F.5.1), and a counter that wraps from ff...ff to 0 in the middle of a long call,
+ * compared with the counter blocks encrypted one by one.
+ */
+static int checkCtr(void) {
+    byte key[KEY_AES_128] = {0x2b, 0x7e, 0x15, 0x16, 0x28, 0xae, 0xd2, 0xa6,
+                             0xab, 0xf7, 0x15, 0x88, 0x09, 0xcf, 0x4f, 0x3c};
+    byte counter[IV_SIZE] = {0xf0, 0xf1, 0xf2, 0xf3, 0xf4, 0xf5, 0xf6, 0xf7,
+                             0xf8, 0xf9, 0xfa, 0xfb, 0xfc, 0xfd, 0xfe, 0xff};
+    byte plain[64] = {0x6b, 0xc1, 0xbe, 0xe2, 0x2e, 0x40, 0x9f, 0x96, 0xe9, 0x3d, 0x7e, 0x11, 0x73, 0x93, 0x17, 0x2a,
+                      0xae, 0x2d, 0x8a, 0x57, 0x1e, 0x03, 0xac, 0x9c, 0x9e, 0xb7, 0x6f, 0xac, 0x45, 0xaf, 0x8e, 0x51,
+                      0x30, 0xc8, 0x1c, 0x46, 0xa3, 0x5c, 0xe4, 0x11, 0xe5, 0xfb, 0xc1, 0x19, 0x1a, 0x0a, 0x52, 0xef,
+                      0xf6, 0x9f, 0x24, 0x45, 0xdf, 0x4f, 0x9b, 0x17, 0xad, 0x2b, 0x41, 0x7b, 0xe6, 0x6c, 0x37, 0x10};
+    byte cipher[64] = {0x87, 0x4d, 0x61, 0x91, 0xb6, 0x20, 0xe3, 0x26, 0x1b, 0xef, 0x68, 0x64, 0x99, 0x0d, 0xb6, 0xce,
+                       0x98, 0x06, 0xf6, 0x6b, 0x79, 0x70, 0xfd, 0xff, 0x86, 0x17, 0x18, 0x7b, 0xb9, 0xff, 0xfd, 0xff,
+                       0x5a, 0xe4, 0xdf, 0x3e, 0xdb, 0xd5, 0xd3, 0x5e, 0x5b, 0x4f, 0x09, 0x02, 0x0d, 0xb0, 0x3e, 0xab,
+                       0x1e, 0x03, 0x1d, 0xda, 0x2f, 0xbe, 0x03, 0xd1, 0x79, 0x21, 0x70, 0xa0, 0xf3, 0x00, 0x9c, 0xee};
+    byte wrapped[IV_SIZE] = {0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0x03};
+    byte data[100 * AES_BLOCK_SIZE];
+    byte stream[100 * AES_BLOCK_SIZE];
+    size_t streamSize = sizeof(stream);
+    ContextAES context;
+    int failed;
+
+    initContextAES(&context, key, AES_128);
+    memcpy(data, plain, sizeof(plain));
+    cryptContextAES_CTR(&context, data, sizeof(plain), counter);
+    failed = checkVector("CTR encryption", data, cipher, sizeof(cipher));
+
+    memset(counter, 0xff, IV_SIZE);
+    memset(data, 0, 4 * AES_BLOCK_SIZE);
+    cryptContextAES_CTR(&context, data, 4 * AES_BLOCK_SIZE, counter);
+    failed |= checkVector("CTR counter after the wrap", counter, wrapped, IV_SIZE);
+
+    // the counter wraps after 40 blocks, the keystream is the counter blocks encrypted in ECB
+    memset(counter, 0xff, IV_SIZE);
+    counter[IV_SIZE - 1] = 0xd8;
+    for (size_t i = 0; i < sizeof(stream); i += AES_BLOCK_SIZE) {
+        byte value = (byte) (0xd8 + i / AES_BLOCK_SIZE);
+
+        memset(stream + i, value < 0xd8 ? 0x00 : 0xff, IV_SIZE - 1);
+        stream[i + IV_SIZE - 1] = value;
+    }
+    encryptInPlaceAES(&context, stream, &streamSize, sizeof(stream), AES_ECB, NULL);
+    memset(data, 0, sizeof(data));
+    cryptContextAES_CTR(&context, data, sizeof(data), counter);
+    failed |= checkVector("CTR long keystream", data, stream, sizeof(data));
+
+    freeContextAES(&context);
+    return failed;
+}
+
+
+
+/**
+ * CBC decryption of 37 blocks, not a multiple of the groups of the parallel engines, in place and into
+ * another buffer. CBC encryption is serial, so it gives the expected plaintext back.
+ */
+static int checkCbc(void) {
+    byte key[KEY_AES_256];
+    byte iv[IV_SIZE];
+    byte plain[37 * AES_BLOCK_SIZE];
+    byte data[37 * AES_BLOCK_SIZE];
+    byte output[37 * AES_BLOCK_SIZE];
+    size_t dataSize = sizeof(data);
+    size_t outputSize = sizeof(output);
+    ContextAES context;
+    int failed;
+
+    for (size_t i = 0; i < sizeof(key); ++i) {
+        key[i] = (byte) (i * 3);
+    }
+    for (size_t i = 0; i < IV_SIZE; ++i) {
+        iv[i] = (byte) (0xa0 + i);
+    }
+    // the last byte is not a padding value, so the size does not change
+    for (size_t i = 0; i < sizeof(plain); ++i) {
+        plain[i] = (byte) (i * 7 + 0x40);
+    }
+
+    initContextAES(&context, key, AES_256);
+    memcpy(data, plain, sizeof(plain));
+    encryptInPlaceAES(&context, data, &dataSize, sizeof(data), AES_CBC, iv);
+    failed = decryptIntoAES(&context, data, dataSize, output, &outputSize, AES_CBC, iv) ||
+             outputSize != sizeof(plain);
+    failed |= checkVector("CBC decryption into a buffer", output, plain, sizeof(plain));
+    failed |= decryptInPlaceAES(&context, data, &dataSize, AES_CBC, iv) || dataSize != sizeof(plain);
+    failed |= checkVector("CBC decryption in place", data, plain, sizeof(plain));
+    freeContextAES(&context);
+    return failed;
+}
+
+
+
+/**
+ * Twelve CBC streams of 16 and 48 bytes with keys of the three sizes, more streams than the lanes of one step,
+ * compared with each stream encrypted alone. The IV of each stream returns its last ciphertext block.
+ */
+static int checkMulti(void) {
+    VersionAES versions[3] = {AES_128, AES_192, AES_256};
+    ContextAES context[3];
+    JobAES jobs[12];
+    byte data[12][48];
+    byte expected[12][48];
+    byte iv[12][IV_SIZE];
+    byte key[KEY_AES_256];
+    int failed = 0;
+
+    for (size_t i = 0; i < sizeof(key); ++i) {
+        key[i] = (byte) (0x80 + i);
+    }
+    for (int i = 0; i < 3; ++i) {
+        initContextAES(&context[i], key, versions[i]);
+    }
+    for (int i = 0; i < 12; ++i) {
+        size_t dataSize = i % 2 ? 48 : 16;
+
+        for (size_t j = 0; j < sizeof(data[i]); ++j) {
+            data[i][j] = (byte) (i * 16 + j);
+        }
+        memset(iv[i], i, IV_SIZE);
+        memcpy(expected[i], data[i], dataSize);
+        encryptInPlaceAES(&context[i % 3], expected[i], &dataSize, dataSize, AES_CBC, iv[i]);
+        jobs[i].context = &context[i % 3];
+        jobs[i].data = data[i];
+        jobs[i].dataSize = dataSize;
+        jobs[i].iv = iv[i];
+    }
+
+    failed |= encryptMultiAES_CBC(jobs, 12);
+    for (int i = 0; i < 12; ++i) {
+        failed |= memcmp(data[i], expected[i], jobs[i].dataSize) != 0;
+        failed |= memcmp(iv[i], expected[i] + jobs[i].dataSize - AES_BLOCK_SIZE, IV_SIZE) != 0;
+    }
+    printf("    CBC of many streams: %s\n", failed ? "FAILED" : "OK");
+
+    for (int i = 0; i < 3; ++i) {
+        freeContextAES(&context[i]);
+    }
+    return failed;
+}
+
+
+
+/**
+ * CFB-128 and OFB of SP 800-38A (F.3.13 and F.4.1), and streams in parts of 5, 30, 29 and 1200 bytes,
+ * compared with one call. The large parts go through the keystream ring of OFB and the parallel CFB decryption.
+ */
+static int checkStream(void) {
+    byte key[KEY_AES_128] = {0x2b, 0x7e, 0x15, 0x16, 0x28, 0xae, 0xd2, 0xa6,
+                             0xab, 0xf7, 0x15, 0x88, 0x09, 0xcf, 0x4f, 0x3c};
+    byte iv[IV_SIZE] = {0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07,
+                        0x08, 0x09, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e, 0x0f};
+    byte plain[64] = {0x6b, 0xc1, 0xbe, 0xe2, 0x2e, 0x40, 0x9f, 0x96, 0xe9, 0x3d, 0x7e, 0x11, 0x73, 0x93, 0x17, 0x2a,
+                      0xae, 0x2d, 0x8a, 0x57, 0x1e, 0x03, 0xac, 0x9c, 0x9e, 0xb7, 0x6f, 0xac, 0x45, 0xaf, 0x8e, 0x51,
+                      0x30, 0xc8, 0x1c, 0x46, 0xa3, 0x5c, 0xe4, 0x11, 0xe5, 0xfb, 0xc1, 0x19, 0x1a, 0x0a, 0x52, 0xef,
+                      0xf6, 0x9f, 0x24, 0x45, 0xdf, 0x4f, 0x9b, 0x17, 0xad, 0x2b, 0x41, 0x7b, 0xe6, 0x6c, 0x37, 0x10};
+    byte cfb[64] = {0x3b, 0x3f, 0xd9, 0x2e, 0xb7, 0x2d, 0xad, 0x20, 0x33, 0x34, 0x49, 0xf8, 0xe8, 0x3c, 0xfb, 0x4a,
+                    0xc8, 0xa6, 0x45, 0x37, 0xa0, 0xb3, 0xa9, 0x3f, 0xcd, 0xe3, 0xcd, 0xad, 0x9f, 0x1c, 0xe5, 0x8b,
+                    0x26, 0x75, 0x1f, 0x67, 0xa3, 0xcb, 0xb1, 0x40, 0xb1, 0x80, 0x8c, 0xf1, 0x87, 0xa4, 0xf4, 0xdf,
+                    0xc0, 0x4b, 0x05, 0x35, 0x7c, 0x5d, 0x1c, 0x0e, 0xea, 0xc4, 0xc6, 0x6f, 0x9f, 0xf7, 0xf2, 0xe6};
+    byte ofb[64] = {0x3b, 0x3f, 0xd9, 0x2e, 0xb7, 0x2d, 0xad, 0x20, 0x33, 0x34, 0x49, 0xf8, 0xe8, 0x3c, 0xfb, 0x4a,
+                    0x77, 0x89, 0x50, 0x8d, 0x16, 0x91, 0x8f, 0x03, 0xf5, 0x3c, 0x52, 0xda, 0xc5, 0x4e, 0xd8, 0x25,
+                    0x97, 0x40, 0x05, 0x1e, 0x9c, 0x5f, 0xec, 0xf6, 0x43, 0x44, 0xf7, 0xa8, 0x22, 0x60, 0xed, 0xcc,
+                    0x30, 0x4c, 0x65, 0x28, 0xf6, 0x59, 0xc7, 0x78, 0x66, 0xa5, 0x10, 0xd9, 0xc1, 0xd6, 0xae, 0x5e};
+    size_t parts[4] = {5, 30, 29, 1200};
+    ModeAES modes[2] = {AES_CFB, AES_OFB};
+    lpcstr names[2] = {"CFB stream in parts", "OFB stream in parts"};
+    byte message[3000];
+    byte whole[3000];
+    byte data[3000];
+    byte chain[IV_SIZE];
+    StreamAES stream;
+    ContextAES context;
+    int failed;
+
+    initContextAES(&context, key, AES_128);
+    memcpy(data, plain, sizeof(plain));
+    memcpy(chain, iv, IV_SIZE);
+    encryptContextAES_CFB(&context, data, sizeof(plain), chain);
+    failed = checkVector("CFB encryption", data, cfb, sizeof(cfb));
+    memcpy(chain, iv, IV_SIZE);
+    decryptContextAES_CFB(&context, data, sizeof(cfb), chain);
+    failed |= checkVector("CFB decryption", data, plain, sizeof(plain));
+    memcpy(data, plain, sizeof(plain));
+    memcpy(chain, iv, IV_SIZE);
+    cryptContextAES_OFB(&context, data, sizeof(plain), chain);
+    failed |= checkVector("OFB encryption", data, ofb, sizeof(ofb));
+    memcpy(chain, iv, IV_SIZE);
+    cryptContextAES_OFB(&context, data, sizeof(ofb), chain);
+    failed |= checkVector("OFB decryption", data, plain, sizeof(plain));
+
+    for (size_t i = 0; i < sizeof(message); ++i) {
+        message[i] = (byte) (i * 13);
+    }
+    for (int m = 0; m < 2; ++m) {
+        int wrong = 0;
+
+        memcpy(whole, message, sizeof(message));
+        memcpy(chain, iv, IV_SIZE);
+        if (modes[m] == AES_CFB) {
+            encryptContextAES_CFB(&context, whole, sizeof(message), chain);
+        } else {
+            cryptContextAES_OFB(&context, whole, sizeof(message), chain);
+        }
+
+        memcpy(data, message, sizeof(message));
+        initStreamAES(&stream, &context, modes[m], iv);
+        for (size_t done = 0, i = 0; done < sizeof(message); ++i) {
+            size_t size = parts[i % 4] < sizeof(message) - done ? parts[i % 4] : sizeof(message) - done;
+
+            if (modes[m] == AES_OFB && i % 4 == 2) {
+                fillStreamAES(&stream);
+            }
+            encryptStreamAES(&stream, data + done, size);
+            done += size;
+        }
+        wrong |= memcmp(data, whole, sizeof(message)) != 0;
+
+        initStreamAES(&stream, &context, modes[m], iv);
+        for (size_t done = 0, i = 0; done < sizeof(message); ++i) {
+            size_t size = parts[i % 4] < sizeof(message) - done ? parts[i % 4] : sizeof(message) - done;
+
+            decryptStreamAES(&stream, data + done, size);
+            done += size;
+        }
+        wrong |= memcmp(data, message, sizeof(message)) != 0;
+        printf("    %s: %s\n", names[m], wrong ? "FAILED" : "OK");
+        failed |= wrong;
+    }
+
+    freeContextAES(&context);
+    return failed;
+}
+
+
+
+/**
+ * CMAC of RFC 4493 (0, 16, 40 and 64 bytes) one by one and in a batch, and the PMAC reference vectors
+ * (0, 3, 16, 20, 32 and 34 bytes of 00 01 02 ..., and 1000 zero bytes).
+ */
+static int checkMac(void) {
+    byte key[KEY_AES_128] = {0x2b, 0x7e, 0x15, 0x16, 0x28, 0xae, 0xd2, 0xa6,
+                             0xab, 0xf7, 0x15, 0x88, 0x09, 0xcf, 0x4f, 0x3c};
+    byte message[64] = {0x6b, 0xc1, 0xbe, 0xe2, 0x2e, 0x40, 0x9f, 0x96, 0xe9, 0x3d, 0x7e, 0x11, 0x73, 0x93, 0x17, 0x2a,
+                        0xae, 0x2d, 0x8a, 0x57, 0x1e, 0x03, 0xac, 0x9c, 0x9e, 0xb7, 0x6f, 0xac, 0x45, 0xaf, 0x8e, 0x51,
+                        0x30, 0xc8, 0x1c, 0x46, 0xa3, 0x5c, 0xe4, 0x11, 0xe5, 0xfb, 0xc1, 0x19, 0x1a, 0x0a, 0x52, 0xef,
+                        0xf6, 0x9f, 0x24, 0x45, 0xdf, 0x4f, 0x9b, 0x17, 0xad, 0x2b, 0x41, 0x7b, 0xe6, 0x6c, 0x37, 0x10};
+    byte cmac[4][MAC_SIZE] = {
+            {0xbb, 0x1d, 0x69, 0x29, 0xe9, 0x59, 0x37, 0x28, 0x7f, 0xa3, 0x7d, 0x12, 0x9b, 0x75, 0x67, 0x46},
+            {0x07, 0x0a, 0x16, 0xb4, 0x6b, 0x4d, 0x41, 0x44, 0xf7, 0x9b, 0xdd, 0x9d, 0xd0, 0x4a, 0x28, 0x7c},
+            {0xdf, 0xa6, 0x67, 0x47, 0xde, 0x9a, 0xe6, 0x30, 0x30, 0xca, 0x32, 0x61, 0x14, 0x97, 0xc8, 0x27},
+            {0x51, 0xf0, 0xbe, 0xbf, 0x7e, 0x3b, 0x9d, 0x92, 0xfc, 0x49, 0x74, 0x17, 0x79, 0x36, 0x3c, 0xfe}
+    };
+    byte pmac[7][MAC_SIZE] = {
+            {0x43, 0x99, 0x57, 0x2c, 0xd6, 0xea, 0x53, 0x41, 0xb8, 0xd3, 0x58, 0x76, 0xa7, 0x09, 0x8a, 0xf7},
+            {0x25, 0x6b, 0xa5, 0x19, 0x3c, 0x1b, 0x99, 0x1b, 0x4d, 0xf0, 0xc5, 0x1f, 0x38, 0x8a, 0x9e, 0x27},
+            {0xeb, 0xbd, 0x82, 0x2f, 0xa4, 0x58, 0xda, 0xf6, 0xdf, 0xda, 0xd7, 0xc2, 0x7d, 0xa7, 0x63, 0x38},
+            {0x04, 0x12, 0xca, 0x15, 0x0b, 0xbf, 0x79, 0x05, 0x8d, 0x8c, 0x75, 0xa5, 0x8c, 0x99, 0x3f, 0x55},
+            {0xe9, 0x7a, 0xc0, 0x4e, 0x9e, 0x5e, 0x33, 0x99, 0xce, 0x53, 0x55, 0xcd, 0x74, 0x07, 0xbc, 0x75},
+            {0x5c, 0xba, 0x7d, 0x5e, 0xb2, 0x4f, 0x7c, 0x86, 0xcc, 0xc5, 0x46, 0x04, 0xe5, 0x3d, 0x55, 0x12},
+            {0xc2, 0xc9, 0xfa, 0x1d, 0x99, 0x85, 0xf6, 0xf0, 0xd2, 0xaf, 0xf9, 0x15, 0xa0, 0xe8, 0xd9, 0x10}
+    };
+    size_t cmacSize[4] = {0, 16, 40, 64};
+    size_t pmacSize[6] = {0, 3, 16, 20, 32, 34};
+    const byte *batch[4] = {message, message, message, message};
+    byte counting[34];
+    byte zeros[1000] = {0};
+    byte mac[4 * MAC_SIZE];
+    ContextAES context;
+    int failed = 0;
+
+    initContextAES(&context, key, AES_128);
+    for (int i = 0; i < 4; ++i) {
+        cmacContextAES(&context, message, cmacSize[i], mac);
+        failed |= checkVector("CMAC", mac, cmac[i], MAC_SIZE);
+    }
+    cmacBatchContextAES(&context, batch, cmacSize, 4, mac);
+    for (int i = 0; i < 4; ++i) {
+        failed |= checkVector("CMAC in a batch", mac + i * MAC_SIZE, cmac[i], MAC_SIZE);
+    }
+    freeContextAES(&context);
+
+    for (size_t i = 0; i < sizeof(key); ++i) {
+        key[i] = (byte) i;
+    }
+    for (size_t i = 0; i < sizeof(counting); ++i) {
+        counting[i] = (byte) i;
+    }
+    initContextAES(&context, key, AES_128);
+    for (int i = 0; i < 6; ++i) {
+        pmacContextAES(&context, counting, pmacSize[i], mac);
+        failed |= checkVector("PMAC", mac, pmac[i], MAC_SIZE);
+    }
+    pmacContextAES(&context, zeros, sizeof(zeros), mac);
+    failed |= checkVector("PMAC of 1000 bytes", mac, pmac[6], MAC_SIZE);
+    freeContextAES(&context);
+    return failed;
+}
+
+
+
+/**
+ * Runs the incremental cipher over the data in parts of 1, 4, 13, 37 and 100 bytes, returns the size of the result.
+ * Returns 0 with *failed set if a call fails.
+ */
+static size_t cipherParts(const ContextAES *context, ModeAES mode, int decrypt, const byte *iv,
+                          const byte *data, size_t dataSize, byte *output, int *failed) {
+    size_t parts[5] = {1, 4, 13, 37, 100};
+    size_t done = 0, outputDone = 0, size;
+    CipherAES cipher;
+
+    *failed = initCipherAES(&cipher, context, mode, decrypt, iv);
+    for (size_t i = 0; done < dataSize && !*failed; ++i) {
+        size_t part = parts[i % 5] < dataSize - done ? parts[i % 5] : dataSize - done;
+
+        size = part + AES_BLOCK_SIZE;
+        *failed = updateCipherAES(&cipher, data + done, part, output + outputDone, &size);
+        done += part;
+        outputDone += size;
+    }
+    size = 2 * AES_BLOCK_SIZE;
+    *failed = *failed || finalCipherAES(&cipher, output + outputDone, &size);
+    return *failed ? 0 : outputDone + size;
+}
+
+
+/**
+ * The incremental cipher in every mode over 1000 bytes (not a multiple of a block) in uneven parts, compared with
+ * encryptIntoAES and decryptIntoAES. A changed tag of GCM must fail the last call.
+ */
+static int checkCipher(void) {
+    ModeAES modes[6] = {AES_ECB, AES_CBC, AES_CTR, AES_GCM, AES_CFB, AES_OFB};
+    lpcstr names[6] = {"ECB in parts", "CBC in parts", "CTR in parts", "GCM in parts", "CFB in parts", "OFB in parts"};
+    byte key[KEY_AES_192];
+    byte iv[IV_SIZE];
+    byte chain[IV_SIZE];
+    byte message[1000];
+    byte expected[1000 + 2 * AES_BLOCK_SIZE];
+    byte cipherData[1000 + 2 * AES_BLOCK_SIZE];
+    byte plainData[1000 + 2 * AES_BLOCK_SIZE];
+    ContextAES context;
+    int failed = 0;
+
+    for (size_t i = 0; i < sizeof(key); ++i) {
+        key[i] = (byte) (0x30 + i);
+    }
+    for (size_t i = 0; i < IV_SIZE; ++i) {
+        iv[i] = (byte) (0xf0 - i);
+    }
+    for (size_t i = 0; i < sizeof(message); ++i) {
+        message[i] = (byte) (i * 5 + 1);
+    }
+    initContextAES(&context, key, AES_192);
+
+    for (int m = 0; m < 6; ++m) {
+        size_t expectedSize = sizeof(expected);
+        size_t cipherSize, plainSize;
+        int wrong, decryptFailed;
+
+        memcpy(chain, iv, IV_SIZE);
+        encryptIntoAES(&context, message, sizeof(message), expected, &expectedSize, modes[m], chain);
+        cipherSize = cipherParts(&context, modes[m], 0, iv, message, sizeof(message), cipherData, &wrong);
+        wrong |= cipherSize != expectedSize || memcmp(cipherData, expected, expectedSize) != 0;
+
+        plainSize = cipherParts(&context, modes[m], 1, iv, cipherData, cipherSize, plainData, &decryptFailed);
+        wrong |= decryptFailed || plainSize != sizeof(message) || memcmp(plainData, message, sizeof(message)) != 0;
+
+        if (modes[m] == AES_GCM) {
+            int rejected;
+
+            cipherData[cipherSize - 1] ^= 1;
+            cipherParts(&context, modes[m], 1, iv, cipherData, cipherSize, plainData, &rejected);
+            wrong |= !rejected;
+        }
+        printf("    %s: %s\n", names[m], wrong ? "FAILED" : "OK");
+        failed |= wrong;
+    }
+
+    freeContextAES(&context);
+    return failed;
+}
+
+
+/**
+ * ECB encryption and CBC decryption of 8 MiB on the calling thread and on 8 threads of the pool give the same data.
+ */
+static int checkPool(void) {
+    size_t dataSize = 8 * 1024 * 1024;
+    byte *data = malloc(dataSize);
+    byte *expected = malloc(dataSize);
+    byte key[KEY_AES_128] = {0};
+    byte iv[IV_SIZE] = {0};
+    int threadCount = getThreadsAES();
+    ContextAES context;
+    int failed = 0;
+
+    if (data == NULL || expected == NULL) {
+        free(data);
+        free(expected);
+        return 1;
+    }
+    for (size_t i = 0; i < dataSize; ++i) {
+        expected[i] = (byte) (i * 11 + i / 4096);
+    }
+    initContextAES(&context, key, AES_128);
+
+    for (ModeAES mode = AES_ECB; mode <= AES_CBC; ++mode) {
+        size_t size = dataSize;
+        int wrong;
+
+        // the data is encrypted with ECB, and decrypted with CBC
+        setThreadsAES(1, 0);
+        memcpy(data, expected, dataSize);
+        if (mode == AES_ECB) {
+            encryptInPlaceAES(&context, expected, &size, dataSize, mode, NULL);
+        } else {
+            decryptInPlaceAES(&context, expected, &size, mode, iv);
+        }
+
+        setThreadsAES(8, 1 << 20);
+        size = dataSize;
+        if (mode == AES_ECB) {
+            encryptInPlaceAES(&context, data, &size, dataSize, mode, NULL);
+        } else {
+            decryptInPlaceAES(&context, data, &size, mode, iv);
+        }
+        wrong = memcmp(data, expected, size) != 0;
+        printf("    %s on 8 threads: %s\n", mode == AES_ECB ? "ECB encryption" : "CBC decryption",
+               wrong ? "FAILED" : "OK");
+        failed |= wrong;
+    }
+
+    setThreadsAES(threadCount, 0);
+    freeContextAES(&context);
+    free(data);
+    free(expected);
+    return failed;
+}
+
+
+/**
+ * A batch of a small CBC encryption, a large ECB encryption and a large CBC decryption with the grain of 4096 bytes,
+ * compared with the same jobs one by one. The blocks in the statistics of the threads add up to all blocks.
+ */
+static int checkBatch(void) {
+    size_t largeSize = 4 * 1024 * 1024;
+    byte *large = malloc(4 * largeSize);
+    byte small[32], smallExpected[32];
+    byte iv[3][IV_SIZE], expectedIv[3][IV_SIZE];
+    byte key[KEY_AES_256] = {0};
+    int threadCount = getThreadsAES();
+    WorkerStatsAES *stats;
+    BatchJobAES jobs[3];
+    ContextAES context;
+    uint64_t blocks = 0;
+    size_t size;
+    int failed;
+
+    setThreadsAES(4, 1 << 20);
+    stats = calloc((size_t) getThreadsAES(), sizeof(WorkerStatsAES));
+    if (large == NULL || stats == NULL) {
+        free(large);
+        free(stats);
+        setThreadsAES(threadCount, 0);
+        return 1;
+    }
+    initContextAES(&context, key, AES_256);
+    for (size_t i = 0; i < 4 * largeSize; ++i) {
+        large[i] = (byte) (i * 29 + i / 997);
+    }
+    for (size_t i = 0; i < sizeof(small); ++i) {
+        small[i] = (byte) (0x20 + i);
+    }
+    for (int i = 0; i < 3; ++i) {
+        memset(iv[i], 0x10 * i, IV_SIZE);
+    }
+
+    // the expected results in the second half of the buffer
+    memcpy(smallExpected, small, sizeof(small));
+    memcpy(large + 2 * largeSize, large, 2 * largeSize);
+    size = sizeof(small);
+    encryptInPlaceAES(&context, smallExpected, &size, sizeof(small), AES_CBC, iv[0]);
+    memcpy(expectedIv[0], smallExpected + sizeof(small) - AES_BLOCK_SIZE, IV_SIZE);
+    size = largeSize;
+    encryptInPlaceAES(&context, large + 2 * largeSize, &size, largeSize, AES_ECB, NULL);
+    memcpy(expectedIv[2], large + 2 * largeSize - AES_BLOCK_SIZE, IV_SIZE);
+    size = largeSize;
+    decryptInPlaceAES(&context, large + 3 * largeSize, &size, AES_CBC, iv[2]);
+
+    jobs[0] = (BatchJobAES) {&context, AES_CBC, 0, small, sizeof(small), iv[0]};
+    jobs[1] = (BatchJobAES) {&context, AES_ECB, 0, large, largeSize, NULL};
+    jobs[2] = (BatchJobAES) {&context, AES_CBC, 1, large + largeSize, largeSize, iv[2]};
+    failed = cryptBatchAES(jobs, 3, 4096, stats);
+
+    failed |= memcmp(small, smallExpected, sizeof(small)) != 0 || memcmp(iv[0], expectedIv[0], IV_SIZE) != 0;
+    failed |= memcmp(large, large + 2 * largeSize, 2 * largeSize) != 0 || memcmp(iv[2], expectedIv[2], IV_SIZE) != 0;
+    for (int i = 0; i < getThreadsAES(); ++i) {
+        blocks += stats[i].blocks;
+    }
+    failed |= blocks != (sizeof(small) + 2 * largeSize) / AES_BLOCK_SIZE;
+    printf("    batch with work stealing: %s\n", failed ? "FAILED" : "OK");
+
+    setThreadsAES(threadCount, 0);
+    freeContextAES(&context);
+    free(large);
+    free(stats);
+    return failed;
+}
+
+
+/**
+ * A queue of capacity 3 (rounded up to 4): the fifth job is refused until the completions are polled, they come
+ * in order with their userData and size, and freeQueueAES finishes the jobs that are still submitted.
+ */
+static int checkQueue(void) {
+    byte key[KEY_AES_128] = {0};
+    byte iv[IV_SIZE] = {0};
+    byte data[8][48];
+    byte output[8][64];
+    byte expected[8][64];
+    size_t expectedSize[8];
+    CompletionAES completions[8];
+    AsyncJobAES job;
+    ContextAES context;
+    QueueAES *queue;
+    size_t count = 0;
+    int failed = 0;
+
+    initContextAES(&context, key, AES_128);
+    for (int i = 0; i < 8; ++i) {
+        for (size_t j = 0; j < sizeof(data[i]); ++j) {
+            data[i][j] = (byte) (i + j);
+        }
+        expectedSize[i] = sizeof(expected[i]);
+        encryptIntoAES(&context, data[i], 10 + 5 * i, expected[i], &expectedSize[i], AES_CBC, iv);
+    }
+
+    queue = createQueueAES(3);
+    if (queue == NULL) {
+        freeContextAES(&context);
+        return 1;
+    }
+    for (int i = 0; i < 5; ++i) {
+        job = (AsyncJobAES) {&context, AES_CBC, 0, data[i], 10 + 5 * i, output[i], sizeof(output[i]), iv, data[i]};
+        // the fifth job does not fit until the completions are polled
+        failed |= submitQueueAES(queue, &job) != (i == 4);
+    }
+    while (count < 4) {
+        count += pollQueueAES(queue, completions + count, 8 - count);
+    }
+    for (size_t i = 0; i < count; ++i) {
+        failed |= completions[i].userData != data[i] || completions[i].result != 0 ||
+                  completions[i].outputSize != expectedSize[i] ||
+                  memcmp(output[i], expected[i], expectedSize[i]) != 0;
+    }
+
+    // the jobs that are not polled are still processed before the queue is freed
+    memset(output, 0, sizeof(output));
+    for (int i = 4; i < 8; ++i) {
+        job = (AsyncJobAES) {&context, AES_CBC, 0, data[i], 10 + 5 * i, output[i], sizeof(output[i]), iv, data[i]};
+        failed |= submitQueueAES(queue, &job);
+    }
+    freeQueueAES(queue);
+    for (int i = 4; i < 8; ++i) {
+        failed |= memcmp(output[i], expected[i], expectedSize[i]) != 0;
+    }
+    printf("    asynchronous queue: %s\n", failed ? "FAILED" : "OK");
+
+    freeContextAES(&context);
+    return failed;
+}
+
+
+/**
+ * Writes the data to the file, returns 1 if it cannot be written.
+ */
+static int writeFile(lpcstr path, const byte *data, size_t dataSize) {
+    FILE *file = fopen(path, "wb");
+    int failed;
+
+    if (file == NULL) {
+        return 1;
+    }
+    failed = fwrite(data, 1, dataSize, file) != dataSize;
+    return fclose(file) != 0 || failed;
+}
+
+
+/**
+ * Reads the file into the buffer of bufferSize bytes, returns the size of the file or bufferSize + 1 on an error.
+ */
+static size_t readFile(lpcstr path, byte *buffer, size_t bufferSize) {
+    FILE *file = fopen(path, "rb");
+    size_t size;
+
+    if (file == NULL) {
+        return bufferSize + 1;
+    }
+    size = fread(buffer, 1, bufferSize + 1, file);
+    fclose(file);
+    return size;
+}
+
+
+/**
+ * Files of three chunks and 5 bytes in ECB, CBC, CTR, CFB and OFB, through io_uring and through stdio.
+ * The encrypted file is compared with encryptIntoAES, the decrypted file with the data.
+ */
+static int checkFile(void) {
+    // three chunks of fileAES.c and 5 bytes
+    size_t dataSize = 3 * 1024 * 1024 + 5;
+    size_t bufferSize = dataSize + 2 * AES_BLOCK_SIZE;
+    byte *data = malloc(dataSize);
+    byte *expected = malloc(bufferSize);
+    byte *buffer = malloc(bufferSize + 1);
+    ModeAES modes[5] = {AES_ECB, AES_CBC, AES_CTR, AES_CFB, AES_OFB};
+    lpcstr names[5] = {"ECB", "CBC", "CTR", "CFB", "OFB"};
+    byte key[KEY_AES_128] = {0};
+    byte iv[IV_SIZE] = {0};
+    byte chain[IV_SIZE];
+    FileStatsAES stats;
+    ContextAES context;
+    int failed = 0;
+
+    if (data == NULL || expected == NULL || buffer == NULL) {
+        free(data);
+        free(expected);
+        free(buffer);
+        return 1;
+    }
+    for (size_t i = 0; i < dataSize; ++i) {
+        data[i] = (byte) (i * 17 + i / 1000);
+    }
+    failed |= writeFile("testAES.in", data, dataSize);
+    initContextAES(&context, key, AES_128);
+
+    for (int uring = 1; uring >= 0; --uring) {
+        setFileUringAES(uring);
+        for (int m = 0; m < 5; ++m) {
+            size_t expectedSize = bufferSize;
+            int wrong;
+
+            memcpy(chain, iv, IV_SIZE);
+            encryptIntoAES(&context, data, dataSize, expected, &expectedSize, modes[m], chain);
+            wrong = encryptFileAES(&context, "testAES.in", "testAES.enc", modes[m], iv, &stats) ||
+                    (!uring && stats.uring) || readFile("testAES.enc", buffer, bufferSize) != expectedSize ||
+                    memcmp(buffer, expected, expectedSize) != 0;
+            wrong |= decryptFileAES(&context, "testAES.enc", "testAES.dec", modes[m], iv, &stats) ||
+                     readFile("testAES.dec", buffer, bufferSize) != dataSize || memcmp(buffer, data, dataSize) != 0;
+            printf("    %s file through %s: %s\n", names[m], stats.uring ? "io_uring" : "stdio",
+                   wrong ? "FAILED" : "OK");
+            failed |= wrong;
+        }
+    }
+
+    setFileUringAES(1);
+    remove("testAES.in");
+    remove("testAES.enc");
+    remove("testAES.dec");
+    freeContextAES(&context);
+    free(data);
+    free(expected);
+    free(buffer);
+    return failed;
+}
+
 
 int main(void) {
     size_t dataSize = 32;
@@ -37,15 +919,45 @@ int main(void) {
     }
     printf("\n\n");
 
-    CryptData decryptData = decryptAES(encryptData.data, encryptData.dataSize, AES_256, AES_CBC, key, iv);
+    CryptData *decryptData = decryptAES(encryptData.data, encryptData.dataSize, AES_256, AES_CBC, key, iv);
 
     printf("result decrypt:\n");
-    for (size_t i = 1; i < decryptData.dataSize + 1; ++i) {
-        printf("%02X", decryptData.data[i - 1]);
+    for (size_t i = 1; i < decryptData->dataSize + 1; ++i) {
+        printf("%02X", decryptData->data[i - 1]);
         if (i % 16 == 0)
             printf("\n");
     }
     printf("\n\n");
 
-    return 0;
+    // known answers with every engine, so that the hardware paths are checked against the portable ones
+    byte longData[1000];
+    byte longTag[GCM_TAG_SIZE];
+    int failed = 0;
+
+    for (size_t i = 0; i < sizeof(engines) / sizeof(engines[0]); ++i) {
+        if (setEngineAES(engines[i])) {
+            continue;
+        }
+        printf("engine %s:\n", getEngineAES());
+        failed |= checkGcm(longData, longTag, i == 0);
+        failed |= checkXts();
+        failed |= checkKeyWrap();
+        failed |= checkBlocks();
+        failed |= checkCtr();
+        failed |= checkCbc();
+        failed |= checkMulti();
+        failed |= checkStream();
+        failed |= checkMac();
+        failed |= checkCipher();
+    }
+    setEngineAES(NULL);
+
+    // the threads and the files with the automatic engine
+    printf("threads and files:\n");
+    failed |= checkPool();
+    failed |= checkBatch();
+    failed |= checkQueue();
+    failed |= checkFile();
+
+    return failed;
 }
@@ -0,0 +1,348 @@
+/*
+ * AES crypter
+ *
+ * Engine on the SSSE3 vector permutation (PSHUFB), it works in constant time and needs no AES-NI.
+ *
+ * SubBytes is computed in the tower field GF((2^4)^2): a byte is mapped into a pair of nibbles,
+ * inverted there with 16-entry tables (logarithms, squares) that PSHUFB looks up for all 16 bytes
+ * at once, and mapped back together with the affine transformation. ShiftRows and MixColumns are
+ * byte shuffles of the whole block. All tables are built once from the Sbox and invSbox tables.
+ */
+#include "engineAES.h"
+
+#ifdef _HARDWARE_AES
+
+#include <tmmintrin.h>
+
+#ifdef _MSC_VER
+#define TARGET_VPERM
+#else // _MSC_VER
+#define TARGET_VPERM __attribute__((target("ssse3")))
+#endif // _MSC_VER
+
+#define MAX_ROUNDS ROUND_AES_256
+
+// logarithm of zero, chosen so that the sum with any other logarithm keeps the high bit
+// and PSHUFB returns zero for the product
+#define LOG_ZERO 0xE0
+
+enum {
+    // nibble tables of the map from the AES field into the tower field
+    TOWER_LO, TOWER_HI,
+    // the same map for decryption, combined with the inverse affine transformation
+    INV_TOWER_LO, INV_TOWER_HI,
+    // nibble tables of the map back into the AES field, combined with the affine transformation
+    SBOX_LO, SBOX_HI,
+    // the same map for decryption, without the affine transformation
+    INV_SBOX_LO, INV_SBOX_HI,
+    // arithmetic of GF(2^4): logarithm, logarithm of the inverse, exponent, squares
+    NIBBLE_LOG, NIBBLE_LOG_INV, NIBBLE_EXP, NIBBLE_SQUARE, NIBBLE_SQUARE_LAMBDA,
+    // byte shuffles
+    SHIFT_ROWS, INV_SHIFT_ROWS, ROTATE_1, ROTATE_2, ROTATE_3,
+    VPERM_TABLES
+};
+
+static byte vpermTables[VPERM_TABLES][16];
+
+
+/**
+ * Multiplication in GF(2^4) modulo x^4 + x + 1.
+ */
+static byte nibbleMultiply(byte a, byte b) {
+    byte result = 0;
+    for (int i = 0; i < 4; i++) {
+        if (b & 1) {
+            result ^= a;
+        }
+        a = (byte) (((a << 1) ^ ((a & 0x08) ? 0x13 : 0x00)) & 0x0F);
+        b >>= 1;
+    }
+    return result;
+}
+
+
+/**
+ * Multiplication in GF(2^8) of AES modulo x^8 + x^4 + x^3 + x + 1.
+ */
+static byte fieldMultiply(byte a, byte b) {
+    byte result = 0;
+    for (int i = 0; i < 8; i++) {
+        if (b & 1) {
+            result ^= a;
+        }
+        a = (byte) ((a << 1) ^ ((a & 0x80) ? 0x1B : 0x00));
+        b >>= 1;
+    }
+    return result;
+}
+
+
+static byte fieldInverse(byte a) {
+    // a^254 = a^-1, and 0 stays 0
+    byte result = 1;
+    for (int i = 0; i < 254; ++i) {
+        result = fieldMultiply(result, a);
+    }
+    return result;
+}
+
+
+/**
+ * Multiplication in GF((2^4)^2) modulo X^2 + X + lambda, the high nibble is the coefficient of X.
+ */
+static byte towerMultiply(byte a, byte b, byte lambda) {
+    byte ah = a >> 4, al = a & 0x0F, bh = b >> 4, bl = b & 0x0F;
+    byte hh = nibbleMultiply(ah, bh);
+    byte hi = hh ^ nibbleMultiply(ah, bl) ^ nibbleMultiply(al, bh);
+    byte lo = nibbleMultiply(hh, lambda) ^ nibbleMultiply(al, bl);
+
+    return (byte) ((hi << 4) | lo);
+}
+
+
+/**
+ * Splits an affine map of bytes into two tables by nibbles: f(x) = lo[x & 0x0F] ^ hi[x >> 4].
+ */
+static void vpermSplit(const byte *map, byte *lo, byte *hi) {
+    for (int n = 0; n < 16; ++n) {
+        lo[n] = map[n];
+        hi[n] = map[n << 4] ^ map[0];
+    }
+}
+
+
+static void vpermInit(void) {
+    byte lambda = 0, root = 0;
+    byte tower[256], field[256], map[256];
+
+    // X^2 + X + lambda must have no roots in GF(2^4)
+    for (byte l = 1; l < 16 && lambda == 0; ++l) {
+        int roots = 0;
+        for (byte t = 0; t < 16; ++t) {
+            roots |= (nibbleMultiply(t, t) ^ t) == l;
+        }
+        if (!roots) {
+            lambda = l;
+        }
+    }
+
+    // a root of x^8 + x^4 + x^3 + x + 1 in the tower field gives the isomorphism x -> root
+    for (int g = 2; g < 256 && root == 0; ++g) {
+        byte power[9];
+        power[0] = 1;
+        for (int i = 1; i <= 8; ++i) {
+            power[i] = towerMultiply(power[i - 1], (byte) g, lambda);
+        }
+        if ((power[8] ^ power[4] ^ power[3] ^ power[1] ^ power[0]) == 0) {
+            root = (byte) g;
+        }
+    }
+
+    for (int x = 0; x < 256; ++x) {
+        byte value = 0, power = 1;
+        for (int i = 0; i < 8; ++i) {
+            if ((x >> i) & 1) {
+                value ^= power;
+            }
+            power = towerMultiply(power, root, lambda);
+        }
+        tower[x] = value;
+        field[value] = (byte) x;
+    }
+
+    vpermSplit(tower, vpermTables[TOWER_LO], vpermTables[TOWER_HI]);
+    vpermSplit(field, vpermTables[INV_SBOX_LO], vpermTables[INV_SBOX_HI]);
+
+    // S(x) = A(x^-1) + 63, so the map back with the affine transformation is t -> S(inverse of t)
+    for (int t = 0; t < 256; ++t) {
+        map[t] = Sbox[fieldInverse(field[t])];
+    }
+    vpermSplit(map, vpermTables[SBOX_LO], vpermTables[SBOX_HI]);
+
+    // InvS(y) = (A^-1(y + 63))^-1, so the map into the tower field is y -> tower(inverse of InvS(y))
+    for (int y = 0; y < 256; ++y) {
+        map[y] = tower[fieldInverse(invSbox[y])];
+    }
+    vpermSplit(map, vpermTables[INV_TOWER_LO], vpermTables[INV_TOWER_HI]);
+
+    for (int n = 0; n < 16; ++n) {
+        byte square = nibbleMultiply((byte) n, (byte) n);
+
+        vpermTables[NIBBLE_SQUARE][n] = square;
+        vpermTables[NIBBLE_SQUARE_LAMBDA][n] = nibbleMultiply(square, lambda);
+        vpermTables[NIBBLE_LOG][n] = LOG_ZERO;
+        vpermTables[NIBBLE_LOG_INV][n] = LOG_ZERO;
+    }
+    // x is a generator of GF(2^4) modulo x^4 + x + 1
+    for (byte i = 0, power = 1; i < 15; ++i) {
+        vpermTables[NIBBLE_EXP][i] = power;
+        vpermTables[NIBBLE_LOG][power] = i;
+        vpermTables[NIBBLE_LOG_INV][power] = (byte) ((15 - i) % 15);
+        power = nibbleMultiply(power, 0x02);
+    }
+    vpermTables[NIBBLE_EXP][15] = 0;
+
+    // the state is stored by columns, byte (r, c) at 4c + r
+    for (int c = 0; c < 4; ++c) {
+        for (int r = 0; r < 4; ++r) {
+            vpermTables[SHIFT_ROWS][4 * c + r] = (byte) (4 * ((c + r) & 3) + r);
+            vpermTables[INV_SHIFT_ROWS][4 * c + r] = (byte) (4 * ((c - r) & 3) + r);
+            vpermTables[ROTATE_1][4 * c + r] = (byte) (4 * c + ((r + 1) & 3));
+            vpermTables[ROTATE_2][4 * c + r] = (byte) (4 * c + ((r + 2) & 3));
+            vpermTables[ROTATE_3][4 * c + r] = (byte) (4 * c + ((r + 3) & 3));
+        }
+    }
+}
+
+
+typedef struct {
+    __m128i towerLo, towerHi, sboxLo, sboxHi;
+    __m128i log, logInv, exp, square, squareLambda;
+    __m128i shiftRows, rotate1, rotate2, rotate3;
+    __m128i low, fifteen, poly;
+} VpermConst;
+
+
+TARGET_VPERM
+static void vpermLoad(VpermConst *k, int decrypt) {
+#define LOAD(i) _mm_loadu_si128((const __m128i *) vpermTables[i])
+    k->towerLo = decrypt ? LOAD(INV_TOWER_LO) : LOAD(TOWER_LO);
+    k->towerHi = decrypt ? LOAD(INV_TOWER_HI) : LOAD(TOWER_HI);
+    k->sboxLo = decrypt ? LOAD(INV_SBOX_LO) : LOAD(SBOX_LO);
+    k->sboxHi = decrypt ? LOAD(INV_SBOX_HI) : LOAD(SBOX_HI);
+    k->shiftRows = decrypt ? LOAD(INV_SHIFT_ROWS) : LOAD(SHIFT_ROWS);
+    k->log = LOAD(NIBBLE_LOG);
+    k->logInv = LOAD(NIBBLE_LOG_INV);
+    k->exp = LOAD(NIBBLE_EXP);
+    k->square = LOAD(NIBBLE_SQUARE);
+    k->squareLambda = LOAD(NIBBLE_SQUARE_LAMBDA);
+    k->rotate1 = LOAD(ROTATE_1);
+    k->rotate2 = LOAD(ROTATE_2);
+    k->rotate3 = LOAD(ROTATE_3);
+    k->low = _mm_set1_epi8(0x0F);
+    k->fifteen = _mm_set1_epi8(15);
+    k->poly = _mm_set1_epi8(0x1B);
+#undef LOAD
+}
+
+
+/**
+ * Exponent of the sum of two logarithms, that is the product of the two nibbles.
+ */
+TARGET_VPERM
+static __m128i vpermProduct(const VpermConst *k, __m128i logA, __m128i logB) {
+    __m128i sum = _mm_add_epi8(logA, logB);
+
+    // reduce modulo 15, the sums with the logarithm of zero keep the high bit
+    sum = _mm_min_epu8(sum, _mm_sub_epi8(sum, k->fifteen));
+    return _mm_shuffle_epi8(k->exp, sum);
+}
+
+
+/**
+ * SubBytes (or InvSubBytes, depending on the loaded tables) of all 16 bytes.
+ */
+TARGET_VPERM
+static __m128i vpermSubBytes(const VpermConst *k, __m128i x) {
+    __m128i t = _mm_xor_si128(_mm_shuffle_epi8(k->towerLo, _mm_and_si128(x, k->low)),
+                              _mm_shuffle_epi8(k->towerHi, _mm_and_si128(_mm_srli_epi16(x, 4), k->low)));
+    __m128i hi = _mm_and_si128(_mm_srli_epi16(t, 4), k->low);
+    __m128i lo = _mm_and_si128(t, k->low);
+    __m128i logHi = _mm_shuffle_epi8(k->log, hi);
+    __m128i logLo = _mm_shuffle_epi8(k->log, lo);
+
+    // (hi X + lo)^-1 = (hi X + hi + lo) / (hi^2 lambda + hi lo + lo^2)
+    __m128i norm = _mm_xor_si128(_mm_xor_si128(_mm_shuffle_epi8(k->squareLambda, hi),
+                                               _mm_shuffle_epi8(k->square, lo)),
+                                 vpermProduct(k, logHi, logLo));
+    __m128i logNormInv = _mm_shuffle_epi8(k->logInv, norm);
+    __m128i invHi = vpermProduct(k, logHi, logNormInv);
+    __m128i invLo = vpermProduct(k, _mm_shuffle_epi8(k->log, _mm_xor_si128(hi, lo)), logNormInv);
+
+    return _mm_xor_si128(_mm_shuffle_epi8(k->sboxLo, invLo), _mm_shuffle_epi8(k->sboxHi, invHi));
+}
+
+
+TARGET_VPERM
+static __m128i vpermXtime(const VpermConst *k, __m128i x) {
+    __m128i carry = _mm_cmpgt_epi8(_mm_setzero_si128(), x);
+    return _mm_xor_si128(_mm_add_epi8(x, x), _mm_and_si128(carry, k->poly));
+}
+
+
+TARGET_VPERM
+static __m128i vpermMixColumns(const VpermConst *k, __m128i x) {
+    __m128i x1 = _mm_shuffle_epi8(x, k->rotate1);
+
+    // 2 a0 + 3 a1 + a2 + a3 = 2 (a0 + a1) + a1 + a2 + a3
+    return _mm_xor_si128(_mm_xor_si128(vpermXtime(k, _mm_xor_si128(x, x1)), x1),
+                         _mm_xor_si128(_mm_shuffle_epi8(x, k->rotate2), _mm_shuffle_epi8(x, k->rotate3)));
+}
+
+
+TARGET_VPERM
+static __m128i vpermInvMixColumns(const VpermConst *k, __m128i x) {
+    // InvMixColumns = MixColumns after adding 4 (a0 + a2) to a0 and a2, 4 (a1 + a3) to a1 and a3
+    __m128i u = vpermXtime(k, vpermXtime(k, _mm_xor_si128(x, _mm_shuffle_epi8(x, k->rotate2))));
+    return vpermMixColumns(k, _mm_xor_si128(x, u));
+}
+
+
+TARGET_VPERM
+static void vpermEncryptBlocks(const byte *roundKey, int rounds, byte *data, size_t blockCount) {
+    __m128i key[MAX_ROUNDS + 1];
+    VpermConst k;
+
+    vpermLoad(&k, 0);
+    for (int i = 0; i <= rounds; ++i) {
+        key[i] = _mm_loadu_si128((const __m128i *) (roundKey + i * AES_BLOCK_SIZE));
+    }
+
+    for (size_t block = 0; block < blockCount; ++block) {
+        __m128i *ptr = (__m128i *) (data + block * AES_BLOCK_SIZE);
+        __m128i state = _mm_xor_si128(_mm_loadu_si128(ptr), key[0]);
+
+        for (int round = 1; round < rounds; ++round) {
+            state = _mm_shuffle_epi8(vpermSubBytes(&k, state), k.shiftRows);
+            state = _mm_xor_si128(vpermMixColumns(&k, state), key[round]);
+        }
+        state = _mm_shuffle_epi8(vpermSubBytes(&k, state), k.shiftRows);
+        _mm_storeu_si128(ptr, _mm_xor_si128(state, key[rounds]));
+    }
+}
+
+
+TARGET_VPERM
+static void vpermDecryptBlocks(const byte *roundKey, int rounds, byte *data, size_t blockCount) {
+    __m128i key[MAX_ROUNDS + 1];
+    VpermConst k;
+
+    vpermLoad(&k, 1);
+    for (int i = 0; i <= rounds; ++i) {
+        key[i] = _mm_loadu_si128((const __m128i *) (roundKey + i * AES_BLOCK_SIZE));
+    }
+
+    for (size_t block = 0; block < blockCount; ++block) {
+        __m128i *ptr = (__m128i *) (data + block * AES_BLOCK_SIZE);
+        __m128i state = _mm_xor_si128(_mm_loadu_si128(ptr), key[0]);
+
+        for (int round = 1; round < rounds; ++round) {
+            state = vpermSubBytes(&k, _mm_shuffle_epi8(state, k.shiftRows));
+            state = _mm_xor_si128(vpermInvMixColumns(&k, state), key[round]);
+        }
+        state = vpermSubBytes(&k, _mm_shuffle_epi8(state, k.shiftRows));
+        _mm_storeu_si128(ptr, _mm_xor_si128(state, key[rounds]));
+    }
+}
+
+
+const EngineAES vpermEngineAES = {
+        "ssse3-vperm",
+        FEATURE_SSSE3,
+        vpermInit,
+        vpermEncryptBlocks,
+        vpermDecryptBlocks,
+        NULL
+};
+
+#endif // _HARDWARE_AES
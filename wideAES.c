@@ -0,0 +1,193 @@
+/*
+ * AES crypter
+ *
+ * Engines on the VAES instructions, one instruction runs a round on several blocks at once:
+ * four blocks in a 512-bit register (AVX-512) or two blocks in a 256-bit register (AVX2).
+ *
+ * Sixteen blocks are kept in work to hide the latency of the instructions. The blocks that
+ * remain after that go through whole registers, and the last partial register is loaded and
+ * stored with a mask (AVX-512) or through the 128-bit AES-NI instructions (AVX2).
+ */
+#include "engineAES.h"
+
+#ifdef _WIDE_AES
+
+#include <immintrin.h>
+
+#ifdef _MSC_VER
+#define TARGET_WIDE_256
+#define TARGET_WIDE_512
+#else // _MSC_VER
+#define TARGET_WIDE_256 __attribute__((target("aes,vaes,avx2")))
+#define TARGET_WIDE_512 __attribute__((target("aes,vaes,avx512f")))
+#endif // _MSC_VER
+
+// the number of blocks in work at once
+#define WIDE_BLOCKS 16
+
+// one middle round on the group of blocks and on one register, expanded for each round by ROUNDS_AES_*
+#define WIDE512_ENCRYPT_GROUP(round)                            \
+        state[0] = _mm512_aesenc_epi128(state[0], key[round]);  \
+        state[1] = _mm512_aesenc_epi128(state[1], key[round]);  \
+        state[2] = _mm512_aesenc_epi128(state[2], key[round]);  \
+        state[3] = _mm512_aesenc_epi128(state[3], key[round]);
+#define WIDE512_ENCRYPT_ONE(round) state = _mm512_aesenc_epi128(state, key[round]);
+#define WIDE512_DECRYPT_GROUP(round)                            \
+        state[0] = _mm512_aesdec_epi128(state[0], key[round]);  \
+        state[1] = _mm512_aesdec_epi128(state[1], key[round]);  \
+        state[2] = _mm512_aesdec_epi128(state[2], key[round]);  \
+        state[3] = _mm512_aesdec_epi128(state[3], key[round]);
+#define WIDE512_DECRYPT_ONE(round) state = _mm512_aesdec_epi128(state, key[round]);
+#define WIDE256_ENCRYPT_GROUP(round)                            \
+        state[0] = _mm256_aesenc_epi128(state[0], key[round]);  \
+        state[1] = _mm256_aesenc_epi128(state[1], key[round]);  \
+        state[2] = _mm256_aesenc_epi128(state[2], key[round]);  \
+        state[3] = _mm256_aesenc_epi128(state[3], key[round]);  \
+        state[4] = _mm256_aesenc_epi128(state[4], key[round]);  \
+        state[5] = _mm256_aesenc_epi128(state[5], key[round]);  \
+        state[6] = _mm256_aesenc_epi128(state[6], key[round]);  \
+        state[7] = _mm256_aesenc_epi128(state[7], key[round]);
+#define WIDE256_ENCRYPT_ONE(round) state = _mm256_aesenc_epi128(state, key[round]);
+#define WIDE256_ENCRYPT_LAST_BLOCK(round) state = _mm_aesenc_si128(state, _mm256_castsi256_si128(key[round]));
+#define WIDE256_DECRYPT_GROUP(round)                            \
+        state[0] = _mm256_aesdec_epi128(state[0], key[round]);  \
+        state[1] = _mm256_aesdec_epi128(state[1], key[round]);  \
+        state[2] = _mm256_aesdec_epi128(state[2], key[round]);  \
+        state[3] = _mm256_aesdec_epi128(state[3], key[round]);  \
+        state[4] = _mm256_aesdec_epi128(state[4], key[round]);  \
+        state[5] = _mm256_aesdec_epi128(state[5], key[round]);  \
+        state[6] = _mm256_aesdec_epi128(state[6], key[round]);  \
+        state[7] = _mm256_aesdec_epi128(state[7], key[round]);
+#define WIDE256_DECRYPT_ONE(round) state = _mm256_aesdec_epi128(state, key[round]);
+#define WIDE256_DECRYPT_LAST_BLOCK(round) state = _mm_aesdec_si128(state, _mm256_castsi256_si128(key[round]));
+
+/*
+ * Generate the functions for one number of rounds, all rounds are unrolled so the round keys stay in registers.
+ * VAESDEC works like VAESENC with the round keys of the equivalent inverse cipher, so both directions have one shape.
+ */
+#define WIDE512_SPECIALIZE(name, rounds, ROUNDS, GROUP, ONE, last)                                                  \
+TARGET_WIDE_512                                                                                                     \
+static void name(const byte *roundKey, byte *data, size_t blockCount) {                                             \
+    __m512i key[rounds + 1];                                                                                        \
+    size_t block = 0;                                                                                               \
+                                                                                                                    \
+    for (int i = 0; i <= rounds; ++i) {                                                                             \
+        key[i] = _mm512_broadcast_i32x4(_mm_loadu_si128((const __m128i *) (roundKey + i * AES_BLOCK_SIZE)));        \
+    }                                                                                                               \
+                                                                                                                    \
+    for (; block + WIDE_BLOCKS <= blockCount; block += WIDE_BLOCKS) {                                               \
+        byte *ptr = data + block * AES_BLOCK_SIZE;                                                                  \
+        __m512i state[WIDE_BLOCKS / 4];                                                                             \
+                                                                                                                    \
+        for (int j = 0; j < WIDE_BLOCKS / 4; ++j) {                                                                 \
+            state[j] = _mm512_xor_si512(_mm512_loadu_si512(ptr + j * 64), key[0]);                                  \
+        }                                                                                                           \
+        ROUNDS(GROUP)                                                                                               \
+        for (int j = 0; j < WIDE_BLOCKS / 4; ++j) {                                                                 \
+            _mm512_storeu_si512(ptr + j * 64, last(state[j], key[rounds]));                                         \
+        }                                                                                                           \
+    }                                                                                                               \
+                                                                                                                    \
+    for (; block < blockCount; block += 4) {                                                                        \
+        byte *ptr = data + block * AES_BLOCK_SIZE;                                                                  \
+        /* two 64-bit lanes per block, the mask covers the blocks that are left */                                  \
+        __mmask8 mask = blockCount - block >= 4 ? 0xFF : (__mmask8) ((1u << ((blockCount - block) * 2)) - 1);       \
+        __m512i state = _mm512_xor_si512(_mm512_maskz_loadu_epi64(mask, ptr), key[0]);                              \
+                                                                                                                    \
+        ROUNDS(ONE)                                                                                                 \
+        _mm512_mask_storeu_epi64(ptr, mask, last(state, key[rounds]));                                              \
+    }                                                                                                               \
+}
+
+#define WIDE256_SPECIALIZE(name, rounds, ROUNDS, GROUP, ONE, LAST_BLOCK, last, lastBlock)                           \
+TARGET_WIDE_256                                                                                                     \
+static void name(const byte *roundKey, byte *data, size_t blockCount) {                                             \
+    __m256i key[rounds + 1];                                                                                        \
+    size_t block = 0;                                                                                               \
+                                                                                                                    \
+    for (int i = 0; i <= rounds; ++i) {                                                                             \
+        key[i] = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *) (roundKey + i * AES_BLOCK_SIZE)));   \
+    }                                                                                                               \
+                                                                                                                    \
+    for (; block + WIDE_BLOCKS <= blockCount; block += WIDE_BLOCKS) {                                               \
+        __m256i *ptr = (__m256i *) (data + block * AES_BLOCK_SIZE);                                                 \
+        __m256i state[WIDE_BLOCKS / 2];                                                                             \
+                                                                                                                    \
+        for (int j = 0; j < WIDE_BLOCKS / 2; ++j) {                                                                 \
+            state[j] = _mm256_xor_si256(_mm256_loadu_si256(ptr + j), key[0]);                                       \
+        }                                                                                                           \
+        ROUNDS(GROUP)                                                                                               \
+        for (int j = 0; j < WIDE_BLOCKS / 2; ++j) {                                                                 \
+            _mm256_storeu_si256(ptr + j, last(state[j], key[rounds]));                                              \
+        }                                                                                                           \
+    }                                                                                                               \
+                                                                                                                    \
+    for (; block + 2 <= blockCount; block += 2) {                                                                   \
+        __m256i *ptr = (__m256i *) (data + block * AES_BLOCK_SIZE);                                                 \
+        __m256i state = _mm256_xor_si256(_mm256_loadu_si256(ptr), key[0]);                                          \
+                                                                                                                    \
+        ROUNDS(ONE)                                                                                                 \
+        _mm256_storeu_si256(ptr, last(state, key[rounds]));                                                         \
+    }                                                                                                               \
+                                                                                                                    \
+    /* the last odd block goes through the 128-bit instructions */                                                  \
+    if (block < blockCount) {                                                                                       \
+        __m128i *ptr = (__m128i *) (data + block * AES_BLOCK_SIZE);                                                 \
+        __m128i state = _mm_xor_si128(_mm_loadu_si128(ptr), _mm256_castsi256_si128(key[0]));                        \
+                                                                                                                    \
+        ROUNDS(LAST_BLOCK)                                                                                          \
+        _mm_storeu_si128(ptr, lastBlock(state, _mm256_castsi256_si128(key[rounds])));                               \
+    }                                                                                                               \
+}
+
+WIDE512_SPECIALIZE(wide512Encrypt128, ROUND_AES_128, ROUNDS_AES_128, WIDE512_ENCRYPT_GROUP, WIDE512_ENCRYPT_ONE,
+                   _mm512_aesenclast_epi128)
+WIDE512_SPECIALIZE(wide512Encrypt192, ROUND_AES_192, ROUNDS_AES_192, WIDE512_ENCRYPT_GROUP, WIDE512_ENCRYPT_ONE,
+                   _mm512_aesenclast_epi128)
+WIDE512_SPECIALIZE(wide512Encrypt256, ROUND_AES_256, ROUNDS_AES_256, WIDE512_ENCRYPT_GROUP, WIDE512_ENCRYPT_ONE,
+                   _mm512_aesenclast_epi128)
+WIDE512_SPECIALIZE(wide512Decrypt128, ROUND_AES_128, ROUNDS_AES_128, WIDE512_DECRYPT_GROUP, WIDE512_DECRYPT_ONE,
+                   _mm512_aesdeclast_epi128)
+WIDE512_SPECIALIZE(wide512Decrypt192, ROUND_AES_192, ROUNDS_AES_192, WIDE512_DECRYPT_GROUP, WIDE512_DECRYPT_ONE,
+                   _mm512_aesdeclast_epi128)
+WIDE512_SPECIALIZE(wide512Decrypt256, ROUND_AES_256, ROUNDS_AES_256, WIDE512_DECRYPT_GROUP, WIDE512_DECRYPT_ONE,
+                   _mm512_aesdeclast_epi128)
+
+WIDE256_SPECIALIZE(wide256Encrypt128, ROUND_AES_128, ROUNDS_AES_128, WIDE256_ENCRYPT_GROUP, WIDE256_ENCRYPT_ONE,
+                   WIDE256_ENCRYPT_LAST_BLOCK, _mm256_aesenclast_epi128, _mm_aesenclast_si128)
+WIDE256_SPECIALIZE(wide256Encrypt192, ROUND_AES_192, ROUNDS_AES_192, WIDE256_ENCRYPT_GROUP, WIDE256_ENCRYPT_ONE,
+                   WIDE256_ENCRYPT_LAST_BLOCK, _mm256_aesenclast_epi128, _mm_aesenclast_si128)
+WIDE256_SPECIALIZE(wide256Encrypt256, ROUND_AES_256, ROUNDS_AES_256, WIDE256_ENCRYPT_GROUP, WIDE256_ENCRYPT_ONE,
+                   WIDE256_ENCRYPT_LAST_BLOCK, _mm256_aesenclast_epi128, _mm_aesenclast_si128)
+WIDE256_SPECIALIZE(wide256Decrypt128, ROUND_AES_128, ROUNDS_AES_128, WIDE256_DECRYPT_GROUP, WIDE256_DECRYPT_ONE,
+                   WIDE256_DECRYPT_LAST_BLOCK, _mm256_aesdeclast_epi128, _mm_aesdeclast_si128)
+WIDE256_SPECIALIZE(wide256Decrypt192, ROUND_AES_192, ROUNDS_AES_192, WIDE256_DECRYPT_GROUP, WIDE256_DECRYPT_ONE,
+                   WIDE256_DECRYPT_LAST_BLOCK, _mm256_aesdeclast_epi128, _mm_aesdeclast_si128)
+WIDE256_SPECIALIZE(wide256Decrypt256, ROUND_AES_256, ROUNDS_AES_256, WIDE256_DECRYPT_GROUP, WIDE256_DECRYPT_ONE,
+                   WIDE256_DECRYPT_LAST_BLOCK, _mm256_aesdeclast_epi128, _mm_aesdeclast_si128)
+
+DISPATCH_ROUNDS(wide512EncryptBlocks, wide512Encrypt)
+DISPATCH_ROUNDS(wide512DecryptBlocks, wide512Decrypt)
+DISPATCH_ROUNDS(wide256EncryptBlocks, wide256Encrypt)
+DISPATCH_ROUNDS(wide256DecryptBlocks, wide256Decrypt)
+
+
+const EngineAES wide512EngineAES = {
+        "vaes-512",
+        FEATURE_AESNI | FEATURE_VAES | FEATURE_AVX512,
+        NULL,
+        wide512EncryptBlocks,
+        wide512DecryptBlocks,
+        NULL
+};
+
+const EngineAES wide256EngineAES = {
+        "vaes-256",
+        FEATURE_AESNI | FEATURE_VAES | FEATURE_AVX2,
+        NULL,
+        wide256EncryptBlocks,
+        wide256DecryptBlocks,
+        NULL
+};
+
+#endif // _WIDE_AES
@@ -0,0 +1,266 @@
+/*
+ * AES crypter
+ *
+ * Key wrapping: AES-KW (RFC 3394) and AES-KWP with padding (RFC 5649).
+ *
+ * A wrap is 6 * n steps over the n 64-bit blocks of the key, each step encrypts one block built from the integrity
+ * value A and one 64-bit block R[i], so the steps of one wrap wait for each other. The wraps of different keys
+ * are independent: each wrap takes one lane, and each engine call encrypts the next step of all lanes with one
+ * expanded KEK. A finished wrap gives its lane to the next one.
+ */
+#include <string.h>
+
+#include "engineAES.h"
+
+// the number of wraps that are processed at once
+#define WRAP_LANES 32
+
+// the size of the integrity value and of the blocks R[i]
+#define WRAP_HALF 8
+
+static const byte wrapIv[WRAP_HALF] = {0xA6, 0xA6, 0xA6, 0xA6, 0xA6, 0xA6, 0xA6, 0xA6};
+static const byte wrapPadIv[4] = {0xA6, 0x59, 0x59, 0xA6};
+
+typedef struct {
+    KeyWrapJobAES *job;
+    // the integrity value A
+    byte a[WRAP_HALF];
+    // the blocks R[1] ... R[n] in the output buffer
+    byte *r;
+    size_t n;
+    // wrapping: the number of finished steps, unwrapping: the number of steps left
+    size_t step;
+} WrapLane;
+
+
+/**
+ * A wrap of one block (only KWP) is one encryption of A | P, all other wraps take 6 * n steps.
+ */
+static size_t wrapSteps(size_t n) {
+    return n == 1 ? 1 : 6 * n;
+}
+
+
+size_t wrapSizeAES(size_t keySize, KeyWrapAES variant) {
+    if (variant == AES_KWP) {
+        return (keySize + WRAP_HALF - 1) / WRAP_HALF * WRAP_HALF + WRAP_HALF;
+    }
+    return keySize + WRAP_HALF;
+}
+
+
+/**
+ * Checks the sizes of the job and prepares its lane for wrapping, returns 1 if the job cannot be wrapped.
+ */
+static int wrapStart(KeyWrapJobAES *job, KeyWrapAES variant, WrapLane *lane) {
+    size_t outputSize = wrapSizeAES(job->inputSize, variant);
+
+    if (job->input == NULL || job->output == NULL || job->outputSize < outputSize) {
+        return 1;
+    }
+    if (variant == AES_KW && (job->inputSize % WRAP_HALF != 0 || job->inputSize < 2 * WRAP_HALF)) {
+        return 1;
+    }
+    if (variant == AES_KWP && (job->inputSize == 0 || job->inputSize > 0xFFFFFFFFu)) {
+        return 1;
+    }
+
+    memmove(job->output + WRAP_HALF, job->input, job->inputSize);
+    if (variant == AES_KW) {
+        memcpy(lane->a, wrapIv, WRAP_HALF);
+    } else {
+        // the alternative IV holds the size of the key (MLI), the key is completed with zeros
+        memcpy(lane->a, wrapPadIv, 4);
+        for (int i = 0; i < 4; ++i) {
+            lane->a[4 + i] = (byte) (job->inputSize >> (24 - i * 8));
+        }
+        memset(job->output + WRAP_HALF + job->inputSize, 0, outputSize - WRAP_HALF - job->inputSize);
+    }
+
+    lane->job = job;
+    lane->r = job->output + WRAP_HALF;
+    lane->n = outputSize / WRAP_HALF - 1;
+    lane->step = 0;
+    job->outputSize = outputSize;
+    return 0;
+}
+
+
+/**
+ * Checks the sizes of the job and prepares its lane for unwrapping, returns 1 if the job cannot be unwrapped.
+ */
+static int unwrapStart(KeyWrapJobAES *job, KeyWrapAES variant, WrapLane *lane) {
+    size_t minimum = variant == AES_KW ? 3 * WRAP_HALF : 2 * WRAP_HALF;
+
+    if (job->input == NULL || job->output == NULL || job->inputSize % WRAP_HALF != 0 || job->inputSize < minimum ||
+        job->outputSize < job->inputSize - WRAP_HALF) {
+        return 1;
+    }
+
+    memcpy(lane->a, job->input, WRAP_HALF);
+    memmove(job->output, job->input + WRAP_HALF, job->inputSize - WRAP_HALF);
+
+    lane->job = job;
+    lane->r = job->output;
+    lane->n = job->inputSize / WRAP_HALF - 1;
+    lane->step = wrapSteps(lane->n);
+    return 0;
+}
+
+
+/**
+ * Checks the integrity value of an unwrapped key and sets the size of the key, the comparison takes the same time
+ * wherever the values differ. If the check fails, the output is cleared.
+ */
+static int unwrapFinish(WrapLane *lane, KeyWrapAES variant) {
+    KeyWrapJobAES *job = lane->job;
+    size_t size = lane->n * WRAP_HALF;
+    byte diff = 0;
+
+    if (variant == AES_KW) {
+        for (int i = 0; i < WRAP_HALF; ++i) {
+            diff |= lane->a[i] ^ wrapIv[i];
+        }
+    } else {
+        size_t mli = 0;
+
+        for (int i = 0; i < 4; ++i) {
+            diff |= lane->a[i] ^ wrapPadIv[i];
+            mli = (mli << 8) | lane->a[4 + i];
+        }
+        // the size is in the last block and the padding is zeros
+        if (mli + WRAP_HALF <= size || mli > size) {
+            diff |= 1;
+        } else {
+            for (size_t i = mli; i < size; ++i) {
+                diff |= lane->r[i];
+            }
+            size = mli;
+        }
+    }
+
+    if (diff != 0) {
+        memset(job->output, 0, lane->n * WRAP_HALF);
+        job->outputSize = 0;
+        return 1;
+    }
+    job->outputSize = size;
+    return 0;
+}
+
+
+/**
+ * Runs the wraps or unwraps of the jobs, the lanes are processed together by the parallel engine.
+ */
+static int wrapRun(const ContextAES *context, KeyWrapAES variant, KeyWrapJobAES *jobs, size_t count, int unwrap) {
+    const EngineAES *engine = dispatchAES()->parallel;
+    WrapLane lane[WRAP_LANES];
+    byte block[WRAP_LANES * AES_BLOCK_SIZE];
+    size_t laneCount = 0, next = 0;
+    int result = 0;
+
+    for (;;) {
+        // the free lanes take the next jobs, the jobs with wrong sizes fail at once
+        for (; laneCount < WRAP_LANES && next < count; ++next) {
+            int failed = unwrap ? unwrapStart(&jobs[next], variant, &lane[laneCount]) :
+                         wrapStart(&jobs[next], variant, &lane[laneCount]);
+
+            jobs[next].result = failed;
+            result |= failed;
+            if (!failed) {
+                ++laneCount;
+            }
+        }
+        if (laneCount == 0) {
+            break;
+        }
+
+        // the block of each lane is A | R[i], for unwrapping A is XORed with the number of the step first
+        for (size_t l = 0; l < laneCount; ++l) {
+            WrapLane *ptr = &lane[l];
+            size_t step = unwrap ? ptr->step - 1 : ptr->step;
+            byte *b = block + l * AES_BLOCK_SIZE;
+
+            memcpy(b, ptr->a, WRAP_HALF);
+            memcpy(b + WRAP_HALF, ptr->r + (step % ptr->n) * WRAP_HALF, WRAP_HALF);
+            if (unwrap && ptr->n > 1) {
+                for (int i = 0; i < WRAP_HALF; ++i) {
+                    b[i] ^= (byte) ((uint64_t) (step + 1) >> (56 - i * 8));
+                }
+            }
+        }
+
+        if (unwrap) {
+            engine->decryptBlocks((const byte *) context->invRoundKey, context->rounds, block, laneCount);
+        } else {
+            engine->encryptBlocks((const byte *) context->roundKey, context->rounds, block, laneCount);
+        }
+
+        for (size_t l = 0; l < laneCount;) {
+            WrapLane *ptr = &lane[l];
+            size_t step = unwrap ? ptr->step - 1 : ptr->step;
+            byte *b = block + l * AES_BLOCK_SIZE;
+            int finished;
+
+            memcpy(ptr->a, b, WRAP_HALF);
+            memcpy(ptr->r + (step % ptr->n) * WRAP_HALF, b + WRAP_HALF, WRAP_HALF);
+            if (!unwrap && ptr->n > 1) {
+                for (int i = 0; i < WRAP_HALF; ++i) {
+                    ptr->a[i] ^= (byte) ((uint64_t) (step + 1) >> (56 - i * 8));
+                }
+            }
+
+            if (unwrap) {
+                finished = --ptr->step == 0;
+            } else {
+                finished = ++ptr->step == wrapSteps(ptr->n);
+            }
+            if (!finished) {
+                ++l;
+                continue;
+            }
+
+            // the finished wraps write the integrity value, their lanes are dropped
+            if (unwrap) {
+                ptr->job->result = unwrapFinish(ptr, variant);
+                result |= ptr->job->result;
+            } else {
+                memcpy(ptr->job->output, ptr->a, WRAP_HALF);
+            }
+            --laneCount;
+            lane[l] = lane[laneCount];
+            memcpy(block + l * AES_BLOCK_SIZE, block + laneCount * AES_BLOCK_SIZE, AES_BLOCK_SIZE);
+        }
+    }
+    return result;
+}
+
+
+int wrapKeyAES(const ContextAES *context, KeyWrapAES variant, const byte *key, size_t keySize,
+               byte *output, size_t *outputSize) {
+    KeyWrapJobAES job = {key, keySize, output, *outputSize, 0};
+    int result = wrapRun(context, variant, &job, 1, 0);
+
+    *outputSize = job.outputSize;
+    return result;
+}
+
+
+int unwrapKeyAES(const ContextAES *context, KeyWrapAES variant, const byte *data, size_t dataSize,
+                 byte *output, size_t *outputSize) {
+    KeyWrapJobAES job = {data, dataSize, output, *outputSize, 0};
+    int result = wrapRun(context, variant, &job, 1, 1);
+
+    *outputSize = job.outputSize;
+    return result;
+}
+
+
+int wrapKeyBatchAES(const ContextAES *context, KeyWrapAES variant, KeyWrapJobAES *jobs, size_t count) {
+    return wrapRun(context, variant, jobs, count, 0);
+}
+
+
+int unwrapKeyBatchAES(const ContextAES *context, KeyWrapAES variant, KeyWrapJobAES *jobs, size_t count) {
+    return wrapRun(context, variant, jobs, count, 1);
+}
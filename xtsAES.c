@@ -0,0 +1,248 @@
+/*
+ * AES crypter
+ *
+ * XTS mode (IEEE 1619, SP 800-38E) for the encryption of sectors.
+ *
+ * Each block is XORed with its tweak before and after the encryption, the tweak of the first block is the number
+ * of the sector encrypted with the second key, the tweak of each next block is the previous one multiplied by x
+ * in GF(2^128). The tweaks of a group of blocks are computed first, then the whole group goes through
+ * the parallel engine at once. If the size is not a multiple of 16 bytes, the last two blocks use ciphertext stealing.
+ */
+#include <string.h>
+
+#include "engineAES.h"
+
+#ifdef _HARDWARE_AES
+
+#include <emmintrin.h>
+
+#ifdef _MSC_VER
+#define TARGET_XTS
+#else // _MSC_VER
+#define TARGET_XTS __attribute__((target("sse2")))
+#endif // _MSC_VER
+
+#endif // _HARDWARE_AES
+
+// the number of blocks (and of sectors for the tweaks) that go to the engine at once
+#define XTS_BLOCKS 32
+
+
+/**
+ * Multiplies the tweak by x, the tweak is a 128-bit little-endian number.
+ */
+static void xtsDouble(byte *tweak) {
+    byte carry = 0;
+
+    for (int i = 0; i < AES_BLOCK_SIZE; ++i) {
+        byte next = tweak[i] >> 7;
+
+        tweak[i] = (byte) ((tweak[i] << 1) | carry);
+        carry = next;
+    }
+    if (carry) {
+        tweak[0] ^= 0x87;
+    }
+}
+
+
+#ifdef _HARDWARE_AES
+/**
+ * The same as xtsDouble in a vector register: each 32-bit lane is shifted left by one bit, the top bit of a lane goes
+ * to the next lane and the top bit of the last lane is reduced with 0x87.
+ */
+TARGET_XTS
+static void xtsTweaksVector(byte *tweak, byte *tweaks, size_t count) {
+    const __m128i reduce = _mm_set_epi32(1, 1, 1, 0x87);
+    __m128i t = _mm_loadu_si128((const __m128i *) tweak);
+
+    for (size_t i = 0; i < count; ++i) {
+        __m128i carry = _mm_and_si128(_mm_shuffle_epi32(_mm_srai_epi32(t, 31), 0x93), reduce);
+
+        _mm_storeu_si128((__m128i *) (tweaks + i * AES_BLOCK_SIZE), t);
+        t = _mm_xor_si128(_mm_slli_epi32(t, 1), carry);
+    }
+    _mm_storeu_si128((__m128i *) tweak, t);
+}
+#endif // _HARDWARE_AES
+
+
+/**
+ * Writes the tweaks of count blocks from the given one and advances it to the tweak of the block after them.
+ */
+static void xtsTweaks(byte *tweak, byte *tweaks, size_t count) {
+#ifdef _HARDWARE_AES
+    // SSE2 comes with any processor that has SSSE3
+    if (dispatchAES()->features & FEATURE_SSSE3) {
+        xtsTweaksVector(tweak, tweaks, count);
+        return;
+    }
+#endif // _HARDWARE_AES
+    for (size_t i = 0; i < count; ++i) {
+        memcpy(tweaks + i * AES_BLOCK_SIZE, tweak, AES_BLOCK_SIZE);
+        xtsDouble(tweak);
+    }
+}
+
+
+/**
+ * Encrypts or decrypts whole blocks with the tweaks from the given one, the tweak is advanced past them.
+ */
+static void xtsBlocks(const ContextXtsAES *context, byte *tweak, byte *data, size_t blockCount, int decrypt) {
+    const EngineAES *engine = dispatchAES()->parallel;
+    const ContextAES *key = &context->dataKey;
+    byte tweaks[XTS_BLOCKS * AES_BLOCK_SIZE];
+
+    for (size_t block = 0; block < blockCount; block += XTS_BLOCKS) {
+        size_t count = blockCount - block < XTS_BLOCKS ? blockCount - block : XTS_BLOCKS;
+        byte *ptr = data + block * AES_BLOCK_SIZE;
+
+        xtsTweaks(tweak, tweaks, count);
+        for (size_t i = 0; i < count * AES_BLOCK_SIZE; ++i) {
+            ptr[i] ^= tweaks[i];
+        }
+        if (decrypt) {
+            engine->decryptBlocks((const byte *) key->invRoundKey, key->rounds, ptr, count);
+        } else {
+            engine->encryptBlocks((const byte *) key->roundKey, key->rounds, ptr, count);
+        }
+        for (size_t i = 0; i < count * AES_BLOCK_SIZE; ++i) {
+            ptr[i] ^= tweaks[i];
+        }
+    }
+}
+
+
+/**
+ * Encrypts or decrypts one data unit (a sector), tweak accepts the encrypted tweak of its first block.
+ */
+static void xtsUnit(const ContextXtsAES *context, byte *tweak, byte *data, size_t dataSize, int decrypt) {
+    size_t blockCount = dataSize / AES_BLOCK_SIZE;
+    size_t tail = dataSize % AES_BLOCK_SIZE;
+    byte *last;
+
+    if (tail == 0) {
+        xtsBlocks(context, tweak, data, blockCount, decrypt);
+        return;
+    }
+
+    // ciphertext stealing: the last whole block and the partial block are processed separately
+    xtsBlocks(context, tweak, data, blockCount - 1, decrypt);
+    last = data + (blockCount - 1) * AES_BLOCK_SIZE;
+
+    if (decrypt) {
+        // the last whole block was encrypted with the tweak of the partial block
+        byte previous[AES_BLOCK_SIZE];
+
+        memcpy(previous, tweak, AES_BLOCK_SIZE);
+        xtsDouble(tweak);
+        xtsBlocks(context, tweak, last, 1, 1);
+        memcpy(tweak, previous, AES_BLOCK_SIZE);
+    } else {
+        xtsBlocks(context, tweak, last, 1, 0);
+    }
+
+    // the partial block takes the first bytes of the processed block, they are replaced by the partial block
+    for (size_t i = 0; i < tail; ++i) {
+        byte tmp = last[i];
+
+        last[i] = last[AES_BLOCK_SIZE + i];
+        last[AES_BLOCK_SIZE + i] = tmp;
+    }
+    xtsBlocks(context, tweak, last, 1, decrypt);
+}
+
+
+int initXtsAES(ContextXtsAES *context, const byte *key, VersionAES version) {
+    size_t keySize = version == AES_128 ? KEY_AES_128 : KEY_AES_256;
+
+    // XTS is defined only for AES-128 and AES-256
+    if (context == NULL || key == NULL || (version != AES_128 && version != AES_256)) {
+        return 1;
+    }
+
+    initContextAES(&context->dataKey, key, version);
+    initContextAES(&context->tweakKey, key + keySize, version);
+    return 0;
+}
+
+
+void freeXtsAES(ContextXtsAES *context) {
+    if (context == NULL) {
+        return;
+    }
+    freeContextAES(&context->dataKey);
+    freeContextAES(&context->tweakKey);
+}
+
+
+static int xtsCrypt(const ContextXtsAES *context, const byte *tweak, byte *data, size_t dataSize, int decrypt) {
+    const ContextAES *key = &context->tweakKey;
+    byte encryptedTweak[AES_BLOCK_SIZE];
+
+    if (tweak == NULL || dataSize < AES_BLOCK_SIZE) {
+        return 1;
+    }
+
+    memcpy(encryptedTweak, tweak, AES_BLOCK_SIZE);
+    dispatchAES()->serial->encryptBlocks((const byte *) key->roundKey, key->rounds, encryptedTweak, 1);
+    xtsUnit(context, encryptedTweak, data, dataSize, decrypt);
+    return 0;
+}
+
+
+int encryptXtsAES(const ContextXtsAES *context, const byte *tweak, byte *data, size_t dataSize) {
+    return xtsCrypt(context, tweak, data, dataSize, 0);
+}
+
+
+int decryptXtsAES(const ContextXtsAES *context, const byte *tweak, byte *data, size_t dataSize) {
+    return xtsCrypt(context, tweak, data, dataSize, 1);
+}
+
+
+/**
+ * The tweaks of a group of sectors are encrypted at once by the parallel engine, then the sectors are processed.
+ */
+static int xtsSectors(const ContextXtsAES *context, uint64_t sector, byte *data, size_t sectorSize,
+                      size_t sectorCount, int decrypt) {
+    const EngineAES *engine = dispatchAES()->parallel;
+    const ContextAES *key = &context->tweakKey;
+    byte tweaks[XTS_BLOCKS * AES_BLOCK_SIZE];
+
+    if (sectorSize < AES_BLOCK_SIZE) {
+        return 1;
+    }
+
+    for (size_t done = 0; done < sectorCount; done += XTS_BLOCKS) {
+        size_t count = sectorCount - done < XTS_BLOCKS ? sectorCount - done : XTS_BLOCKS;
+
+        // the tweak is the number of the sector, a 128-bit little-endian number
+        memset(tweaks, 0, count * AES_BLOCK_SIZE);
+        for (size_t i = 0; i < count; ++i) {
+            uint64_t number = sector + done + i;
+
+            for (int j = 0; j < 8; ++j) {
+                tweaks[i * AES_BLOCK_SIZE + j] = (byte) (number >> (j * 8));
+            }
+        }
+        engine->encryptBlocks((const byte *) key->roundKey, key->rounds, tweaks, count);
+
+        for (size_t i = 0; i < count; ++i) {
+            xtsUnit(context, tweaks + i * AES_BLOCK_SIZE, data + (done + i) * sectorSize, sectorSize, decrypt);
+        }
+    }
+    return 0;
+}
+
+
+int encryptSectorsXtsAES(const ContextXtsAES *context, uint64_t sector, byte *data, size_t sectorSize,
+                         size_t sectorCount) {
+    return xtsSectors(context, sector, data, sectorSize, sectorCount, 0);
+}
+
+
+int decryptSectorsXtsAES(const ContextXtsAES *context, uint64_t sector, byte *data, size_t sectorSize,
+                         size_t sectorCount) {
+    return xtsSectors(context, sector, data, sectorSize, sectorCount, 1);
+}